@@ -6,28 +6,117 @@
 #define GENESIS_ADDRESSINDEX_H
 #include <uint256.h>
 #include <amount.h>
+#include <compressor.h>
 #include <script/script.h>
+ /** Write n in 1 to 5 bytes that sort like the numbers they encode, so keys
+ *  ordered by height or position stay in order. The leading one bits of the
+ *  first byte count the bytes that follow. */
+template<typename Stream>
+void WriteSortedVarInt(Stream& s, uint32_t n)
+{
+    if (n < 0x80) {
+        ser_writedata8(s, n);
+        return;
+    }
+    n -= 0x80;
+    if (n < 0x4000) {
+        ser_writedata8(s, 0x80 | (n >> 8));
+        ser_writedata8(s, n & 0xff);
+        return;
+    }
+    n -= 0x4000;
+    if (n < 0x200000) {
+        ser_writedata8(s, 0xc0 | (n >> 16));
+        ser_writedata8(s, (n >> 8) & 0xff);
+        ser_writedata8(s, n & 0xff);
+        return;
+    }
+    n -= 0x200000;
+    if (n < 0x10000000) {
+        ser_writedata32be(s, 0xe0000000 | n);
+        return;
+    }
+    n -= 0x10000000;
+    ser_writedata8(s, 0xf0);
+    ser_writedata32be(s, n);
+}
+ template<typename Stream>
+uint32_t ReadSortedVarInt(Stream& s)
+{
+    const uint8_t first = ser_readdata8(s);
+    if (first < 0x80)
+        return first;
+    if (first < 0xc0)
+        return 0x80 + (((uint32_t)(first & 0x3f) << 8) | ser_readdata8(s));
+    if (first < 0xe0) {
+        uint32_t n = (uint32_t)(first & 0x1f) << 16;
+        n |= (uint32_t)ser_readdata8(s) << 8;
+        n |= ser_readdata8(s);
+        return 0x4080 + n;
+    }
+    if (first < 0xf0) {
+        uint32_t n = (uint32_t)(first & 0x0f) << 24;
+        n |= (uint32_t)ser_readdata8(s) << 16;
+        n |= (uint32_t)ser_readdata8(s) << 8;
+        n |= ser_readdata8(s);
+        return 0x204080 + n;
+    }
+    if (first != 0xf0)
+        throw std::ios_base::failure("ReadSortedVarInt(): invalid size");
+    const uint32_t n = ser_readdata32be(s);
+    if (n > 0xffffffff - 0x10204080)
+        throw std::ios_base::failure("ReadSortedVarInt(): size too large");
+    return 0x10204080 + n;
+}
+ /** The script an address index type and hash were taken from. */
+inline CScript GetAddressScript(unsigned int type, const uint160& hashBytes)
+{
+    if (type == 2)
+        return CScript() << OP_HASH160 << ToByteVector(hashBytes) << OP_EQUAL;
+    if (type == 1)
+        return CScript() << OP_DUP << OP_HASH160 << ToByteVector(hashBytes) << OP_EQUALVERIFY << OP_CHECKSIG;
+    return CScript();
+}
+ /** Wrapper for the amount of an address index entry: a varint of the
+ *  compressed absolute amount, with the sign in the lowest bit. */
+class CAddressAmountCompressor
+{
+private:
+    CAmount &nValue;
+ public:
+    explicit CAddressAmountCompressor(CAmount &nValueIn) : nValue(nValueIn) { }
+     template<typename Stream>
+    void Serialize(Stream& s) const {
+        uint64_t n = CTxOutCompressor::CompressAmount(nValue < 0 ? -nValue : nValue) * 2 + (nValue < 0 ? 1 : 0);
+        s << VARINT(n);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        uint64_t n = 0;
+        s >> VARINT(n);
+        nValue = CTxOutCompressor::DecompressAmount(n / 2);
+        if (n & 1)
+            nValue = -nValue;
+    }
+};
  struct CAddressUnspentKey {
     unsigned int type;
     uint160 hashBytes;
     uint256 txhash;
     size_t index;
-     size_t GetSerializeSize() const {
-        return 57;
-    }
-    template<typename Stream>
+     template<typename Stream>
     void Serialize(Stream& s) const {
         ser_writedata8(s, type);
         hashBytes.Serialize(s);
         txhash.Serialize(s);
-        ser_writedata32(s, index);
+        WriteSortedVarInt(s, index);
     }
     template<typename Stream>
     void Unserialize(Stream& s) {
         type = ser_readdata8(s);
         hashBytes.Unserialize(s);
         txhash.Unserialize(s);
-        index = ser_readdata32(s);
+        index = ReadSortedVarInt(s);
     }
      CAddressUnspentKey(unsigned int addressType, uint160 addressHash, uint256 txid, size_t indexValue) {
         type = addressType;
@@ -44,17 +133,26 @@
         txhash.SetNull();
         index = 0;
     }
+     bool IsNull() const {
+        return (type == 0);
+    }
 };
  struct CAddressUnspentValue {
     CAmount satoshis;
     CScript script;
     int blockHeight;
      ADD_SERIALIZE_METHODS;
-     template <typename Stream, typename Operation>
+     // The script is left out: it is rebuilt from the type and hash of the key
+    template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action) {
-        READWRITE(satoshis);
-        READWRITE(*(CScriptBase*)(&script));
-        READWRITE(blockHeight);
+        uint64_t nAmount = ser_action.ForRead() ? 0 : CTxOutCompressor::CompressAmount(satoshis);
+        uint32_t nHeight = blockHeight;
+        READWRITE(VARINT(nAmount));
+        READWRITE(VARINT(nHeight));
+        if (ser_action.ForRead()) {
+            satoshis = CTxOutCompressor::DecompressAmount(nAmount);
+            blockHeight = nHeight;
+        }
     }
      CAddressUnspentValue(CAmount sats, CScript scriptPubKey, int height) {
         satoshis = sats;
@@ -81,18 +179,15 @@
     uint256 txhash;
     size_t index;
     bool spending;
-     size_t GetSerializeSize() const {
-        return 66;
-    }
-    template<typename Stream>
+     template<typename Stream>
     void Serialize(Stream& s) const {
         ser_writedata8(s, type);
         hashBytes.Serialize(s);
-        // Heights are stored big-endian for key sorting in LevelDB
-        ser_writedata32be(s, blockHeight);
-        ser_writedata32be(s, txindex);
+        // Heights and positions sort as numbers in LevelDB
+        WriteSortedVarInt(s, blockHeight);
+        WriteSortedVarInt(s, txindex);
         txhash.Serialize(s);
-        ser_writedata32(s, index);
+        WriteSortedVarInt(s, index);
         char f = spending;
         ser_writedata8(s, f);
     }
@@ -100,10 +195,10 @@
     void Unserialize(Stream& s) {
         type = ser_readdata8(s);
         hashBytes.Unserialize(s);
-        blockHeight = ser_readdata32be(s);
-        txindex = ser_readdata32be(s);
+        blockHeight = ReadSortedVarInt(s);
+        txindex = ReadSortedVarInt(s);
         txhash.Unserialize(s);
-        index = ser_readdata32(s);
+        index = ReadSortedVarInt(s);
         char f = ser_readdata8(s);
         spending = f;
     }
@@ -129,6 +224,9 @@
         index = 0;
         spending = false;
     }
+     bool IsNull() const {
+        return (type == 0);
+    }
  };
  struct CAddressIndexIteratorKey {
     unsigned int type;
@@ -157,25 +255,51 @@
         type = 0;
         hashBytes.SetNull();
     }
+};
+ struct CAddressBalanceValue {
+    CAmount balance;
+    CAmount received;
+    int64_t txCount;
+    int firstHeight;
+    int lastHeight;
+     ADD_SERIALIZE_METHODS;
+     template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(balance);
+        READWRITE(received);
+        READWRITE(txCount);
+        READWRITE(firstHeight);
+        READWRITE(lastHeight);
+    }
+     CAddressBalanceValue() {
+        SetNull();
+    }
+     void SetNull() {
+        balance = 0;
+        received = 0;
+        txCount = 0;
+        firstHeight = 0;
+        lastHeight = 0;
+    }
+     bool IsNull() const {
+        return (txCount == 0);
+    }
 };
  struct CAddressIndexIteratorHeightKey {
     unsigned int type;
     uint160 hashBytes;
     int blockHeight;
-     size_t GetSerializeSize() const {
-        return 25;
-    }
-    template<typename Stream>
+     template<typename Stream>
     void Serialize(Stream& s) const {
         ser_writedata8(s, type);
         hashBytes.Serialize(s);
-        ser_writedata32be(s, blockHeight);
+        WriteSortedVarInt(s, blockHeight);
     }
     template<typename Stream>
     void Unserialize(Stream& s) {
         type = ser_readdata8(s);
         hashBytes.Unserialize(s);
-        blockHeight = ser_readdata32be(s);
+        blockHeight = ReadSortedVarInt(s);
     }
      CAddressIndexIteratorHeightKey(unsigned int addressType, uint160 addressHash, int height) {
         type = addressType;
@@ -190,6 +314,61 @@
         hashBytes.SetNull();
         blockHeight = 0;
     }
+};
+ /** The address index records in the format written before the compact one,
+ *  read to upgrade older databases. */
+struct CLegacyAddressUnspentKey : public CAddressUnspentKey {
+    using CAddressUnspentKey::CAddressUnspentKey;
+     template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata8(s, type);
+        hashBytes.Serialize(s);
+        txhash.Serialize(s);
+        ser_writedata32(s, index);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        type = ser_readdata8(s);
+        hashBytes.Unserialize(s);
+        txhash.Unserialize(s);
+        index = ser_readdata32(s);
+    }
+};
+ struct CLegacyAddressUnspentValue : public CAddressUnspentValue {
+    using CAddressUnspentValue::CAddressUnspentValue;
+     ADD_SERIALIZE_METHODS;
+     template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(satoshis);
+        READWRITE(*(CScriptBase*)(&script));
+        READWRITE(blockHeight);
+    }
+};
+ struct CLegacyAddressIndexKey : public CAddressIndexKey {
+    using CAddressIndexKey::CAddressIndexKey;
+     template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata8(s, type);
+        hashBytes.Serialize(s);
+        // Heights are stored big-endian for key sorting in LevelDB
+        ser_writedata32be(s, blockHeight);
+        ser_writedata32be(s, txindex);
+        txhash.Serialize(s);
+        ser_writedata32(s, index);
+        char f = spending;
+        ser_writedata8(s, f);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        type = ser_readdata8(s);
+        hashBytes.Unserialize(s);
+        blockHeight = ser_readdata32be(s);
+        txindex = ser_readdata32be(s);
+        txhash.Unserialize(s);
+        index = ser_readdata32(s);
+        char f = ser_readdata8(s);
+        spending = f;
+    }
 };
  struct CMempoolAddressDelta
 {
@@ -4,6 +4,7 @@
 
 #include <bench/bench.h>
 
+#include <crypto/blake2b.h>
 #include <crypto/sha256.h>
 #include <key.h>
 #include <validation.h>
@@ -43,6 +44,7 @@ main(int argc, char** argv)
     }
 
     SHA256AutoDetect();
+    Blake2bAutoDetect();
     RandomInit();
     ECC_Start();
     SetupEnvironment();
@@ -5,6 +5,7 @@
 #include <bench/bench.h>
 #include <coins.h>
 #include <policy/policy.h>
+#include <random.h>
 #include <wallet/crypter.h>
 
 #include <vector>
@@ -85,3 +86,37 @@ static void CCoinsCaching(benchmark::State& state)
 }
 
 BENCHMARK(CCoinsCaching, 170 * 1000);
+
+//! Coins held in the maps below
+static const size_t COINS_MAP_BENCH_SIZE = 100000;
+
+// Fill a coins map, look every coin up and empty it again, with the nodes
+// either pooled (as in CCoinsViewCache) or taken one by one from the heap.
+// Memory use per coin is checked in coins_tests/ccoins_map_pool_usage.
+static void CCoinsMapFillLookup(benchmark::State& state, bool fPool)
+{
+    FastRandomContext rng(true);
+    std::vector<COutPoint> outpoints;
+    outpoints.reserve(COINS_MAP_BENCH_SIZE);
+    for (size_t i = 0; i < COINS_MAP_BENCH_SIZE; i++)
+        outpoints.emplace_back(rng.rand256(), i % 4);
+    const CTxOut txout(50 * CENT, CScript() << OP_TRUE);
+
+    while (state.KeepRunning()) {
+        CCoinsMap map = fPool ?
+            CCoinsMap(0, SaltedOutpointHasher(), std::equal_to<COutPoint>(), CCoinsMapAllocator(std::make_shared<CCoinsMapAllocator::ResourceType>())) :
+            CCoinsMap();
+        for (const COutPoint& outpoint : outpoints)
+            map.emplace(outpoint, CCoinsCacheEntry(Coin(txout, 1, false)));
+        size_t nFound = 0;
+        for (const COutPoint& outpoint : outpoints)
+            nFound += map.count(outpoint);
+        assert(nFound == COINS_MAP_BENCH_SIZE);
+    }
+}
+
+static void CCoinsMapPooled(benchmark::State& state) { CCoinsMapFillLookup(state, true); }
+static void CCoinsMapHeap(benchmark::State& state) { CCoinsMapFillLookup(state, false); }
+
+BENCHMARK(CCoinsMapPooled, 20);
+BENCHMARK(CCoinsMapHeap, 20);
@@ -10,6 +10,7 @@
 #include <random.h>
 #include <uint256.h>
 #include <utiltime.h>
+#include <crypto/blake2b.h>
 #include <crypto/ripemd160.h>
 #include <crypto/sha1.h>
 #include <crypto/sha256.h>
@@ -60,6 +61,48 @@ static void SHA512(benchmark::State& state)
         CSHA512().Write(in.data(), in.size()).Finalize(hash);
 }
 
+/* Equihash leaf hashing: a 140-byte header state extended by a 32-bit index. */
+static void Blake2bLeafState(crypto_generichash_blake2b_state& blake)
+{
+    unsigned char personalization[crypto_generichash_blake2b_PERSONALBYTES] = {};
+    memcpy(personalization, "GENX_PoW", 8);
+    crypto_generichash_blake2b_init_salt_personal(&blake, NULL, 0, 48, NULL, personalization);
+    std::vector<uint8_t> in(140, 0);
+    crypto_generichash_blake2b_update(&blake, in.data(), in.size());
+}
+
+static void BLAKE2b_Leaf(benchmark::State& state)
+{
+    crypto_generichash_blake2b_state blake;
+    Blake2bLeafState(blake);
+    uint8_t hash[48];
+    uint32_t index = 0;
+    while (state.KeepRunning()) {
+        crypto_generichash_blake2b_state leaf = blake;
+        crypto_generichash_blake2b_update(&leaf, (const uint8_t*)&index, sizeof(index));
+        crypto_generichash_blake2b_final(&leaf, hash, sizeof(hash));
+        index++;
+    }
+}
+
+static void BLAKE2b_Leaf_Lanes(benchmark::State& state)
+{
+    crypto_generichash_blake2b_state blake;
+    Blake2bLeafState(blake);
+    CBlake2bLanes lanes;
+    if (!Blake2bPrepareLanes(blake, lanes)) {
+        return;
+    }
+    uint8_t hash[BLAKE2B_LANES][48];
+    uint32_t index[BLAKE2B_LANES] = {0, 1, 2, 3};
+    while (state.KeepRunning()) {
+        Blake2bFinalizeLanes(lanes, index, hash[0], sizeof(hash[0]));
+        for (size_t lane = 0; lane < BLAKE2B_LANES; lane++) {
+            index[lane] += BLAKE2B_LANES;
+        }
+    }
+}
+
 static void SipHash_32b(benchmark::State& state)
 {
     uint256 x;
@@ -93,6 +136,8 @@ BENCHMARK(SHA256, 340);
 BENCHMARK(SHA512, 330);
 
 BENCHMARK(SHA256_32b, 4700 * 1000);
+BENCHMARK(BLAKE2b_Leaf, 1500 * 1000);
+BENCHMARK(BLAKE2b_Leaf_Lanes, 1500 * 1000 / 4);
 BENCHMARK(SipHash_32b, 40 * 1000 * 1000);
 BENCHMARK(FastRandom_32bit, 110 * 1000 * 1000);
 BENCHMARK(FastRandom_1bit, 440 * 1000 * 1000);
@@ -0,0 +1,209 @@
+// Copyright (c) 2018 The Genesis Official developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chainparams.h>
+#include <crypto/common.h>
+#include <crypto/equihash/equihash.h>
+#include <miner.h>
+#include <pow.h>
+#include <utilstrencodings.h>
+
+#include <sodium.h>
+
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Fixed Equihash<192,7> input so that results are comparable across commits:
+// personalization "ZcashPoW", I = "block header", V = 0.
+static const std::string EQUIHASH_BENCH_INPUT = "block header";
+static const std::vector<eh_index> EQUIHASH_BENCH_SOLUTION_192_7 = {
+    353065, 2285352, 4052508, 32655279, 6425581, 32444613, 11132334, 32174742,
+    1135535, 1316591, 23575676, 26779278, 3404916, 6475039, 4315308, 15597112,
+    2911760, 3597648, 6759030, 15705381, 12459724, 14440020, 16882312, 21906755,
+    3174661, 27129465, 16129659, 22569540, 5259078, 18094614, 8875400, 24205139,
+    1662164, 7798741, 3796814, 15097811, 10728390, 15172164, 20355177, 24922893,
+    6050103, 20366309, 7218096, 14000079, 9088775, 25231591, 25186474, 29732788,
+    3135313, 27598632, 8899269, 18785720, 4414764, 7125615, 22658132, 30291704,
+    3407605, 15188295, 14929059, 30950311, 6466754, 18719699, 24328060, 26788476,
+    1115940, 8131871, 9361851, 28340399, 7257918, 25865082, 16370709, 30428733,
+    3091180, 18383070, 13024176, 24377951, 22057650, 31381175, 25115753, 31981131,
+    2334876, 6957228, 12340546, 23797569, 4771942, 18608409, 6551777, 6819468,
+    15223536, 21196245, 22012611, 33005471, 20158855, 26160192, 23145498, 31773052,
+    1391533, 14963314, 5401887, 20882073, 2386662, 17935048, 7734547, 17638475,
+    2839963, 8337948, 10708122, 16330796, 3838556, 6859962, 10041123, 26920400,
+    2148757, 4216446, 10803691, 20931676, 8576127, 15336351, 26438321, 29074181,
+    2760402, 20900170, 17838362, 23109679, 3109494, 25230412, 9248884, 28642724
+};
+
+// A GENX_PoW Equihash<192,7> solution for the main network genesis header
+// (whose own solution predates the switch to 192,7).
+static const char* EQUIHASH_BENCH_GENESIS_SOLUTION_192_7 =
+    "00770941979703070732daf3d0682e561974f97ded7fe006865250eb6323e7aa2be55d4f8df5d67a84dcec62a3777571"
+    "4cfd1465720b2b3569ba68d5257286075ea46d71a73ffa5bd1fd8619d354d61aabdb30d95ae846465e798d8f89665a35"
+    "71b7f47002741fd9084c04991afb383241badb6718a2698b175af7796458e80eda8eb9e15a4d5f303ab671f7cee1ed6e"
+    "377411de6d4a2ef0c7cea55018e461d6305db454556cbb4429599d13cbe1923e2d063b8c8a98ce0b0d872e841a6e0ea9"
+    "e2215e55bcf140240131c61e5be1489ae008ec96051b60d2f9f1def8d31dd5bab8189c4d73743094059518025011e411"
+    "1ad67f41020bf112e06709678b8770b5ca17ae4dc33c17fa1fb48287a3574febd1c69616c0f85321679b27a73120d044"
+    "9afbe6dc4459e087db13fdc60a0cb052de6618f873ef5996d118c4f25347809991cb210aa017a2209fe39a120a06546f"
+    "9de596036636e465e9f9b34310e31c4caacfa45796b6fa51dc5c63b11d159af26627186736a5622cf14772f2cd14795a"
+    "7a3b75f847cb16d40bde730a9fc716bf";
+
+static void EquihashBenchState192_7(eh_HashState& base_state, uint32_t nNonce = 0)
+{
+    Eh192_7.InitialiseState(base_state, "ZcashPoW");
+    crypto_generichash_blake2b_update(&base_state, (const unsigned char*)EQUIHASH_BENCH_INPUT.data(), EQUIHASH_BENCH_INPUT.size());
+    unsigned char nonce[32] = {};
+    WriteLE32(nonce, nNonce);
+    crypto_generichash_blake2b_update(&base_state, nonce, sizeof(nonce));
+}
+
+// A full 192,7 solve takes minutes and several gigabytes per run, so the solver
+// benchmarks only run when GENX_BENCH_EQUIHASH_SOLVE is set in the environment.
+static bool EquihashBenchSolveEnabled()
+{
+    return getenv("GENX_BENCH_EQUIHASH_SOLVE") != nullptr;
+}
+
+// Not every nonce has a solution, so the count is reported rather than checked.
+static void EquihashBenchReportSolutions(const benchmark::State& state, uint32_t nRuns, size_t nSols)
+{
+    std::cerr << state.m_name << ": " << nSols << " solutions in " << nRuns << " runs" << std::endl;
+}
+
+// One iteration verifies one header's solution, so iterations per second
+// equals headers verified per second.
+static void EquihashVerify192_7(benchmark::State& state)
+{
+    eh_HashState base_state;
+    EquihashBenchState192_7(base_state);
+    std::vector<unsigned char> soln = GetMinimalFromIndices(EQUIHASH_BENCH_SOLUTION_192_7, Equihash<192,7>::CollisionBitLength);
+    while (state.KeepRunning()) {
+        bool isValid = Eh192_7.IsValidSolution(base_state, soln);
+        assert(isValid);
+    }
+}
+
+static void EquihashVerify192_7Flat(benchmark::State& state)
+{
+    eh_HashState base_state;
+    EquihashBenchState192_7(base_state);
+    std::vector<unsigned char> soln = GetMinimalFromIndices(EQUIHASH_BENCH_SOLUTION_192_7, Equihash<192,7>::CollisionBitLength);
+    while (state.KeepRunning()) {
+        bool isValid = EquihashFlatVerifier<192,7>::IsValidSolution(base_state, soln);
+        assert(isValid);
+    }
+}
+
+// Includes serializing the header and copying the cached base state, as done
+// for every header received.
+static void EquihashCheckSolution(benchmark::State& state)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    CBlockHeader header = chainParams->GenesisBlock().GetBlockHeader();
+    header.nSolution = ParseHex(EQUIHASH_BENCH_GENESIS_SOLUTION_192_7);
+    while (state.KeepRunning()) {
+        bool isValid = CheckEquihashSolution(&header, *chainParams, "GENX_PoW");
+        assert(isValid);
+    }
+}
+
+static void EquihashGetMinimalFromIndices(benchmark::State& state)
+{
+    while (state.KeepRunning()) {
+        std::vector<unsigned char> minimal = GetMinimalFromIndices(EQUIHASH_BENCH_SOLUTION_192_7, Equihash<192,7>::CollisionBitLength);
+        assert((minimal.size() == Equihash<192,7>::SolutionWidth));
+    }
+}
+
+static void EquihashGetIndicesFromMinimal(benchmark::State& state)
+{
+    std::vector<unsigned char> minimal = GetMinimalFromIndices(EQUIHASH_BENCH_SOLUTION_192_7, Equihash<192,7>::CollisionBitLength);
+    while (state.KeepRunning()) {
+        std::vector<eh_index> indices = GetIndicesFromMinimal(minimal, Equihash<192,7>::CollisionBitLength);
+        assert(indices.size() == EQUIHASH_BENCH_SOLUTION_192_7.size());
+    }
+}
+
+// One iteration is one solver run on the next nonce, and a run yields about
+// two solutions on average, so sols/s is roughly twice the runs per second.
+// The Fresh variant constructs the solver for every nonce, as the miner used
+// to; the other keeps one solver and only resets its bucket counters.
+static void EquihashSolve192_7Tromp(benchmark::State& state)
+{
+    if (!EquihashBenchSolveEnabled())
+        return;
+    CTrompSolver solver(192, 7, 1, DEFAULT_EQUIHASH_HUGE_PAGES);
+    uint32_t nNonce = 0;
+    size_t nSols = 0;
+    while (state.KeepRunning()) {
+        eh_HashState curr_state;
+        EquihashBenchState192_7(curr_state, nNonce++);
+        nSols += solver.Solve(curr_state).size();
+    }
+    EquihashBenchReportSolutions(state, nNonce, nSols);
+}
+
+static void EquihashSolve192_7TrompFresh(benchmark::State& state)
+{
+    if (!EquihashBenchSolveEnabled())
+        return;
+    uint32_t nNonce = 0;
+    size_t nSols = 0;
+    while (state.KeepRunning()) {
+        eh_HashState curr_state;
+        EquihashBenchState192_7(curr_state, nNonce++);
+        std::unique_ptr<CTrompSolver> solver(new CTrompSolver(192, 7, 1, DEFAULT_EQUIHASH_HUGE_PAGES));
+        nSols += solver->Solve(curr_state).size();
+    }
+    EquihashBenchReportSolutions(state, nNonce, nSols);
+}
+
+// One iteration is a full run; select it with -filter when comparing solver
+// changes.
+static void EquihashOptimisedSolve192_7(benchmark::State& state)
+{
+    if (!EquihashBenchSolveEnabled())
+        return;
+    uint32_t nNonce = 0;
+    size_t nSols = 0;
+    while (state.KeepRunning()) {
+        eh_HashState curr_state;
+        EquihashBenchState192_7(curr_state, nNonce++);
+        Eh192_7.OptimisedSolve(curr_state,
+            [&nSols](std::vector<unsigned char> soln) { nSols++; return false; },
+            [](EhSolverCancelCheck pos) { return false; });
+    }
+    EquihashBenchReportSolutions(state, nNonce, nSols);
+}
+
+static void EquihashOptimisedSolve192_7Radix(benchmark::State& state)
+{
+    if (!EquihashBenchSolveEnabled())
+        return;
+    uint32_t nNonce = 0;
+    size_t nSols = 0;
+    while (state.KeepRunning()) {
+        eh_HashState curr_state;
+        EquihashBenchState192_7(curr_state, nNonce++);
+        Eh192_7.OptimisedSolve(curr_state,
+            [&nSols](std::vector<unsigned char> soln) { nSols++; return false; },
+            [](EhSolverCancelCheck pos) { return false; }, true);
+    }
+    EquihashBenchReportSolutions(state, nNonce, nSols);
+}
+
+BENCHMARK(EquihashVerify192_7, 10 * 1000);
+BENCHMARK(EquihashVerify192_7Flat, 15 * 1000);
+BENCHMARK(EquihashSolve192_7Tromp, 1);
+BENCHMARK(EquihashSolve192_7TrompFresh, 1);
+BENCHMARK(EquihashCheckSolution, 10 * 1000);
+BENCHMARK(EquihashGetMinimalFromIndices, 100 * 1000);
+BENCHMARK(EquihashGetIndicesFromMinimal, 100 * 1000);
+BENCHMARK(EquihashOptimisedSolve192_7, 1);
+BENCHMARK(EquihashOptimisedSolve192_7Radix, 1);
@@ -0,0 +1,95 @@
+// Copyright (c) 2018 The Genesis Official developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blocktimeindex.h>
+
+#include <chain.h>
+#include <validation.h>
+
+#include <algorithm>
+
+CBlockTimeIndex blockTimeIndex;
+
+void CBlockTimeIndex::Append(const CBlockIndex* pindex)
+{
+    assert((size_t)pindex->nHeight == vBlock.size());
+    unsigned int nLogicalTime = 0;
+    if (pindex->nHeight > 0) {
+        nLogicalTime = pindex->nTime;
+        if (nLogicalTime <= vLogicalTime.back())
+            nLogicalTime = vLogicalTime.back() + 1;
+    }
+    vBlock.push_back(pindex);
+    vLogicalTime.push_back(nLogicalTime);
+}
+
+void CBlockTimeIndex::Sync()
+{
+    AssertLockHeld(cs_main);
+    while (!vBlock.empty() && !chainActive.Contains(vBlock.back())) {
+        vBlock.pop_back();
+        vLogicalTime.pop_back();
+    }
+    vBlock.reserve(chainActive.Height() + 1);
+    vLogicalTime.reserve(chainActive.Height() + 1);
+    while ((int)vBlock.size() <= chainActive.Height())
+        Append(chainActive[vBlock.size()]);
+    fSynced = true;
+}
+
+void CBlockTimeIndex::Find(unsigned int high, unsigned int low, std::vector<std::pair<uint256, unsigned int> >& hashes) const
+{
+    if (vBlock.size() < 2)
+        return;
+    // The genesis block is not in the timestamp index either
+    std::vector<unsigned int>::const_iterator it = std::lower_bound(vLogicalTime.begin() + 1, vLogicalTime.end(), low);
+    for (; it != vLogicalTime.end() && *it < high; ++it)
+        hashes.push_back(std::make_pair(vBlock[it - vLogicalTime.begin()]->GetBlockHash(), *it));
+}
+
+void CBlockTimeIndex::GetBlockHashes(unsigned int high, unsigned int low, std::vector<std::pair<uint256, unsigned int> >& hashes)
+{
+    {
+        LOCK(cs_blocktime);
+        if (fSynced) {
+            Find(high, low, hashes);
+            return;
+        }
+    }
+
+    LOCK2(cs_main, cs_blocktime);
+    Sync();
+    Find(high, low, hashes);
+}
+
+void CBlockTimeIndex::BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex, const std::vector<CTransactionRef>& txnConflicted)
+{
+    LOCK(cs_blocktime);
+    if (!fSynced)
+        return;
+    const size_t nHeight = pindex->nHeight;
+    if (nHeight < vBlock.size() && vBlock[nHeight] == pindex)
+        return; // already loaded from chainActive
+    if (nHeight > vBlock.size() || (nHeight > 0 && vBlock[nHeight - 1] != pindex->pprev)) {
+        // Missed notifications, or a stale one after loading from chainActive
+        fSynced = false;
+        return;
+    }
+    vBlock.resize(nHeight);
+    vLogicalTime.resize(nHeight);
+    Append(pindex);
+}
+
+void CBlockTimeIndex::BlockDisconnected(const std::shared_ptr<const CBlock>& block)
+{
+    LOCK(cs_blocktime);
+    if (!fSynced)
+        return;
+    if (vBlock.empty() || vBlock.back()->GetBlockHash() != block->GetHash()) {
+        fSynced = false;
+        return;
+    }
+    vBlock.pop_back();
+    vLogicalTime.pop_back();
+}
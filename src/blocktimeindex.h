@@ -0,0 +1,54 @@
+// Copyright (c) 2018 The Genesis Official developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef GENESIS_BLOCKTIMEINDEX_H
+#define GENESIS_BLOCKTIMEINDEX_H
+
+#include <sync.h>
+#include <uint256.h>
+#include <validationinterface.h>
+
+#include <utility>
+#include <vector>
+
+class CBlockIndex;
+
+/**
+ * Logical timestamps of the active chain by height. The logical timestamp of
+ * a block is its nTime, raised to one past that of its parent where needed,
+ * exactly as the timestamp index assigns it. It strictly increases along the
+ * chain, so a time range of active blocks is found by binary search, without
+ * iterating the timestamp index or looking each hash up under cs_main.
+ *
+ * The index follows connected and disconnected blocks through the validation
+ * interface. It is loaded from chainActive, under a single cs_main lock, on
+ * first use and whenever a notification does not fit what it holds.
+ */
+class CBlockTimeIndex : public CValidationInterface
+{
+public:
+    /** Active chain blocks with low <= logical timestamp < high, oldest first, with their logical timestamps. */
+    void GetBlockHashes(unsigned int high, unsigned int low, std::vector<std::pair<uint256, unsigned int> >& hashes);
+
+protected:
+    void BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex, const std::vector<CTransactionRef>& txnConflicted) override;
+    void BlockDisconnected(const std::shared_ptr<const CBlock>& block) override;
+
+private:
+    void Sync();
+    void Append(const CBlockIndex* pindex);
+    void Find(unsigned int high, unsigned int low, std::vector<std::pair<uint256, unsigned int> >& hashes) const;
+
+    CCriticalSection cs_blocktime;
+    //! Active chain by height
+    std::vector<const CBlockIndex*> vBlock;
+    //! Logical timestamp by height. The genesis block has none and is given 0.
+    std::vector<unsigned int> vLogicalTime;
+    //! Whether vBlock is a prefix of some recent active chain
+    bool fSynced = false;
+};
+
+extern CBlockTimeIndex blockTimeIndex;
+
+#endif // GENESIS_BLOCKTIMEINDEX_H
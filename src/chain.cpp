@@ -5,6 +5,28 @@
 
 #include <chain.h>
 
+bool CBlockIndex::GetBlockHeader(CBlockHeader& block, const BlockSolutionReader& readSolution) const
+{
+    block.nVersion       = nVersion;
+    block.hashPrevBlock  = pprev ? pprev->GetBlockHash() : uint256();
+    block.hashMerkleRoot = hashMerkleRoot;
+    block.nHeight        = nHeight;
+    block.hashReserved   = hashReserved;
+    block.nTime          = nTime;
+    block.nBits          = nBits;
+    block.nNonce         = nNonce;
+    return GetSolution(block.nSolution, readSolution);
+}
+
+bool CBlockIndex::GetSolution(std::vector<unsigned char>& solution, const BlockSolutionReader& readSolution) const
+{
+    if (HasSolution()) {
+        solution = nSolution;
+        return true;
+    }
+    return readSolution && readSolution(GetBlockHash(), solution);
+}
+
 /**
  * CChain implementation
  */
@@ -12,6 +12,7 @@
 #include <tinyformat.h>
 #include <uint256.h>
 
+#include <functional>
 #include <vector>
 
 /**
@@ -162,6 +163,9 @@ enum BlockStatus: uint32_t {
     BLOCK_OPT_WITNESS       =   128, //!< block data in blk*.data was received with a witness-enforcing client
 };
 
+/** Reads the solution of the block with the given hash from storage. Returns false if it could not be read. */
+typedef std::function<bool(const uint256&, std::vector<unsigned char>&)> BlockSolutionReader;
+
 /** The block chain is a tree shaped structure starting with the
  * genesis block at the root, with each block potentially having multiple
  * candidates to be the next block. A blockindex may have multiple pprev pointing
@@ -213,6 +217,8 @@ public:
     uint32_t nTime;
     uint32_t nBits;
     uint256 nNonce;
+    //! Equihash solution. Only held until the entry has been written to the
+    //! block tree DB; use ReadBlockSolution() or ReadBlockHeader() to read it.
     std::vector<unsigned char> nSolution;
 
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
@@ -283,22 +289,24 @@ public:
         return ret;
     }
 
-    CBlockHeader GetBlockHeader() const
+    /** The block header. A trimmed solution is fetched with readSolution; returns false if that fails. */
+    bool GetBlockHeader(CBlockHeader& block, const BlockSolutionReader& readSolution) const;
+
+    bool HasSolution() const
     {
-        CBlockHeader block;
-        block.nVersion       = nVersion;
-        if (pprev)
-            block.hashPrevBlock = pprev->GetBlockHash();
-        block.hashMerkleRoot = hashMerkleRoot;
-        block.nHeight        = nHeight;
-        block.hashReserved   = hashReserved;
-        block.nTime          = nTime;
-        block.nBits          = nBits;
-        block.nNonce         = nNonce;
-        block.nSolution      = nSolution;
-        return block;
+        return !nSolution.empty();
     }
 
+    //! Release the in-memory solution of an entry that is stored on disk. Requires cs_main,
+    //! which readers of the solution hold too.
+    void TrimSolution()
+    {
+        std::vector<unsigned char>().swap(nSolution);
+    }
+
+    //! The Equihash solution, fetched with readSolution if trimmed. Returns false if that fails.
+    bool GetSolution(std::vector<unsigned char>& solution, const BlockSolutionReader& readSolution) const;
+
     uint256 GetBlockHash() const
     {
         return *phashBlock;
@@ -386,6 +394,7 @@ public:
         hashPrev = uint256();
     }
 
+    //! A trimmed entry's solution must be filled in before it is written
     explicit CDiskBlockIndex(const CBlockIndex* pindex) : CBlockIndex(*pindex) {
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
     }
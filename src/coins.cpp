@@ -7,12 +7,26 @@
 #include <consensus/consensus.h>
 #include <random.h>
 
+#include <new>
+
 bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 std::vector<uint256> CCoinsView::GetHeadBlocks() const { return std::vector<uint256>(); }
 bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
 CCoinsViewCursor *CCoinsView::Cursor() const { return nullptr; }
 
+size_t CCoinsView::GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins, std::vector<bool> &found) const
+{
+    coins.assign(outpoints.size(), Coin());
+    found.assign(outpoints.size(), false);
+    size_t nFound = 0;
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        found[i] = GetCoin(outpoints[i], coins[i]);
+        nFound += found[i];
+    }
+    return nFound;
+}
+
 bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
 {
     Coin coin;
@@ -21,6 +35,7 @@ bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
 
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) { }
 bool CCoinsViewBacked::GetCoin(const COutPoint &outpoint, Coin &coin) const { return base->GetCoin(outpoint, coin); }
+size_t CCoinsViewBacked::GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins, std::vector<bool> &found) const { return base->GetCoins(outpoints, coins, found); }
 bool CCoinsViewBacked::HaveCoin(const COutPoint &outpoint) const { return base->HaveCoin(outpoint); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 std::vector<uint256> CCoinsViewBacked::GetHeadBlocks() const { return base->GetHeadBlocks(); }
@@ -31,7 +46,23 @@ size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
 
 SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
+static CCoinsMap NewCoinsMap()
+{
+    return CCoinsMap(0, SaltedOutpointHasher(), std::equal_to<COutPoint>(), CCoinsMapAllocator(std::make_shared<CCoinsMapAllocator::ResourceType>()));
+}
+
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cacheCoins(NewCoinsMap()), cachedCoinsUsage(0) {}
+
+void CCoinsViewCache::ReallocateCache()
+{
+    // The map's hasher can't be assigned, so move a new map into place. It
+    // is built first, so that if that throws the cache is left as it was.
+    // The old pool is freed with the last map using it, which may be a
+    // generation the base is still writing.
+    CCoinsMap newCoins(NewCoinsMap());
+    cacheCoins.~CCoinsMap();
+    ::new (&cacheCoins) CCoinsMap(std::move(newCoins));
+}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
@@ -63,6 +94,51 @@ bool CCoinsViewCache::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     return false;
 }
 
+size_t CCoinsViewCache::GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins, std::vector<bool> &found) const {
+    coins.assign(outpoints.size(), Coin());
+    found.assign(outpoints.size(), false);
+    size_t nFound = 0;
+    // Answer what we can from the cache and fetch the rest from the base in one go
+    std::vector<size_t> vMissing;
+    std::vector<COutPoint> vMissingOutpoints;
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        CCoinsMap::const_iterator it = cacheCoins.find(outpoints[i]);
+        if (it == cacheCoins.end()) {
+            vMissing.push_back(i);
+            vMissingOutpoints.push_back(outpoints[i]);
+            continue;
+        }
+        coins[i] = it->second.coin;
+        found[i] = !coins[i].IsSpent();
+        nFound += found[i];
+    }
+    if (vMissing.empty())
+        return nFound;
+
+    std::vector<Coin> vBaseCoins;
+    std::vector<bool> vBaseFound;
+    base->GetCoins(vMissingOutpoints, vBaseCoins, vBaseFound);
+    for (size_t j = 0; j < vMissing.size(); j++) {
+        if (!vBaseFound[j])
+            continue;
+        // An outpoint asked for more than once is only cached and counted once
+        CCoinsMap::iterator ret;
+        bool inserted;
+        std::tie(ret, inserted) = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(vMissingOutpoints[j]), std::forward_as_tuple(std::move(vBaseCoins[j])));
+        if (inserted) {
+            if (ret->second.coin.IsSpent()) {
+                ret->second.flags = CCoinsCacheEntry::FRESH;
+            }
+            cachedCoinsUsage += ret->second.coin.DynamicMemoryUsage();
+        }
+        const size_t i = vMissing[j];
+        coins[i] = ret->second.coin;
+        found[i] = !coins[i].IsSpent();
+        nFound += found[i];
+    }
+    return nFound;
+}
+
 void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possible_overwrite) {
     assert(!coin.IsSpent());
     if (coin.out.scriptPubKey.IsUnspendable()) return;
@@ -202,7 +278,8 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
 
 bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
-    cacheCoins.clear();
+    // Give the pool's chunks back along with the flushed coins
+    ReallocateCache();
     cachedCoinsUsage = 0;
     return fOk;
 }
@@ -12,11 +12,13 @@
 #include <hash.h>
 #include <memusage.h>
 #include <serialize.h>
+#include <support/allocators/pool.h>
 #include <uint256.h>
 
 #include <assert.h>
 #include <stdint.h>
 
+#include <functional>
 #include <unordered_map>
 
 /**
@@ -119,7 +121,14 @@ struct CCoinsCacheEntry
     explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+/**
+ * Largest allocation the coins cache takes from its pool: a map node with
+ * its links and cached hash. Nodes are pooled rather than malloc'ed one by
+ * one, so the cache holds more coins in the same -dbcache.
+ */
+static const size_t COINS_MAP_POOL_BLOCK_SIZE = sizeof(void*) * 4 + sizeof(std::pair<const COutPoint, CCoinsCacheEntry>);
+typedef PoolAllocator<std::pair<const COutPoint, CCoinsCacheEntry>, COINS_MAP_POOL_BLOCK_SIZE, alignof(void*)> CCoinsMapAllocator;
+typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher, std::equal_to<COutPoint>, CCoinsMapAllocator> CCoinsMap;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -151,6 +160,13 @@ public:
      */
     virtual bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
 
+    /** Retrieve the Coins for many outpoints at once. found[i] is what
+     *  GetCoin(outpoints[i], coins[i]) would have returned. Views over a
+     *  database override this to read all of them in one pass.
+     *  Returns the number of coins found.
+     */
+    virtual size_t GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins, std::vector<bool> &found) const;
+
     //! Just check whether a given outpoint is unspent.
     virtual bool HaveCoin(const COutPoint &outpoint) const;
 
@@ -187,6 +203,7 @@ protected:
 public:
     CCoinsViewBacked(CCoinsView *viewIn);
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    size_t GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins, std::vector<bool> &found) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
@@ -211,6 +228,9 @@ protected:
     /* Cached dynamic memory usage for the inner Coin objects. */
     mutable size_t cachedCoinsUsage;
 
+    /** Replace cacheCoins by an empty map with a pool of its own. */
+    void ReallocateCache();
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
 
@@ -221,6 +241,7 @@ public:
 
     // Standard CCoinsView methods
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    size_t GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins, std::vector<bool> &found) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     void SetBestBlock(const uint256 &hashBlock);
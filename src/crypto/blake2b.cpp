@@ -0,0 +1,292 @@
+// Copyright (c) 2018 The Genesis Official developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <crypto/blake2b.h>
+#include <crypto/common.h>
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+#if (defined(ENABLE_SSE41) || defined(ENABLE_AVX2)) && !defined(BUILD_GENESIS_INTERNAL)
+#include <cpuid.h>
+#endif
+#if defined(ENABLE_SSE41) && !defined(BUILD_GENESIS_INTERNAL)
+namespace blake2b_sse41
+{
+void FinalizeLanes(const uint64_t* h, uint64_t t, const uint64_t (*m)[16], uint64_t (*out)[8]);
+}
+#endif
+#if defined(ENABLE_AVX2) && !defined(BUILD_GENESIS_INTERNAL)
+namespace blake2b_avx2
+{
+void FinalizeLanes(const uint64_t* h, uint64_t t, const uint64_t (*m)[16], uint64_t (*out)[8]);
+}
+#endif
+#endif
+
+/** BLAKE2b constants, shared with the SSE4.1 and AVX2 implementations. */
+namespace blake2b_tables
+{
+extern const uint64_t IV[8];
+extern const uint8_t SIGMA[12][16];
+
+const uint64_t IV[8] = {
+    0x6a09e667f3bcc908ull, 0xbb67ae8584caa73bull, 0x3c6ef372fe94f82bull, 0xa54ff53a5f1d36f1ull,
+    0x510e527fade682d1ull, 0x9b05688c2b3e6c1full, 0x1f83d9abfb41bd6bull, 0x5be0cd19137e2179ull};
+
+const uint8_t SIGMA[12][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3}};
+}
+
+// Internal implementation code.
+namespace
+{
+/// Internal BLAKE2b implementation.
+namespace blake2b
+{
+using blake2b_tables::IV;
+using blake2b_tables::SIGMA;
+
+uint64_t inline Rotr(uint64_t x, int n) { return (x >> n) | (x << (64 - n)); }
+
+void inline G(uint64_t& a, uint64_t& b, uint64_t& c, uint64_t& d, uint64_t x, uint64_t y)
+{
+    a = a + b + x;
+    d = Rotr(d ^ a, 32);
+    c = c + d;
+    b = Rotr(b ^ c, 24);
+    a = a + b + y;
+    d = Rotr(d ^ a, 16);
+    c = c + d;
+    b = Rotr(b ^ c, 63);
+}
+
+/** Compress one block of message words m into h. t is the byte counter including this block. */
+void Compress(uint64_t* h, uint64_t t, bool last, const uint64_t* m)
+{
+    uint64_t v[16];
+    for (int i = 0; i < 8; i++) {
+        v[i] = h[i];
+        v[i + 8] = IV[i];
+    }
+    v[12] ^= t;
+    if (last) v[14] = ~v[14];
+
+    for (int r = 0; r < 12; r++) {
+        const uint8_t* s = SIGMA[r];
+        G(v[0], v[4], v[8], v[12], m[s[0]], m[s[1]]);
+        G(v[1], v[5], v[9], v[13], m[s[2]], m[s[3]]);
+        G(v[2], v[6], v[10], v[14], m[s[4]], m[s[5]]);
+        G(v[3], v[7], v[11], v[15], m[s[6]], m[s[7]]);
+        G(v[0], v[5], v[10], v[15], m[s[8]], m[s[9]]);
+        G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+        G(v[2], v[7], v[8], v[13], m[s[12]], m[s[13]]);
+        G(v[3], v[4], v[9], v[14], m[s[14]], m[s[15]]);
+    }
+
+    for (int i = 0; i < 8; i++) {
+        h[i] ^= v[i] ^ v[i + 8];
+    }
+}
+
+void FinalizeLanes(const uint64_t* h, uint64_t t, const uint64_t (*m)[16], uint64_t (*out)[8])
+{
+    for (size_t lane = 0; lane < BLAKE2B_LANES; lane++) {
+        memcpy(out[lane], h, sizeof(out[lane]));
+        Compress(out[lane], t, true, m[lane]);
+    }
+}
+
+} // namespace blake2b
+
+/**
+ * Mirror of libsodium's internal blake2b_state, which backs the opaque
+ * crypto_generichash_blake2b_state. Blake2bAutoDetect only enables lanes after
+ * checking that results read through this layout match libsodium's own.
+ */
+struct SodiumBlake2bState
+{
+    uint64_t h[8];
+    uint64_t t[2];
+    uint64_t f[2];
+    uint8_t buf[256];
+    size_t buflen;
+    uint8_t last_node;
+};
+static_assert(sizeof(SodiumBlake2bState) <= sizeof(crypto_generichash_blake2b_state), "libsodium blake2b state is smaller than expected");
+
+typedef void (*FinalizeLanesType)(const uint64_t*, uint64_t, const uint64_t (*)[16], uint64_t (*)[8]);
+
+FinalizeLanesType FinalizeLanes = blake2b::FinalizeLanes;
+
+/** Whether Blake2bPrepareLanes may be used; set once the self-test has passed. */
+bool fLanesEnabled = false;
+
+bool PrepareLanes(const crypto_generichash_blake2b_state& state, CBlake2bLanes& lanes)
+{
+    SodiumBlake2bState s;
+    memcpy(&s, &state, sizeof(s));
+    if (s.f[0] != 0 || s.f[1] != 0 || s.t[1] != 0 || s.last_node != 0 || s.buflen > sizeof(s.buf)) {
+        return false;
+    }
+
+    // libsodium keeps the final block buffered, so after appending the 4-byte
+    // word it compresses every block except the last non-empty one.
+    const size_t total = s.buflen + sizeof(uint32_t);
+    const size_t common = ((total - 1) / 128) * 128;
+    if (s.buflen < common) {
+        // The trailing word would straddle two blocks.
+        return false;
+    }
+
+    memcpy(lanes.h, s.h, sizeof(lanes.h));
+    lanes.t = s.t[0];
+    for (size_t pos = 0; pos < common; pos += 128) {
+        uint64_t m[16];
+        for (int i = 0; i < 16; i++) {
+            m[i] = ReadLE64(s.buf + pos + 8 * i);
+        }
+        lanes.t += 128;
+        blake2b::Compress(lanes.h, lanes.t, false, m);
+    }
+    lanes.prefixLen = s.buflen - common;
+    memset(lanes.block, 0, sizeof(lanes.block));
+    memcpy(lanes.block, s.buf + common, lanes.prefixLen);
+    return true;
+}
+
+bool SelfTest(FinalizeLanesType finalize)
+{
+    static const size_t prefixLens[] = {0, 12, 100, 124, 128, 140, 200, 252, 256, 300};
+    static const uint32_t suffix[BLAKE2B_LANES] = {0, 1, 0x01234567, 0xffffffff};
+    unsigned char personalization[crypto_generichash_blake2b_PERSONALBYTES] = {'Z', 'c', 'a', 's', 'h', 'P', 'o', 'W', 192, 0, 0, 0, 7, 0, 0, 0};
+    unsigned char input[300];
+    for (size_t i = 0; i < sizeof(input); i++) {
+        input[i] = (unsigned char)(i * 131 + 7);
+    }
+
+    FinalizeLanesType saved = FinalizeLanes;
+    FinalizeLanes = finalize;
+    bool ret = true;
+    for (size_t n = 0; ret && n < sizeof(prefixLens) / sizeof(prefixLens[0]); n++) {
+        crypto_generichash_blake2b_state state;
+        crypto_generichash_blake2b_init_salt_personal(&state, NULL, 0, 48, NULL, personalization);
+        crypto_generichash_blake2b_update(&state, input, prefixLens[n]);
+
+        CBlake2bLanes lanes;
+        if (!PrepareLanes(state, lanes)) {
+            // Only a straddling trailing word may be refused.
+            ret = prefixLens[n] % 128 > 124;
+            continue;
+        }
+        unsigned char out[BLAKE2B_LANES][48];
+        Blake2bFinalizeLanes(lanes, suffix, out[0], sizeof(out[0]));
+        for (size_t lane = 0; lane < BLAKE2B_LANES; lane++) {
+            crypto_generichash_blake2b_state laneState = state;
+            unsigned char expected[48];
+            unsigned char leb[4];
+            WriteLE32(leb, suffix[lane]);
+            crypto_generichash_blake2b_update(&laneState, leb, sizeof(leb));
+            crypto_generichash_blake2b_final(&laneState, expected, sizeof(expected));
+            if (memcmp(out[lane], expected, sizeof(expected))) ret = false;
+        }
+    }
+    FinalizeLanes = saved;
+    return ret;
+}
+
+#if (defined(ENABLE_SSE41) || defined(ENABLE_AVX2)) && !defined(BUILD_GENESIS_INTERNAL)
+/** Check whether the OS has enabled AVX registers. */
+bool AVXEnabled()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+#endif
+
+} // namespace
+
+bool Blake2bPrepareLanes(const crypto_generichash_blake2b_state& state, CBlake2bLanes& lanes)
+{
+    return fLanesEnabled && PrepareLanes(state, lanes);
+}
+
+void Blake2bFinalizeLanes(const CBlake2bLanes& lanes, const uint32_t* suffix, unsigned char* out, size_t outLen)
+{
+    assert(outLen <= 64);
+    uint64_t m[BLAKE2B_LANES][16];
+    unsigned char block[128];
+    memcpy(block, lanes.block, sizeof(block));
+    for (size_t lane = 0; lane < BLAKE2B_LANES; lane++) {
+        WriteLE32(block + lanes.prefixLen, suffix[lane]);
+        for (int i = 0; i < 16; i++) {
+            m[lane][i] = ReadLE64(block + 8 * i);
+        }
+    }
+
+    uint64_t h[BLAKE2B_LANES][8];
+    FinalizeLanes(lanes.h, lanes.t + lanes.prefixLen + sizeof(uint32_t), m, h);
+    for (size_t lane = 0; lane < BLAKE2B_LANES; lane++) {
+        unsigned char digest[64];
+        for (int i = 0; i < 8; i++) {
+            WriteLE64(digest + 8 * i, h[lane][i]);
+        }
+        memcpy(out + lane * outLen, digest, outLen);
+    }
+}
+
+std::string Blake2bAutoDetect()
+{
+    // Everything below relies on reading libsodium's state, so verify that
+    // first with the portable implementation and stay on libsodium otherwise.
+    fLanesEnabled = true;
+    if (!SelfTest(blake2b::FinalizeLanes)) {
+        fLanesEnabled = false;
+        return "sodium";
+    }
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+#if (defined(ENABLE_SSE41) || defined(ENABLE_AVX2)) && !defined(BUILD_GENESIS_INTERNAL)
+    uint32_t eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        const bool have_sse41 = (ecx >> 19) & 1;
+        const bool have_avx = ((ecx >> 27) & 1) && ((ecx >> 28) & 1) && AVXEnabled();
+        (void)have_sse41;
+        (void)have_avx;
+#if defined(ENABLE_AVX2)
+        if (have_avx && __get_cpuid_max(0, nullptr) >= 7) {
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            if ((ebx >> 5) & 1) {
+                FinalizeLanes = blake2b_avx2::FinalizeLanes;
+                assert(SelfTest(FinalizeLanes));
+                return "avx2(4way)";
+            }
+        }
+#endif
+#if defined(ENABLE_SSE41)
+        if (have_sse41) {
+            FinalizeLanes = blake2b_sse41::FinalizeLanes;
+            assert(SelfTest(FinalizeLanes));
+            return "sse4.1(2way)";
+        }
+#endif
+    }
+#endif
+#endif
+
+    return "standard(1way)";
+}
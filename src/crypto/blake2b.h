@@ -0,0 +1,50 @@
+// Copyright (c) 2018 The Genesis Official developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef GENESIS_CRYPTO_BLAKE2B_H
+#define GENESIS_CRYPTO_BLAKE2B_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+
+#include <sodium.h>
+
+/** Number of hashes finalized together by Blake2bFinalizeLanes. */
+static const size_t BLAKE2B_LANES = 4;
+
+/**
+ * A BLAKE2b state shared by a batch of hashes whose inputs differ only in a
+ * trailing 32-bit little-endian word, as in Equihash leaf generation. Every
+ * block before the one holding that word has already been compressed, so each
+ * lane costs a single compression, and the lanes are finalized side by side
+ * with SIMD where the CPU supports it.
+ */
+struct CBlake2bLanes
+{
+    uint64_t h[8];
+    uint64_t t;                 //!< bytes compressed before the final block
+    unsigned char block[128];   //!< final block up to the trailing word, zero padded
+    size_t prefixLen;           //!< offset of the trailing word within block
+};
+
+/**
+ * Prepare lanes from a libsodium state. Returns false if multi-lane hashing is
+ * unavailable or cannot represent this state, in which case the caller must
+ * fall back to crypto_generichash_blake2b_update/final.
+ */
+bool Blake2bPrepareLanes(const crypto_generichash_blake2b_state& state, CBlake2bLanes& lanes);
+
+/**
+ * Compute the BLAKE2B_LANES digests of (lanes input || le32(suffix[i])) and
+ * write the first outLen (at most 64) bytes of each to out + i * outLen.
+ */
+void Blake2bFinalizeLanes(const CBlake2bLanes& lanes, const uint32_t* suffix, unsigned char* out, size_t outLen);
+
+/** Autodetect the best available multi-lane BLAKE2b implementation.
+ *  Returns the name of the implementation.
+ */
+std::string Blake2bAutoDetect();
+
+#endif // GENESIS_CRYPTO_BLAKE2B_H
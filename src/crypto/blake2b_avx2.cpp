@@ -0,0 +1,86 @@
+// Copyright (c) 2018 The Genesis Official developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// This is a 4-way AVX2 implementation of the final BLAKE2b compression used by
+// Blake2bFinalizeLanes: each 64-bit element of a vector belongs to one lane.
+
+#ifdef ENABLE_AVX2
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include <crypto/blake2b.h>
+
+// Defined in blake2b.cpp
+namespace blake2b_tables {
+extern const uint64_t IV[8];
+extern const uint8_t SIGMA[12][16];
+}
+
+namespace blake2b_avx2 {
+namespace {
+
+using blake2b_tables::IV;
+using blake2b_tables::SIGMA;
+
+__m256i inline Add(__m256i x, __m256i y) { return _mm256_add_epi64(x, y); }
+__m256i inline Xor(__m256i x, __m256i y) { return _mm256_xor_si256(x, y); }
+__m256i inline Ror32(__m256i x) { return _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)); }
+__m256i inline Ror24(__m256i x) { return _mm256_shuffle_epi8(x, _mm256_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10, 3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10)); }
+__m256i inline Ror16(__m256i x) { return _mm256_shuffle_epi8(x, _mm256_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9, 2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9)); }
+__m256i inline Ror63(__m256i x) { return Xor(_mm256_srli_epi64(x, 63), Add(x, x)); }
+
+void inline G(__m256i& a, __m256i& b, __m256i& c, __m256i& d, __m256i x, __m256i y)
+{
+    a = Add(Add(a, b), x);
+    d = Ror32(Xor(d, a));
+    c = Add(c, d);
+    b = Ror24(Xor(b, c));
+    a = Add(Add(a, b), y);
+    d = Ror16(Xor(d, a));
+    c = Add(c, d);
+    b = Ror63(Xor(b, c));
+}
+
+} // namespace
+
+void FinalizeLanes(const uint64_t* h, uint64_t t, const uint64_t (*m)[16], uint64_t (*out)[8])
+{
+    static_assert(BLAKE2B_LANES == 4, "AVX2 kernel handles exactly four lanes");
+    __m256i msg[16];
+    for (int i = 0; i < 16; i++) {
+        msg[i] = _mm256_set_epi64x(m[3][i], m[2][i], m[1][i], m[0][i]);
+    }
+    __m256i v[16];
+    for (int i = 0; i < 8; i++) {
+        v[i] = _mm256_set1_epi64x(h[i]);
+        v[i + 8] = _mm256_set1_epi64x(IV[i]);
+    }
+    v[12] = _mm256_set1_epi64x(IV[4] ^ t);
+    v[14] = _mm256_set1_epi64x(~IV[6]);
+
+    for (int r = 0; r < 12; r++) {
+        const uint8_t* s = SIGMA[r];
+        G(v[0], v[4], v[8], v[12], msg[s[0]], msg[s[1]]);
+        G(v[1], v[5], v[9], v[13], msg[s[2]], msg[s[3]]);
+        G(v[2], v[6], v[10], v[14], msg[s[4]], msg[s[5]]);
+        G(v[3], v[7], v[11], v[15], msg[s[6]], msg[s[7]]);
+        G(v[0], v[5], v[10], v[15], msg[s[8]], msg[s[9]]);
+        G(v[1], v[6], v[11], v[12], msg[s[10]], msg[s[11]]);
+        G(v[2], v[7], v[8], v[13], msg[s[12]], msg[s[13]]);
+        G(v[3], v[4], v[9], v[14], msg[s[14]], msg[s[15]]);
+    }
+
+    for (int i = 0; i < 8; i++) {
+        uint64_t word[4];
+        _mm256_storeu_si256((__m256i*)word, Xor(_mm256_set1_epi64x(h[i]), Xor(v[i], v[i + 8])));
+        for (size_t lane = 0; lane < BLAKE2B_LANES; lane++) {
+            out[lane][i] = word[lane];
+        }
+    }
+}
+
+} // namespace blake2b_avx2
+
+#endif
@@ -0,0 +1,86 @@
+// Copyright (c) 2018 The Genesis Official developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// This is a 2-way SSE4.1 implementation of the final BLAKE2b compression used by
+// Blake2bFinalizeLanes: each 64-bit element of a vector belongs to one lane.
+
+#ifdef ENABLE_SSE41
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include <crypto/blake2b.h>
+
+// Defined in blake2b.cpp
+namespace blake2b_tables {
+extern const uint64_t IV[8];
+extern const uint8_t SIGMA[12][16];
+}
+
+namespace blake2b_sse41 {
+namespace {
+
+using blake2b_tables::IV;
+using blake2b_tables::SIGMA;
+
+__m128i inline Add(__m128i x, __m128i y) { return _mm_add_epi64(x, y); }
+__m128i inline Xor(__m128i x, __m128i y) { return _mm_xor_si128(x, y); }
+__m128i inline Ror32(__m128i x) { return _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)); }
+__m128i inline Ror24(__m128i x) { return _mm_shuffle_epi8(x, _mm_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10)); }
+__m128i inline Ror16(__m128i x) { return _mm_shuffle_epi8(x, _mm_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9)); }
+__m128i inline Ror63(__m128i x) { return Xor(_mm_srli_epi64(x, 63), Add(x, x)); }
+
+void inline G(__m128i& a, __m128i& b, __m128i& c, __m128i& d, __m128i x, __m128i y)
+{
+    a = Add(Add(a, b), x);
+    d = Ror32(Xor(d, a));
+    c = Add(c, d);
+    b = Ror24(Xor(b, c));
+    a = Add(Add(a, b), y);
+    d = Ror16(Xor(d, a));
+    c = Add(c, d);
+    b = Ror63(Xor(b, c));
+}
+
+} // namespace
+
+void FinalizeLanes(const uint64_t* h, uint64_t t, const uint64_t (*m)[16], uint64_t (*out)[8])
+{
+    for (size_t lane = 0; lane < BLAKE2B_LANES; lane += 2) {
+        __m128i msg[16];
+        for (int i = 0; i < 16; i++) {
+            msg[i] = _mm_set_epi64x(m[lane + 1][i], m[lane][i]);
+        }
+        __m128i v[16];
+        for (int i = 0; i < 8; i++) {
+            v[i] = _mm_set1_epi64x(h[i]);
+            v[i + 8] = _mm_set1_epi64x(IV[i]);
+        }
+        v[12] = _mm_set1_epi64x(IV[4] ^ t);
+        v[14] = _mm_set1_epi64x(~IV[6]);
+
+        for (int r = 0; r < 12; r++) {
+            const uint8_t* s = SIGMA[r];
+            G(v[0], v[4], v[8], v[12], msg[s[0]], msg[s[1]]);
+            G(v[1], v[5], v[9], v[13], msg[s[2]], msg[s[3]]);
+            G(v[2], v[6], v[10], v[14], msg[s[4]], msg[s[5]]);
+            G(v[3], v[7], v[11], v[15], msg[s[6]], msg[s[7]]);
+            G(v[0], v[5], v[10], v[15], msg[s[8]], msg[s[9]]);
+            G(v[1], v[6], v[11], v[12], msg[s[10]], msg[s[11]]);
+            G(v[2], v[7], v[8], v[13], msg[s[12]], msg[s[13]]);
+            G(v[3], v[4], v[9], v[14], msg[s[14]], msg[s[15]]);
+        }
+
+        for (int i = 0; i < 8; i++) {
+            uint64_t word[2];
+            _mm_storeu_si128((__m128i*)word, Xor(_mm_set1_epi64x(h[i]), Xor(v[i], v[i + 8])));
+            out[lane][i] = word[0];
+            out[lane + 1][i] = word[1];
+        }
+    }
+}
+
+} // namespace blake2b_sse41
+
+#endif
@@ -17,6 +17,7 @@
 #endif
 
 #include "crypto/equihash/equihash.h"
+#include "crypto/blake2b.h"
 
 #ifndef NO_UTIL_LOG
 #include "util.h"
@@ -60,6 +61,23 @@ void GenerateHash(const eh_HashState& base_state, eh_index g,
     crypto_generichash_blake2b_final(&state, hash, hLen);
 }
 
+// Generate the hashes for count block indices into consecutive hLen-byte
+// slots of hashes, finalizing BLAKE2B_LANES of them at a time when possible.
+void GenerateHashes(const eh_HashState& base_state, const eh_index* g, size_t count,
+                    unsigned char* hashes, size_t hLen)
+{
+    size_t i = 0;
+    CBlake2bLanes lanes;
+    if (Blake2bPrepareLanes(base_state, lanes)) {
+        for (; i + BLAKE2B_LANES <= count; i += BLAKE2B_LANES) {
+            Blake2bFinalizeLanes(lanes, g + i, hashes + i*hLen, hLen);
+        }
+    }
+    for (; i < count; i++) {
+        GenerateHash(base_state, g[i], hashes + i*hLen, hLen);
+    }
+}
+
 void ExpandArray(const unsigned char* in, size_t in_len,
                  unsigned char* out, size_t out_len,
                  size_t bit_len, size_t byte_pad)
@@ -174,7 +192,7 @@ eh_index UntruncateIndex(const eh_trunc t, const eh_index r, const unsigned int
     return (i << (ilen - 8)) | r;
 }
 
-std::vector<eh_index> GetIndicesFromMinimal(std::vector<unsigned char> minimal,
+std::vector<eh_index> GetIndicesFromMinimal(const std::vector<unsigned char>& minimal,
                                             size_t cBitLen)
 {
     assert(((cBitLen+1)+7)/8 <= sizeof(eh_index));
@@ -190,7 +208,7 @@ std::vector<eh_index> GetIndicesFromMinimal(std::vector<unsigned char> minimal,
     return ret;
 }
 
-std::vector<unsigned char> GetMinimalFromIndices(std::vector<eh_index> indices,
+std::vector<unsigned char> GetMinimalFromIndices(const std::vector<eh_index>& indices,
                                                  size_t cBitLen)
 {
     assert(((cBitLen+1)+7)/8 <= sizeof(eh_index));
@@ -329,10 +347,78 @@ std::shared_ptr<eh_trunc> TruncatedStepRow<WIDTH>::GetTruncatedIndices(size_t le
     return p;
 }
 
+// Entries of the radix sort, pairing a row's key with its position in the
+// list. Keys of up to four bytes share a single uint64_t with the position.
+static inline void MakeRadixEntry(uint64_t& e, uint64_t key, eh_index pos) { e = (key << 32) | pos; }
+static inline uint64_t RadixKey(uint64_t e) { return e >> 32; }
+static inline eh_index RadixPos(uint64_t e) { return (eh_index)e; }
+
+typedef std::pair<uint64_t, eh_index> WideRadixEntry;
+static inline void MakeRadixEntry(WideRadixEntry& e, uint64_t key, eh_index pos) { e = WideRadixEntry(key, pos); }
+static inline uint64_t RadixKey(const WideRadixEntry& e) { return e.first; }
+static inline eh_index RadixPos(const WideRadixEntry& e) { return e.second; }
+
+// Order X by its first len bytes, as std::sort with CompareSR(len) does up to
+// the order of equal rows, using a least significant digit radix sort of
+// (key, position) entries. The rows themselves are then permuted in place,
+// following each cycle of the permutation, so every row moves once instead of
+// being swapped all through a comparison sort.
+template<typename Entry, typename Row>
+void RadixSortRows(std::vector<Row>& X, size_t len)
+{
+    const size_t n = X.size();
+    std::vector<Entry> entries(n), tmp(n);
+    for (size_t i = 0; i < n; i++)
+        MakeRadixEntry(entries[i], X[i].GetKey(len), i);
+
+    for (size_t digit = 0; digit < len; digit++) {
+        const unsigned int shift = 8*digit;
+        size_t offsets[257] = {0};
+        for (const Entry& e : entries)
+            offsets[((RadixKey(e) >> shift) & 0xff) + 1]++;
+        if (offsets[((RadixKey(entries[0]) >> shift) & 0xff) + 1] == n)
+            continue; // every row has the same digit here
+        for (size_t b = 0; b < 256; b++)
+            offsets[b+1] += offsets[b];
+        for (const Entry& e : entries)
+            tmp[offsets[(RadixKey(e) >> shift) & 0xff]++] = e;
+        entries.swap(tmp);
+    }
+    std::vector<Entry>().swap(tmp);
+
+    // Row i of the result is row RadixPos(entries[i]) of X
+    std::vector<bool> placed(n);
+    for (size_t i = 0; i < n; i++) {
+        if (placed[i] || RadixPos(entries[i]) == i)
+            continue;
+        Row first(X[i]);
+        size_t j = i;
+        while (RadixPos(entries[j]) != i) {
+            X[j] = X[RadixPos(entries[j])];
+            placed[j] = true;
+            j = RadixPos(entries[j]);
+        }
+        X[j] = first;
+        placed[j] = true;
+    }
+}
+
+template<typename Row>
+void SortRows(std::vector<Row>& X, size_t len, bool fRadixSort)
+{
+    if (!fRadixSort || len > sizeof(uint64_t) || X.size() < 2)
+        std::sort(X.begin(), X.end(), CompareSR(len));
+    else if (len <= sizeof(eh_index))
+        RadixSortRows<uint64_t>(X, len);
+    else
+        RadixSortRows<WideRadixEntry>(X, len);
+}
+
 template<unsigned int N, unsigned int K>
 bool Equihash<N,K>::BasicSolve(const eh_HashState& base_state,
                                const std::function<bool(std::vector<unsigned char>)> validBlock,
-                               const std::function<bool(EhSolverCancelCheck)> cancelled)
+                               const std::function<bool(EhSolverCancelCheck)> cancelled,
+                               bool fRadixSort)
 {
     eh_index init_size { 1 << (CollisionBitLength + 1) };
 
@@ -357,7 +443,7 @@ bool Equihash<N,K>::BasicSolve(const eh_HashState& base_state,
         //LogPrint(BCLog::POW, "Round %u:\n", r);
         // 2a) Sort the list
         //LogPrint(BCLog::POW, "- Sorting list\n");
-        std::sort(X.begin(), X.end(), CompareSR(CollisionByteLength));
+        SortRows(X, CollisionByteLength, fRadixSort);
         if (cancelled(ListSorting)) throw solver_cancelled;
 
         //LogPrint(BCLog::POW, "- Finding collisions\n");
@@ -415,7 +501,7 @@ bool Equihash<N,K>::BasicSolve(const eh_HashState& base_state,
     //LogPrint(BCLog::POW, "Final round:\n");
     if (X.size() > 1) {
         //LogPrint(BCLog::POW, "- Sorting list\n");
-        std::sort(X.begin(), X.end(), CompareSR(hashLen));
+        SortRows(X, hashLen, fRadixSort);
         if (cancelled(FinalSorting)) throw solver_cancelled;
         //LogPrint(BCLog::POW, "- Finding collisions\n");
         size_t i = 0;
@@ -442,7 +528,7 @@ bool Equihash<N,K>::BasicSolve(const eh_HashState& base_state,
             i += j;
             if (cancelled(FinalColliding)) throw solver_cancelled;
         }
-    } else
+    } //else
         //LogPrint(BCLog::POW, "- List is empty\n");
 
     return false;
@@ -503,7 +589,8 @@ void CollideBranches(std::vector<FullStepRow<WIDTH>>& X, const size_t hlen, cons
 template<unsigned int N, unsigned int K>
 bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
                                    const std::function<bool(std::vector<unsigned char>)> validBlock,
-                                   const std::function<bool(EhSolverCancelCheck)> cancelled)
+                                   const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                   bool fRadixSort)
 {
     eh_index init_size { 1 << (CollisionBitLength + 1) };
     eh_index recreate_size { UntruncateIndex(1, 0, CollisionBitLength + 1) };
@@ -536,7 +623,7 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
             //LogPrint(BCLog::POW, "Round %zu:\n", r);
             // 2a) Sort the list
             //LogPrint(BCLog::POW, "- Sorting list\n");
-            std::sort(Xt.begin(), Xt.end(), CompareSR(CollisionByteLength));
+            SortRows(Xt, CollisionByteLength, fRadixSort);
             if (cancelled(ListSorting)) throw solver_cancelled;
 
             //LogPrint(BCLog::POW, "- Finding collisions\n");
@@ -601,7 +688,7 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
         //LogPrint(BCLog::POW, "Final round:\n");
         if (Xt.size() > 1) {
             //LogPrint(BCLog::POW, "- Sorting list\n");
-            std::sort(Xt.begin(), Xt.end(), CompareSR(hashLen));
+            SortRows(Xt, hashLen, fRadixSort);
             if (cancelled(FinalSorting)) throw solver_cancelled;
             //LogPrint(BCLog::POW, "- Finding collisions\n");
             size_t i = 0;
@@ -671,7 +758,9 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
                         // 2c) Merge the lists
                         ic->reserve(ic->size() + X[r]->size());
                         ic->insert(ic->end(), X[r]->begin(), X[r]->end());
-                        std::sort(ic->begin(), ic->end(), CompareSR(hashLen));
+                        // CollideBranches only needs the rows grouped by
+                        // their next collision, not fully ordered
+                        SortRows(*ic, fRadixSort ? (size_t)CollisionByteLength : hashLen, fRadixSort);
                         if (cancelled(PartialSorting)) throw solver_cancelled;
                         size_t lti = rti-(1<<r);
                         CollideBranches(*ic, hashLen, lenIndices,
@@ -723,7 +812,7 @@ invalidsolution:
 }
 
 template<unsigned int N, unsigned int K>
-bool Equihash<N,K>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln)
+bool Equihash<N,K>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln)
 {
     if (soln.size() != SolutionWidth) {
         // LogPrintf("Invalid solution length: %d (expected %d)\n", soln.size(), SolutionWidth);
@@ -770,51 +859,143 @@ bool Equihash<N,K>::IsValidSolution(const eh_HashState& base_state, std::vector<
     return X[0].IsZero(hashLen);
 }
 
+template<unsigned int N, unsigned int K>
+bool EquihashFlatVerifier<N,K>::IsValidSolution(const eh_HashState& base_state,
+                                                const unsigned char* soln, size_t solnLen)
+{
+    typedef Equihash<N,K> Eh;
+    if (solnLen != Eh::SolutionWidth) {
+        return false;
+    }
+
+    // Decode the minimal encoding into 2^K indices
+    const size_t cBitLen = Eh::CollisionBitLength;
+    const size_t bytePad = sizeof(eh_index) - ((cBitLen+1)+7)/8;
+    unsigned char indexBytes[ProofSize*sizeof(eh_index)];
+    ExpandArray(soln, solnLen, indexBytes, sizeof(indexBytes), cBitLen+1, bytePad);
+    eh_index indices[ProofSize];
+    for (size_t i = 0; i < ProofSize; i++) {
+        indices[i] = ArrayToEhIndex(indexBytes+(i*sizeof(eh_index)));
+    }
+
+    // The per-round DistinctIndices checks together require that all indices
+    // in the solution are distinct, so check that once up front.
+    eh_index sorted[ProofSize];
+    std::copy(indices, indices+ProofSize, sorted);
+    std::sort(sorted, sorted+ProofSize);
+    for (size_t i = 1; i < ProofSize; i++) {
+        if (sorted[i] == sorted[i-1]) {
+            return false;
+        }
+    }
+
+    // Generate the leaf rows
+    eh_index blocks[ProofSize];
+    for (size_t i = 0; i < ProofSize; i++) {
+        blocks[i] = indices[i]/Eh::IndicesPerHashOutput;
+    }
+    unsigned char hashes[ProofSize][Eh::HashOutput];
+    GenerateHashes(base_state, blocks, ProofSize, hashes[0], Eh::HashOutput);
+    unsigned char rows[ProofSize][Eh::HashLength];
+    for (size_t i = 0; i < ProofSize; i++) {
+        ExpandArray(hashes[i]+((indices[i] % Eh::IndicesPerHashOutput) * N/8), N/8,
+                    rows[i], Eh::HashLength, cBitLen);
+    }
+
+    // Collide sibling rows in place. After round r, rows[j] holds the XOR of
+    // the subtree whose leftmost leaf is indices[j << (r+1)], and only the
+    // bytes past offset are still meaningful.
+    size_t count = ProofSize;
+    size_t offset = 0;
+    for (size_t r = 0; r < K; r++) {
+        for (size_t j = 0; j < count/2; j++) {
+            const unsigned char* a = rows[2*j];
+            const unsigned char* b = rows[2*j+1];
+            if (memcmp(a+offset, b+offset, Eh::CollisionByteLength) != 0) {
+                return false;
+            }
+            if (indices[(2*j+1) << r] < indices[(2*j) << r]) {
+                // Index tree incorrectly ordered
+                return false;
+            }
+            for (size_t x = offset+Eh::CollisionByteLength; x < Eh::HashLength; x++) {
+                rows[j][x] = a[x] ^ b[x];
+            }
+        }
+        count /= 2;
+        offset += Eh::CollisionByteLength;
+    }
+
+    for (size_t x = offset; x < Eh::HashLength; x++) {
+        if (rows[0][x] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
 // Explicit instantiations for Equihash<96,3>
 template int Equihash<96,3>::InitialiseState(eh_HashState& base_state, const std::string personalizationString);
 template bool Equihash<96,3>::BasicSolve(const eh_HashState& base_state,
                                          const std::function<bool(std::vector<unsigned char>)> validBlock,
-                                         const std::function<bool(EhSolverCancelCheck)> cancelled);
+                                         const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                         bool fRadixSort);
 template bool Equihash<96,3>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
-                                             const std::function<bool(EhSolverCancelCheck)> cancelled);
-template bool Equihash<96,3>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+                                             const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                             bool fRadixSort);
+template bool Equihash<96,3>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
 
 // Explicit instantiations for Equihash<200,9>
 template int Equihash<200,9>::InitialiseState(eh_HashState& base_state, const std::string personalizationString);
 template bool Equihash<200,9>::BasicSolve(const eh_HashState& base_state,
                                           const std::function<bool(std::vector<unsigned char>)> validBlock,
-                                          const std::function<bool(EhSolverCancelCheck)> cancelled);
+                                          const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                          bool fRadixSort);
 template bool Equihash<200,9>::OptimisedSolve(const eh_HashState& base_state,
                                               const std::function<bool(std::vector<unsigned char>)> validBlock,
-                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
-template bool Equihash<200,9>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+                                              const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                              bool fRadixSort);
+template bool Equihash<200,9>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
 
 // Explicit instantiations for Equihash<96,5>
 template int Equihash<96,5>::InitialiseState(eh_HashState& base_state, const std::string personalizationString);
 template bool Equihash<96,5>::BasicSolve(const eh_HashState& base_state,
                                          const std::function<bool(std::vector<unsigned char>)> validBlock,
-                                         const std::function<bool(EhSolverCancelCheck)> cancelled);
+                                         const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                         bool fRadixSort);
 template bool Equihash<96,5>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
-                                             const std::function<bool(EhSolverCancelCheck)> cancelled);
-template bool Equihash<96,5>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+                                             const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                             bool fRadixSort);
+template bool Equihash<96,5>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
 
 // Explicit instantiations for Equihash<48,5>
 template int Equihash<48,5>::InitialiseState(eh_HashState& base_state, const std::string personalizationString);
 template bool Equihash<48,5>::BasicSolve(const eh_HashState& base_state,
                                          const std::function<bool(std::vector<unsigned char>)> validBlock,
-                                         const std::function<bool(EhSolverCancelCheck)> cancelled);
+                                         const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                         bool fRadixSort);
 template bool Equihash<48,5>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
-                                             const std::function<bool(EhSolverCancelCheck)> cancelled);
-template bool Equihash<48,5>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+                                             const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                             bool fRadixSort);
+template bool Equihash<48,5>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
 // Explicit instantiations for Equihash<192,7>
 template int Equihash<192,7>::InitialiseState(eh_HashState& base_state, const std::string personalizationString);
 template bool Equihash<192,7>::BasicSolve(const eh_HashState& base_state,
                                          const std::function<bool(std::vector<unsigned char>)> validBlock,
-                                         const std::function<bool(EhSolverCancelCheck)> cancelled);
+                                         const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                         bool fRadixSort);
 template bool Equihash<192,7>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
-                                             const std::function<bool(EhSolverCancelCheck)> cancelled);
-template bool Equihash<192,7>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+                                             const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                             bool fRadixSort);
+template bool Equihash<192,7>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
+
+// Explicit instantiations for EquihashFlatVerifier
+template class EquihashFlatVerifier<96,3>;
+template class EquihashFlatVerifier<200,9>;
+template class EquihashFlatVerifier<96,5>;
+template class EquihashFlatVerifier<48,5>;
+template class EquihashFlatVerifier<192,7>;
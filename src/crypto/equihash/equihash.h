@@ -17,6 +17,7 @@
 #include <functional>
 #include <memory>
 #include <set>
+#include <stdexcept>
 #include <vector>
 
 #include <boost/static_assert.hpp>
@@ -35,9 +36,9 @@ void CompressArray(const unsigned char* in, size_t in_len,
 eh_index ArrayToEhIndex(const unsigned char* array);
 eh_trunc TruncateIndex(const eh_index i, const unsigned int ilen);
 
-std::vector<eh_index> GetIndicesFromMinimal(std::vector<unsigned char> minimal,
+std::vector<eh_index> GetIndicesFromMinimal(const std::vector<unsigned char>& minimal,
                                             size_t cBitLen);
-std::vector<unsigned char> GetMinimalFromIndices(std::vector<eh_index> indices,
+std::vector<unsigned char> GetMinimalFromIndices(const std::vector<eh_index>& indices,
                                                  size_t cBitLen);
 
 template<size_t WIDTH>
@@ -60,6 +61,14 @@ public:
 
     bool IsZero(size_t len);
     std::string GetHex(size_t len) { return HexStr(hash, hash+len); }
+    /** The first len bytes, at most 8, as a big-endian integer, so keys order like CompareSR(len) */
+    uint64_t GetKey(size_t len) const
+    {
+        uint64_t key = 0;
+        for (size_t i = 0; i < len; i++)
+            key = (key << 8) | hash[i];
+        return key;
+    }
 
     template<size_t W>
     friend bool HasCollision(StepRow<W>& a, StepRow<W>& b, size_t l);
@@ -183,13 +192,39 @@ public:
     Equihash() { }
 
     int InitialiseState(eh_HashState& base_state, const std::string personalizationString);
+    /**
+     * The solvers order each list before looking for collisions in it. With
+     * fRadixSort the rows are grouped by a radix sort of their collision bits
+     * instead of std::sort over whole rows; the solutions are the same.
+     */
     bool BasicSolve(const eh_HashState& base_state,
                     const std::function<bool(std::vector<unsigned char>)> validBlock,
-                    const std::function<bool(EhSolverCancelCheck)> cancelled);
+                    const std::function<bool(EhSolverCancelCheck)> cancelled,
+                    bool fRadixSort = false);
     bool OptimisedSolve(const eh_HashState& base_state,
                         const std::function<bool(std::vector<unsigned char>)> validBlock,
-                        const std::function<bool(EhSolverCancelCheck)> cancelled);
-    bool IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+                        const std::function<bool(EhSolverCancelCheck)> cancelled,
+                        bool fRadixSort = false);
+    bool IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
+};
+
+/**
+ * Allocation-free Equihash verifier. The 2^K leaf rows of a solution are kept
+ * in a fixed-size array on the stack and collided in place, so checking a
+ * header performs no heap allocation. Accepts the same minimal encoding and
+ * gives the same result as Equihash<N,K>::IsValidSolution.
+ */
+template<unsigned int N, unsigned int K>
+class EquihashFlatVerifier
+{
+public:
+    enum : size_t { ProofSize=1 << K };
+
+    static bool IsValidSolution(const eh_HashState& base_state, const unsigned char* soln, size_t solnLen);
+    static bool IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln)
+    {
+        return IsValidSolution(base_state, soln.data(), soln.size());
+    }
 };
 
 #include "equihash.tcc"
@@ -217,18 +252,19 @@ static Equihash<192,7> Eh192_7;
 
 inline bool EhBasicSolve(unsigned int n, unsigned int k, const eh_HashState& base_state,
                     const std::function<bool(std::vector<unsigned char>)> validBlock,
-                    const std::function<bool(EhSolverCancelCheck)> cancelled)
+                    const std::function<bool(EhSolverCancelCheck)> cancelled,
+                    bool fRadixSort = false)
 {
     if (n == 96 && k == 3) {
-        return Eh96_3.BasicSolve(base_state, validBlock, cancelled);
+        return Eh96_3.BasicSolve(base_state, validBlock, cancelled, fRadixSort);
     } else if (n == 200 && k == 9) {
-        return Eh200_9.BasicSolve(base_state, validBlock, cancelled);
+        return Eh200_9.BasicSolve(base_state, validBlock, cancelled, fRadixSort);
     } else if (n == 96 && k == 5) {
-        return Eh96_5.BasicSolve(base_state, validBlock, cancelled);
+        return Eh96_5.BasicSolve(base_state, validBlock, cancelled, fRadixSort);
     } else if (n == 48 && k == 5) {
-        return Eh48_5.BasicSolve(base_state, validBlock, cancelled);
+        return Eh48_5.BasicSolve(base_state, validBlock, cancelled, fRadixSort);
     } else if (n == 192 && k == 7) {
-        return Eh192_7.BasicSolve(base_state, validBlock, cancelled);
+        return Eh192_7.BasicSolve(base_state, validBlock, cancelled, fRadixSort);
     } else {
         throw std::invalid_argument("Unsupported Equihash parameters");
     }
@@ -243,18 +279,19 @@ inline bool EhBasicSolveUncancellable(unsigned int n, unsigned int k, const eh_H
 
 inline bool EhOptimisedSolve(unsigned int n, unsigned int k, const eh_HashState& base_state,
                     const std::function<bool(std::vector<unsigned char>)> validBlock,
-                    const std::function<bool(EhSolverCancelCheck)> cancelled)
+                    const std::function<bool(EhSolverCancelCheck)> cancelled,
+                    bool fRadixSort = false)
 {
     if (n == 96 && k == 3) {
-        return Eh96_3.OptimisedSolve(base_state, validBlock, cancelled);
+        return Eh96_3.OptimisedSolve(base_state, validBlock, cancelled, fRadixSort);
     } else if (n == 200 && k == 9) {
-        return Eh200_9.OptimisedSolve(base_state, validBlock, cancelled);
+        return Eh200_9.OptimisedSolve(base_state, validBlock, cancelled, fRadixSort);
     } else if (n == 96 && k == 5) {
-        return Eh96_5.OptimisedSolve(base_state, validBlock, cancelled);
+        return Eh96_5.OptimisedSolve(base_state, validBlock, cancelled, fRadixSort);
     } else if (n == 48 && k == 5) {
-        return Eh48_5.OptimisedSolve(base_state, validBlock, cancelled);
+        return Eh48_5.OptimisedSolve(base_state, validBlock, cancelled, fRadixSort);
     } else if (n == 192 && k == 7) {
-        return Eh192_7.OptimisedSolve(base_state, validBlock, cancelled);
+        return Eh192_7.OptimisedSolve(base_state, validBlock, cancelled, fRadixSort);
     } else {
         throw std::invalid_argument("Unsupported Equihash parameters");
     }
@@ -276,8 +313,8 @@ inline bool EhOptimisedSolveUncancellable(unsigned int n, unsigned int k, const
         ret = Eh96_5.IsValidSolution(base_state, soln);  \
     } else if (n == 48 && k == 5) {                      \
         ret = Eh48_5.IsValidSolution(base_state, soln);  \
-    } else if (n == 192 && k == 7) {                      \
-        ret = Eh192_7.IsValidSolution(base_state, soln);  \
+    } else if (n == 192 && k == 7) {                     \
+        ret = EquihashFlatVerifier<192,7>::IsValidSolution(base_state, soln); \
     } else {                                             \
         throw std::invalid_argument("Unsupported Equihash parameters"); \
     }
@@ -16,6 +16,10 @@
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
+#include <algorithm>
+#include <memory>
+#include <vector>
+
 static const size_t DBWRAPPER_PREALLOC_KEY_SIZE = 64;
 static const size_t DBWRAPPER_PREALLOC_VALUE_SIZE = 1024;
 
@@ -133,6 +137,7 @@ public:
     bool Valid() const;
 
     void SeekToFirst();
+    void SeekToLast();
 
     template<typename K> void Seek(const K& key) {
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
@@ -143,6 +148,7 @@ public:
     }
 
     void Next();
+    void Prev();
 
     template<typename K> bool GetKey(K& key) {
         leveldb::Slice slKey = piter->key();
@@ -249,6 +255,69 @@ public:
         return true;
     }
 
+    /**
+     * Read the values of many keys at once. The keys are sorted and visited
+     * in order with a single iterator, so all reads see one snapshot and keys
+     * that sit next to each other on disk are reached by stepping forward
+     * through the table block already loaded rather than by a fresh lookup.
+     * On return found[i] tells whether values[i] holds the value of keys[i].
+     * Returns the number of keys found.
+     */
+    template <typename K, typename V>
+    size_t ReadMany(const std::vector<K>& keys, std::vector<V>& values, std::vector<bool>& found) const
+    {
+        values.assign(keys.size(), V());
+        found.assign(keys.size(), false);
+
+        std::vector<CDataStream> vKey;
+        vKey.reserve(keys.size());
+        for (const K& key : keys) {
+            vKey.emplace_back(SER_DISK, CLIENT_VERSION);
+            vKey.back().reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+            vKey.back() << key;
+        }
+        std::vector<size_t> vOrder(keys.size());
+        for (size_t i = 0; i < vOrder.size(); i++)
+            vOrder[i] = i;
+        std::sort(vOrder.begin(), vOrder.end(), [&vKey](size_t a, size_t b) {
+            return leveldb::Slice(vKey[a].data(), vKey[a].size()).compare(leveldb::Slice(vKey[b].data(), vKey[b].size())) < 0;
+        });
+
+        size_t nFound = 0;
+        const size_t nNone = keys.size();
+        size_t nPrev = nNone;
+        std::unique_ptr<leveldb::Iterator> piter(pdb->NewIterator(readoptions));
+        for (size_t i : vOrder) {
+            leveldb::Slice slKey(vKey[i].data(), vKey[i].size());
+            if (nPrev != nNone && slKey == leveldb::Slice(vKey[nPrev].data(), vKey[nPrev].size())) {
+                // Repeated key: the iterator has already moved past it
+                values[i] = values[nPrev];
+                found[i] = found[nPrev];
+                nFound += found[i];
+                continue;
+            }
+            nPrev = i;
+            // The iterator rests on the entry after the previous key; only
+            // search again if this key lies beyond it.
+            if (!piter->Valid() || piter->key().compare(slKey) < 0)
+                piter->Seek(slKey);
+            if (!piter->Valid() || piter->key().compare(slKey) != 0)
+                continue;
+            leveldb::Slice slValue = piter->value();
+            try {
+                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+                ssValue.Xor(obfuscate_key);
+                ssValue >> values[i];
+                found[i] = true;
+                nFound++;
+            } catch (const std::exception&) {
+            }
+            piter->Next();
+        }
+        dbwrapper_private::HandleError(piter->status());
+        return nFound;
+    }
+
     template <typename K, typename V>
     bool Write(const K& key, const V& value, bool fSync = false)
     {
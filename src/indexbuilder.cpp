@@ -0,0 +1,404 @@
+// Copyright (c) 2018 The Genesis Official developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <indexbuilder.h>
+
+#include <chain.h>
+#include <chainparams.h>
+#include <txdb.h>
+#include <undo.h>
+#include <util.h>
+#include <utiltime.h>
+#include <validation.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+
+/** Type and hash of the address a script pays to, as the address and spent
+ *  indexes key them, or type 0 for other scripts. */
+static int GetAddressKey(const CScript& script, uint160& hashBytes)
+{
+    if (script.IsPayToScriptHash()) {
+        hashBytes = uint160(std::vector<unsigned char>(script.begin()+2, script.begin()+22));
+        return 2;
+    }
+    if (script.IsPayToPublicKeyHash()) {
+        hashBytes = uint160(std::vector<unsigned char>(script.begin()+3, script.begin()+23));
+        return 1;
+    }
+    hashBytes.SetNull();
+    return 0;
+}
+
+CIndexBuilder::CIndexBuilder(const std::string& name) : strName(name), pindexBest(nullptr), fSynced(false)
+{
+}
+
+CIndexBuilder::~CIndexBuilder()
+{
+    Interrupt();
+    Stop();
+}
+
+void CIndexBuilder::Start()
+{
+    CBlockLocator locator;
+    const bool fHaveLocator = pindexdb->ReadBestBlock(strName, locator);
+    {
+        LOCK(cs_main);
+        if (!fHaveLocator) {
+            // Earlier versions wrote the index in step with the chain state
+            pindexBest = chainActive.Tip();
+        } else if (locator.IsNull()) {
+            pindexBest = nullptr;
+        } else {
+            // Start from the block itself, which may have been reorganized away
+            BlockMap::const_iterator it = mapBlockIndex.find(locator.vHave[0]);
+            pindexBest = it != mapBlockIndex.end() ? it->second : FindForkInGlobalIndex(chainActive, locator);
+        }
+    }
+
+    // Notifications are ignored until the sync thread has caught up
+    RegisterValidationInterface(this);
+    threadSync = std::thread(&TraceThread<std::function<void()> >, strName.c_str(), std::bind(&CIndexBuilder::ThreadSync, this));
+}
+
+void CIndexBuilder::Interrupt()
+{
+    interrupt();
+}
+
+void CIndexBuilder::Stop()
+{
+    UnregisterValidationInterface(this);
+    if (threadSync.joinable())
+        threadSync.join();
+}
+
+void CIndexBuilder::ThreadSync()
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    const CBlockIndex* pindex = pindexBest;
+    int64_t nLastLog = 0;
+    while (!interrupt) {
+        const CBlockIndex* pindexFork = nullptr;
+        const CBlockIndex* pindexNext = nullptr;
+        bool fBehind = false;
+        {
+            LOCK(cs_main);
+            // The active chain can be behind the index rather than forked
+            // from it, as while -reindex-chainstate connects the blocks again
+            const CBlockIndex* pindexTip = chainActive.Tip();
+            if (pindex && pindex != pindexTip && (!pindexTip || pindex->GetAncestor(pindexTip->nHeight) == pindexTip)) {
+                fBehind = true;
+            } else {
+                pindexFork = pindex ? chainActive.FindFork(pindex) : nullptr;
+                pindexNext = pindexFork ? chainActive.Next(pindexFork) : chainActive.Genesis();
+                if (pindexFork == pindex && !pindexNext) {
+                    // Blocks connected from here on are notified with fSynced set
+                    fSynced = true;
+                    break;
+                }
+            }
+        }
+
+        if (fBehind) {
+            // Wait for it to catch up rather than unwind blocks that are
+            // about to be connected again
+            interrupt.sleep_for(std::chrono::seconds(1));
+            continue;
+        }
+
+        if (pindexFork != pindex) {
+            if (!Rewind(pindexFork)) {
+                AbortNode(strprintf("%s: failed to rewind %s", __func__, strName));
+                return;
+            }
+            pindex = pindexFork;
+            continue;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindexNext, consensusParams)) {
+            AbortNode(strprintf("%s: failed to read block %s from disk to build %s", __func__, pindexNext->GetBlockHash().ToString(), strName));
+            return;
+        }
+        if (!ApplyBlock(block, pindexNext, true)) {
+            AbortNode(strprintf("%s: failed to write block %s to %s", __func__, pindexNext->GetBlockHash().ToString(), strName));
+            return;
+        }
+        pindex = pindexNext;
+
+        const int64_t nNow = GetTime();
+        if (nNow - nLastLog >= INDEX_SYNC_LOG_INTERVAL) {
+            LogPrintf("Building %s, at height %d\n", strName, pindex->nHeight);
+            nLastLog = nNow;
+        }
+    }
+
+    if (fSynced)
+        LogPrintf("%s is up to date at height %d\n", strName, pindex ? pindex->nHeight : -1);
+}
+
+bool CIndexBuilder::ApplyBlock(const CBlock& block, const CBlockIndex* pindex, bool fConnect)
+{
+    CDBBatch batch(*pindexdb);
+
+    // Like block validation, leave out the transactions of the genesis block
+    if (pindex->pprev) {
+        CBlockUndo blockundo;
+        if (NeedsUndo()) {
+            if (!UndoReadFromDisk(blockundo, pindex))
+                return error("%s: failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+            if (blockundo.vtxundo.size() + 1 != block.vtx.size())
+                return error("%s: block and undo data inconsistent", __func__);
+            for (size_t i = 1; i < block.vtx.size(); i++) {
+                if (blockundo.vtxundo[i-1].vprevout.size() != block.vtx[i]->vin.size())
+                    return error("%s: transaction and undo data inconsistent", __func__);
+            }
+        }
+        WriteBlock(batch, block, blockundo, pindex, fConnect);
+    }
+
+    const CBlockIndex* pindexNew = fConnect ? pindex : pindex->pprev;
+    CBlockLocator locator;
+    if (pindexNew) {
+        LOCK(cs_main);
+        locator = chainActive.GetLocator(pindexNew);
+    }
+    pindexdb->WriteBestBlock(batch, strName, locator);
+    if (!pindexdb->WriteBatch(batch))
+        return error("%s: failed to write %s", __func__, strName);
+    pindexBest = pindexNew;
+    return true;
+}
+
+bool CIndexBuilder::Rewind(const CBlockIndex* pindexFork)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    for (const CBlockIndex* pindex = pindexBest; pindex && pindex != pindexFork; pindex = pindex->pprev) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, consensusParams))
+            return error("%s: failed to read block %s from disk", __func__, pindex->GetBlockHash().ToString());
+        if (!ApplyBlock(block, pindex, false))
+            return false;
+    }
+    return true;
+}
+
+void CIndexBuilder::BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex, const std::vector<CTransactionRef>& txnConflicted)
+{
+    if (!fSynced)
+        return;
+
+    const CBlockIndex* pindexPrev = pindexBest;
+    if (pindexPrev && pindexPrev->GetAncestor(pindex->nHeight) == pindex)
+        return; // built by the sync thread, or reconnected by -reindex-chainstate
+    if (pindex->pprev != pindexPrev) {
+        if (pindexPrev && pindex->pprev && !Rewind(LastCommonAncestor(pindexPrev, pindex->pprev))) {
+            AbortNode(strprintf("%s: failed to rewind %s", __func__, strName));
+            return;
+        }
+        if (pindex->pprev != pindexBest) {
+            LogPrintf("%s: block %s does not connect to the best block of %s, not updating it\n",
+                      __func__, pindex->GetBlockHash().ToString(), strName);
+            return;
+        }
+    }
+    if (!ApplyBlock(*block, pindex, true))
+        AbortNode(strprintf("%s: failed to write block %s to %s", __func__, pindex->GetBlockHash().ToString(), strName));
+}
+
+void CIndexBuilder::BlockDisconnected(const std::shared_ptr<const CBlock>& block)
+{
+    if (!fSynced)
+        return;
+
+    const CBlockIndex* pindex = pindexBest;
+    if (!pindex || pindex->GetBlockHash() != block->GetHash())
+        return; // never made it into the index
+    if (!ApplyBlock(*block, pindex, false))
+        AbortNode(strprintf("%s: failed to erase block %s from %s", __func__, pindex->GetBlockHash().ToString(), strName));
+}
+
+namespace {
+
+/** Address index: the changes and unspent outputs of each address, with the
+ *  balance records CIndexDB keeps alongside. */
+class CAddressIndexBuilder : public CIndexBuilder
+{
+public:
+    CAddressIndexBuilder() : CIndexBuilder("addressindex") {}
+
+protected:
+    void WriteBlock(CDBBatch& batch, const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fConnect) override
+    {
+        std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
+        uint160 hashBytes;
+
+        for (unsigned int i = 0; i < block.vtx.size(); i++) {
+            const CTransaction& tx = *block.vtx[i];
+            const uint256 txhash = tx.GetHash();
+
+            if (i > 0) {
+                const CTxUndo& txundo = blockundo.vtxundo[i-1];
+                for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                    const Coin& coin = txundo.vprevout[j];
+                    const int type = GetAddressKey(coin.out.scriptPubKey, hashBytes);
+                    if (type == 0)
+                        continue;
+                    const COutPoint& prevout = tx.vin[j].prevout;
+                    // spending activity, and the spent output leaves the unspent index
+                    addressIndex.push_back(std::make_pair(CAddressIndexKey(type, hashBytes, pindex->nHeight, i, txhash, j, true), coin.out.nValue * -1));
+                    addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(type, hashBytes, prevout.hash, prevout.n),
+                        fConnect ? CAddressUnspentValue() : CAddressUnspentValue(coin.out.nValue, coin.out.scriptPubKey, coin.nHeight)));
+                }
+            }
+
+            for (unsigned int k = 0; k < tx.vout.size(); k++) {
+                const CTxOut& out = tx.vout[k];
+                const int type = GetAddressKey(out.scriptPubKey, hashBytes);
+                if (type == 0)
+                    continue;
+                // receiving activity, and the new unspent output
+                addressIndex.push_back(std::make_pair(CAddressIndexKey(type, hashBytes, pindex->nHeight, i, txhash, k, false), out.nValue));
+                addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(type, hashBytes, txhash, k),
+                    fConnect ? CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight) : CAddressUnspentValue()));
+            }
+        }
+
+        if (fConnect) {
+            pindexdb->WriteAddressIndex(batch, addressIndex);
+        } else {
+            pindexdb->EraseAddressIndex(batch, addressIndex);
+            // Undo in reverse, so an output spent within the block ends up erased
+            std::reverse(addressUnspentIndex.begin(), addressUnspentIndex.end());
+        }
+        pindexdb->UpdateAddressUnspentIndex(batch, addressUnspentIndex);
+    }
+};
+
+/** Spent index: the input spending each output, with the output's amount and address. */
+class CSpentIndexBuilder : public CIndexBuilder
+{
+public:
+    CSpentIndexBuilder() : CIndexBuilder("spentindex") {}
+
+protected:
+    void WriteBlock(CDBBatch& batch, const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fConnect) override
+    {
+        std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+        uint160 hashBytes;
+
+        for (unsigned int i = 1; i < block.vtx.size(); i++) {
+            const CTransaction& tx = *block.vtx[i];
+            const uint256 txhash = tx.GetHash();
+            const CTxUndo& txundo = blockundo.vtxundo[i-1];
+            for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                const Coin& coin = txundo.vprevout[j];
+                const COutPoint& prevout = tx.vin[j].prevout;
+                const int type = GetAddressKey(coin.out.scriptPubKey, hashBytes);
+                spentIndex.push_back(std::make_pair(CSpentIndexKey(prevout.hash, prevout.n),
+                    fConnect ? CSpentIndexValue(txhash, j, pindex->nHeight, coin.out.nValue, type, hashBytes) : CSpentIndexValue()));
+            }
+        }
+        pindexdb->UpdateSpentIndex(batch, spentIndex);
+    }
+};
+
+/** Timestamp index: block hashes by logical timestamp, which strictly increases along the chain. */
+class CTimestampIndexBuilder : public CIndexBuilder
+{
+public:
+    CTimestampIndexBuilder() : CIndexBuilder("timestampindex") {}
+
+protected:
+    bool NeedsUndo() const override { return false; }
+
+    void WriteBlock(CDBBatch& batch, const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fConnect) override
+    {
+        // Entries of disconnected blocks are kept; readers filter them by the active chain
+        if (!fConnect)
+            return;
+
+        unsigned int logicalTS = pindex->nTime;
+        unsigned int prevLogicalTS = 0;
+        // retrieve logical timestamp of the previous block
+        if (!pindexdb->ReadTimestampBlockIndex(pindex->pprev->GetBlockHash(), prevLogicalTS))
+            LogPrintf("%s: Failed to read previous block's logical timestamp\n", __func__);
+        if (logicalTS <= prevLogicalTS) {
+            logicalTS = prevLogicalTS + 1;
+            LogPrintf("%s: Previous logical timestamp is newer Actual[%d] prevLogical[%d] Logical[%d]\n", __func__, pindex->nTime, prevLogicalTS, logicalTS);
+        }
+        pindexdb->WriteTimestampIndex(batch, CTimestampIndexKey(logicalTS, pindex->GetBlockHash()));
+        pindexdb->WriteTimestampBlockIndex(batch, CTimestampBlockIndexKey(pindex->GetBlockHash()), CTimestampBlockIndexValue(logicalTS));
+    }
+};
+
+std::vector<std::unique_ptr<CIndexBuilder> > vIndexBuilders;
+
+} // namespace
+
+bool SetIndexEnabled(const std::string& name, bool& fEnabled, bool fEnable)
+{
+    if (fEnabled == fEnable)
+        return true;
+
+    // Clear the flag first: entries left by an interrupted change are wiped
+    // again when the index is next switched on.
+    if (!fEnable && !pblocktree->WriteFlag(name, false))
+        return error("%s: failed to write %s flag", __func__, name);
+    LogPrintf("%s: %s %s\n", __func__, fEnable ? "building" : "erasing", name);
+    if (!pindexdb->WipeIndex(name))
+        return error("%s: failed to erase %s", __func__, name);
+    if (fEnable) {
+        // A null best block makes the builder start from genesis
+        CDBBatch batch(*pindexdb);
+        pindexdb->WriteBestBlock(batch, name, CBlockLocator());
+        if (!pindexdb->WriteBatch(batch, true))
+            return error("%s: failed to reset %s", __func__, name);
+        if (!pblocktree->WriteFlag(name, true))
+            return error("%s: failed to write %s flag", __func__, name);
+        // Balance records are built along with the address index
+        if (name == "addressindex" && !pblocktree->WriteFlag("addressbalance", true))
+            return error("%s: failed to write addressbalance flag", __func__);
+    }
+    fEnabled = fEnable;
+    return true;
+}
+
+void StartIndexBuilders()
+{
+    if (fAddressIndex)
+        vIndexBuilders.emplace_back(new CAddressIndexBuilder());
+    if (fSpentIndex)
+        vIndexBuilders.emplace_back(new CSpentIndexBuilder());
+    if (fTimestampIndex)
+        vIndexBuilders.emplace_back(new CTimestampIndexBuilder());
+    for (const auto& builder : vIndexBuilders)
+        builder->Start();
+}
+
+void InterruptIndexBuilders()
+{
+    for (const auto& builder : vIndexBuilders)
+        builder->Interrupt();
+}
+
+void StopIndexBuilders()
+{
+    for (const auto& builder : vIndexBuilders)
+        builder->Stop();
+    vIndexBuilders.clear();
+}
+
+std::vector<const CIndexBuilder*> GetIndexBuilders()
+{
+    std::vector<const CIndexBuilder*> vBuilders;
+    for (const auto& builder : vIndexBuilders)
+        vBuilders.push_back(builder.get());
+    return vBuilders;
+}
@@ -0,0 +1,81 @@
+// Copyright (c) 2018 The Genesis Official developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef GENESIS_INDEXBUILDER_H
+#define GENESIS_INDEXBUILDER_H
+
+#include <dbwrapper.h>
+#include <threadinterrupt.h>
+#include <validationinterface.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+class CBlockIndex;
+class CBlockUndo;
+
+//! Seconds between progress messages while an index catches up
+static const int64_t INDEX_SYNC_LOG_INTERVAL = 30;
+
+/**
+ * Builds one of the optional indexes off the block validation path. Starting
+ * after the block the index was last written up to, a thread reads blocks and
+ * their undo data from disk until it reaches the tip of the active chain;
+ * from then on the index follows connected and disconnected blocks through
+ * the validation interface. The entries of a block are written in one batch
+ * with the index's best block, so a build that is interrupted resumes where
+ * it stopped.
+ */
+class CIndexBuilder : public CValidationInterface
+{
+public:
+    explicit CIndexBuilder(const std::string& name);
+    virtual ~CIndexBuilder();
+
+    /** Resume from the stored best block and start following the chain. */
+    void Start();
+    void Interrupt();
+    void Stop();
+
+    const std::string& GetName() const { return strName; }
+    /** Whether the index has caught up with the active chain. */
+    bool IsSynced() const { return fSynced; }
+    /** The last block whose entries are in the index, or null. */
+    const CBlockIndex* GetBestBlock() const { return pindexBest; }
+
+protected:
+    void BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex, const std::vector<CTransactionRef>& txnConflicted) override;
+    void BlockDisconnected(const std::shared_ptr<const CBlock>& block) override;
+
+    /** Whether WriteBlock looks at the spent outputs in the undo data. */
+    virtual bool NeedsUndo() const { return true; }
+    /** Add the entries of a connected block to batch, or (!fConnect) their erasure. */
+    virtual void WriteBlock(CDBBatch& batch, const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fConnect) = 0;
+
+private:
+    void ThreadSync();
+    /** Write or erase the entries of one block together with the new best block. */
+    bool ApplyBlock(const CBlock& block, const CBlockIndex* pindex, bool fConnect);
+    /** Erase the entries of the blocks after pindexFork. */
+    bool Rewind(const CBlockIndex* pindexFork);
+
+    const std::string strName;
+    std::atomic<const CBlockIndex*> pindexBest;
+    std::atomic<bool> fSynced;
+    std::thread threadSync;
+    CThreadInterrupt interrupt;
+};
+
+/** Switch the named index on or off in the database. An index switched on is
+ *  built from scratch by its builder; one switched off is erased. */
+bool SetIndexEnabled(const std::string& name, bool& fEnabled, bool fEnable);
+/** Start a builder for each enabled index. */
+void StartIndexBuilders();
+void InterruptIndexBuilders();
+void StopIndexBuilders();
+std::vector<const CIndexBuilder*> GetIndexBuilders();
+
+#endif // GENESIS_INDEXBUILDER_H
@@ -11,14 +11,18 @@
 
 #include <addrman.h>
 #include <amount.h>
+#include <base58.h>
+#include <blocktimeindex.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
 #include <compat/sanity.h>
 #include <consensus/validation.h>
+#include <crypto/blake2b.h>
 #include <fs.h>
 #include <httpserver.h>
 #include <httprpc.h>
+#include <indexbuilder.h>
 #include <key.h>
 #include <validation.h>
 #include <miner.h>
@@ -35,6 +39,7 @@
 #include <script/standard.h>
 #include <script/sigcache.h>
 #include <scheduler.h>
+#include <subsidycache.h>
 #include <timedata.h>
 #include <txdb.h>
 #include <txmempool.h>
@@ -47,6 +52,7 @@
 #include <wallet/init.h>
 #endif
 #include <warnings.h>
+#include <workserver.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <memory>
@@ -149,6 +155,15 @@ public:
             abort();
         }
     }
+    size_t GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins, std::vector<bool> &found) const override {
+        try {
+            return CCoinsViewBacked::GetCoins(outpoints, coins, found);
+        } catch(const std::runtime_error& e) {
+            uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
+            LogPrintf("Error reading from database: %s\n", e.what());
+            abort();
+        }
+    }
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
@@ -165,6 +180,8 @@ void Interrupt()
     InterruptRPC();
     InterruptREST();
     InterruptTorControl();
+    InterruptWorkServer();
+    InterruptIndexBuilders();
     if (g_connman)
         g_connman->Interrupt();
 }
@@ -201,6 +218,7 @@ void Shutdown()
     g_connman.reset();
 
     StopTorControl();
+    StopWorkServer();
 
     // After everything has been shut down, but before things get flushed, stop the
     // CScheduler/checkqueue threadGroup
@@ -232,6 +250,9 @@ void Shutdown()
     // CValidationInterface callbacks, flush them...
     GetMainSignals().FlushBackgroundCallbacks();
 
+    // Stop the index builders only after flushing the callbacks they follow
+    StopIndexBuilders();
+
     // Any future callbacks will be dropped. This should absolutely be safe - if
     // missing a callback results in an unrecoverable situation, unclean shutdown
     // would too. The only reason to do the above flushes is to let the wallet catch
@@ -247,11 +268,15 @@ void Shutdown()
         pcoinscatcher.reset();
         pcoinsdbview.reset();
         pblocktree.reset();
+        pindexdb.reset();
     }
 #ifdef ENABLE_WALLET
     StopWallets();
 #endif
 
+    UnregisterValidationInterface(&subsidyCache);
+    UnregisterValidationInterface(&blockTimeIndex);
+
 #if ENABLE_ZMQ
     if (pzmqNotificationInterface) {
         UnregisterValidationInterface(pzmqNotificationInterface);
@@ -351,11 +376,13 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-daemon", _("Run in the background as a daemon and accept commands"));
 #endif
     }
+    strUsage += HelpMessageOpt("-asynccoinsflush", strprintf(_("Write the coins cache to disk in a background thread while blocks keep connecting; may hold up to twice -dbcache in memory (default: %u)"), DEFAULT_ASYNC_COINS_FLUSH));
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     if (showDebug) {
         strUsage += HelpMessageOpt("-dbbatchsize", strprintf("Maximum database write batch size in bytes (default: %u)", nDefaultDbBatchSize));
     }
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-indexdbcache=<n>", strprintf(_("Set the cache size of the address, spent and timestamp index database in megabytes, on top of -dbcache (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultIndexDbCache));
     if (showDebug)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
@@ -506,6 +533,10 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blockmintxfee=<amt>", strprintf(_("Set lowest fee rate (in %s/kB) for transactions to be included in block creation. (default: %s)"), CURRENCY_UNIT, FormatMoney(DEFAULT_BLOCK_MIN_TX_FEE)));
     if (showDebug)
         strUsage += HelpMessageOpt("-blockversion=<n>", "Override block version to test forking scenarios");
+    strUsage += HelpMessageOpt("-equihashsolver=<name>", strprintf(_("Equihash solver used by the built-in miner and the generate RPCs: tromp, radix or default; tromp falls back to radix for parameters it is not built for (default: %s)"), DEFAULT_EQUIHASH_SOLVER));
+    strUsage += HelpMessageOpt("-equihashsolverthreads=<n>", strprintf(_("Number of threads each tromp solver uses on a single nonce, sharing one set of buckets (default: %d)"), DEFAULT_EQUIHASH_SOLVER_THREADS));
+    strUsage += HelpMessageOpt("-equihashhugepages", strprintf(_("Back the tromp solver's buckets with huge pages where the system provides them (default: %u)"), DEFAULT_EQUIHASH_HUGE_PAGES));
+    strUsage += HelpMessageOpt("-workserverport=<port>", strprintf(_("Serve Stratum-style Equihash jobs to local miners on 127.0.0.1:<port>, paying the coinbase to -mineraddress (default: %u, 0 to disable)"), DEFAULT_WORKSERVER_PORT));
 
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
@@ -1184,6 +1215,8 @@ bool AppInitSanityChecks()
     // Initialize elliptic curve code
     std::string sha256_algo = SHA256AutoDetect();
     LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);
+    std::string blake2b_algo = Blake2bAutoDetect();
+    LogPrintf("Using the '%s' BLAKE2b implementation for Equihash\n", blake2b_algo);
     RandomInit();
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
@@ -1248,10 +1281,12 @@ bool AppInitMain()
     InitSignatureCache();
     InitScriptExecutionCache();
 
-    LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    LogPrintf("Using %u threads for script and header Equihash verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadEquihashCheck);
     }
 
     // Start the lightweight task scheduler thread
@@ -1300,6 +1335,8 @@ bool AppInitMain()
 
     peerLogic.reset(new PeerLogicValidation(&connman, scheduler));
     RegisterValidationInterface(peerLogic.get());
+    RegisterValidationInterface(&subsidyCache);
+    RegisterValidationInterface(&blockTimeIndex);
 
     // sanitize comments per BIP-0014, format user agent and check total size
     std::vector<std::string> uacomments;
@@ -1420,11 +1457,13 @@ bool AppInitMain()
     nTotalCache = std::max(nTotalCache, nMinDbCache << 20); // total cache cannot be less than nMinDbCache
     nTotalCache = std::min(nTotalCache, nMaxDbCache << 20); // total cache cannot be greater than nMaxDbcache
     int64_t nBlockTreeDBCache = nTotalCache / 8;
-        if (gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX) || gArgs.GetBoolArg("-spentindex", DEFAULT_SPENTINDEX)) {
-        // enable 3/4 of the cache if addressindex and/or spentindex is enabled
-        nBlockTreeDBCache = nTotalCache * 3 / 4;
-    } else {
-        nBlockTreeDBCache = std::min(nBlockTreeDBCache, (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxBlockDBAndTxIndexCache : nMaxBlockDBCache) << 20);
+    nBlockTreeDBCache = std::min(nBlockTreeDBCache, (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxBlockDBAndTxIndexCache : nMaxBlockDBCache) << 20);
+    // the address, spent and timestamp indexes have their own budget outside -dbcache
+    int64_t nIndexDBCache = nMinDbCache << 20;
+    if (gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX) || gArgs.GetBoolArg("-spentindex", DEFAULT_SPENTINDEX) || gArgs.GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX)) {
+        nIndexDBCache = gArgs.GetArg("-indexdbcache", nDefaultIndexDbCache) << 20;
+        nIndexDBCache = std::max(nIndexDBCache, nMinDbCache << 20);
+        nIndexDBCache = std::min(nIndexDBCache, nMaxDbCache << 20);
     }
     nTotalCache -= nBlockTreeDBCache;
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
@@ -1435,6 +1474,7 @@ bool AppInitMain()
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Max cache setting possible %.1fMiB\n", nMaxDbCache);
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1fMiB for index database\n", nIndexDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set (plus up to %.1fMiB of unused mempool space)\n", nCoinCacheUsage * (1.0 / 1024 / 1024), nMempoolSizeMax * (1.0 / 1024 / 1024));
 
@@ -1456,6 +1496,8 @@ bool AppInitMain()
                 // fails if it's still open from the previous loop. Close it first:
                 pblocktree.reset();
                 pblocktree.reset(new CBlockTreeDB(nBlockTreeDBCache, false, fReset, dbCompression, dbMaxOpenFiles, dbMaxFileSize));
+                pindexdb.reset();
+                pindexdb.reset(new CIndexDB(nIndexDBCache, false, fReset, dbCompression, dbMaxOpenFiles, dbMaxFileSize));
 
                 if (fReset) {
                     pblocktree->WriteReindexing(true);
@@ -1487,19 +1529,19 @@ bool AppInitMain()
                     break;
                 }
 
-	            // Check for changed -addressindex state
-                if (fAddressIndex != gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX)) {
-                    strLoadError = _("You need to rebuild the database using -reindex-chainstate to change -addressindex");
-                    break;
-                }
-                 // Check for changed -spentindex state
-                if (fSpentIndex != gArgs.GetBoolArg("-spentindex", DEFAULT_SPENTINDEX)) {
-                    strLoadError = _("You need to rebuild the database using -reindex-chainstate to change -spentindex");
+                // Check for changed -addressindex, -spentindex and -timestampindex state. An index
+                // switched on is built in the background, which needs the blocks from genesis.
+                const bool fAddressIndexArg = gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
+                const bool fSpentIndexArg = gArgs.GetBoolArg("-spentindex", DEFAULT_SPENTINDEX);
+                const bool fTimestampIndexArg = gArgs.GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX);
+                if (fHavePruned && ((fAddressIndexArg && !fAddressIndex) || (fSpentIndexArg && !fSpentIndex) || (fTimestampIndexArg && !fTimestampIndex))) {
+                    strLoadError = _("You need to rebuild the database using -reindex to enable an index on a pruned node");
                     break;
                 }
-                 // Check for changed -timestampindex state
-                if (fTimestampIndex != gArgs.GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX)) {
-                    strLoadError = _("You need to rebuild the database using -reindex-chainstate to change -timestampindex");
+                if (!SetIndexEnabled("addressindex", fAddressIndex, fAddressIndexArg) ||
+                    !SetIndexEnabled("spentindex", fSpentIndex, fSpentIndexArg) ||
+                    !SetIndexEnabled("timestampindex", fTimestampIndex, fTimestampIndexArg)) {
+                    strLoadError = _("Error switching indexes on or off");
                     break;
                 }
 
@@ -1539,6 +1581,8 @@ bool AppInitMain()
                 }
 
                 // The on-disk coinsdb is now in a good state, create the cache
+                if (gArgs.GetBoolArg("-asynccoinsflush", DEFAULT_ASYNC_COINS_FLUSH))
+                    pcoinsdbview->StartBackgroundFlush();
                 pcoinsTip.reset(new CCoinsViewCache(pcoinscatcher.get()));
 
                 bool is_coinsview_empty = fReset || fReindexChainState || pcoinsTip->GetBestBlock().IsNull();
@@ -1686,6 +1730,9 @@ bool AppInitMain()
         vImportFiles.push_back(strFile);
     }
 
+    // Catch up the enabled indexes and keep them following the chain
+    StartIndexBuilders();
+
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
 
     // Wait for genesis block to be processed
@@ -1719,6 +1766,15 @@ bool AppInitMain()
     if (gArgs.GetBoolArg("-listenonion", DEFAULT_LISTEN_ONION))
         StartTorControl(threadGroup, scheduler);
 
+    const int nWorkServerPort = gArgs.GetArg("-workserverport", DEFAULT_WORKSERVER_PORT);
+    if (nWorkServerPort > 0) {
+        CTxDestination dest = DecodeDestination(gArgs.GetArg("-mineraddress", ""));
+        if (!IsValidDestination(dest))
+            return InitError(_("-workserverport requires a valid -mineraddress to pay the coinbase to"));
+        if (nWorkServerPort > 65535 || !StartWorkServer(nWorkServerPort, GetScriptForDestination(dest)))
+            return InitError(strprintf(_("Unable to start the work server on port %d"), nWorkServerPort));
+    }
+
     Discover(threadGroup);
 
     // Map ports with UPnP
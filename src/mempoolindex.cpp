@@ -0,0 +1,158 @@
+// Copyright (c) 2018 The Genesis Official developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <mempoolindex.h>
+
+#include <hash.h>
+#include <random.h>
+#include <script/script.h>
+
+#include <algorithm>
+#include <limits>
+#include <string.h>
+
+bool GetScriptAddressId(const CScript& script, CMempoolAddressId& id)
+{
+    if (script.IsPayToScriptHash()) {
+        id.type = 2;
+        memcpy(id.hash.begin(), &script[2], 20);
+        return true;
+    }
+    if (script.IsPayToPublicKeyHash()) {
+        id.type = 1;
+        memcpy(id.hash.begin(), &script[3], 20);
+        return true;
+    }
+    return false;
+}
+
+CMempoolAddressIndex::Hasher::Hasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+size_t CMempoolAddressIndex::Hasher::operator()(const CMempoolAddressId& id) const
+{
+    return CSipHasher(k0, k1).Write(id.hash.begin(), id.hash.size()).Write(id.type).Finalize();
+}
+
+size_t CMempoolAddressIndex::Hasher::operator()(const uint256& txhash) const
+{
+    return SipHashUint256(k0, k1, txhash);
+}
+
+void CMempoolAddressIndex::LockAddressShards(const std::vector<CMempoolAddressId>& ids, std::vector<std::unique_ptr<CCriticalBlock> >& locks) const
+{
+    std::vector<size_t> shards;
+    shards.reserve(ids.size());
+    for (const CMempoolAddressId& id : ids)
+        shards.push_back(GetShard(id));
+    std::sort(shards.begin(), shards.end());
+    shards.erase(std::unique(shards.begin(), shards.end()), shards.end());
+
+    locks.reserve(locks.size() + shards.size());
+    for (size_t i : shards)
+        locks.emplace_back(new CCriticalBlock(vAddressShards[i].cs, "vAddressShards[i].cs", __FILE__, __LINE__));
+}
+
+void CMempoolAddressIndex::Add(const uint256& txhash, const std::vector<Entry>& entries)
+{
+    std::vector<CMempoolAddressId> ids;
+    for (const Entry& entry : entries) {
+        const CMempoolAddressId id(entry.first.type, entry.first.addressBytes);
+        if (std::find(ids.begin(), ids.end(), id) == ids.end())
+            ids.push_back(id);
+    }
+    if (ids.empty())
+        return;
+
+    {
+        std::vector<std::unique_ptr<CCriticalBlock> > locks;
+        LockAddressShards(ids, locks);
+        for (const Entry& entry : entries) {
+            const CMempoolAddressId id(entry.first.type, entry.first.addressBytes);
+            vAddressShards[GetShard(id)].map[id].push_back(entry);
+        }
+    }
+
+    TxShard& shard = vTxShards[GetShard(txhash)];
+    LOCK(shard.cs);
+    std::vector<CMempoolAddressId>& inserted = shard.map[txhash];
+    inserted.insert(inserted.end(), ids.begin(), ids.end());
+}
+
+void CMempoolAddressIndex::Remove(const uint256& txhash)
+{
+    std::vector<CMempoolAddressId> ids;
+    {
+        TxShard& shard = vTxShards[GetShard(txhash)];
+        LOCK(shard.cs);
+        auto it = shard.map.find(txhash);
+        if (it == shard.map.end())
+            return;
+        ids.swap(it->second);
+        shard.map.erase(it);
+    }
+
+    std::vector<std::unique_ptr<CCriticalBlock> > locks;
+    LockAddressShards(ids, locks);
+    for (const CMempoolAddressId& id : ids) {
+        AddressShard& shard = vAddressShards[GetShard(id)];
+        auto it = shard.map.find(id);
+        if (it == shard.map.end())
+            continue;
+        std::vector<Entry>& v = it->second;
+        v.erase(std::remove_if(v.begin(), v.end(), [&txhash](const Entry& entry) { return entry.first.txhash == txhash; }), v.end());
+        if (v.empty())
+            shard.map.erase(it);
+    }
+}
+
+void CMempoolAddressIndex::Get(const std::vector<std::pair<uint160, int> >& addresses, std::vector<Entry>& results) const
+{
+    std::vector<CMempoolAddressId> ids;
+    ids.reserve(addresses.size());
+    for (const std::pair<uint160, int>& address : addresses)
+        ids.emplace_back(address.second, address.first);
+
+    std::vector<std::unique_ptr<CCriticalBlock> > locks;
+    LockAddressShards(ids, locks);
+    for (const CMempoolAddressId& id : ids) {
+        const AddressShard& shard = vAddressShards[GetShard(id)];
+        auto it = shard.map.find(id);
+        if (it != shard.map.end())
+            results.insert(results.end(), it->second.begin(), it->second.end());
+    }
+}
+
+CMempoolSpentIndex::Hasher::Hasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+size_t CMempoolSpentIndex::Hasher::operator()(const CSpentIndexKey& key) const
+{
+    return SipHashUint256Extra(k0, k1, key.txid, key.outputIndex);
+}
+
+void CMempoolSpentIndex::Add(const CSpentIndexKey& key, const CSpentIndexValue& value)
+{
+    Shard& shard = vShards[GetShard(key)];
+    LOCK(shard.cs);
+    shard.map[key] = value;
+}
+
+void CMempoolSpentIndex::Remove(const CSpentIndexKey& key, const uint256& txhash)
+{
+    Shard& shard = vShards[GetShard(key)];
+    LOCK(shard.cs);
+    auto it = shard.map.find(key);
+    if (it != shard.map.end() && it->second.txid == txhash)
+        shard.map.erase(it);
+}
+
+bool CMempoolSpentIndex::Get(const CSpentIndexKey& key, CSpentIndexValue& value) const
+{
+    const Shard& shard = vShards[GetShard(key)];
+    LOCK(shard.cs);
+    auto it = shard.map.find(key);
+    if (it == shard.map.end())
+        return false;
+    value = it->second;
+    return true;
+}
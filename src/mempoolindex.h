@@ -0,0 +1,149 @@
+// Copyright (c) 2018 The Genesis Official developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef GENESIS_MEMPOOLINDEX_H
+#define GENESIS_MEMPOOLINDEX_H
+
+#include <addressindex.h>
+#include <spentindex.h>
+#include <sync.h>
+#include <uint256.h>
+
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class CScript;
+
+//! Number of independently locked shards of the mempool address and spent indexes
+static const size_t MEMPOOL_INDEX_SHARDS = 32;
+
+/** The address type and hash160 that index entries are filed under. */
+struct CMempoolAddressId
+{
+    int type;
+    uint160 hash;
+
+    CMempoolAddressId() : type(0) {}
+    CMempoolAddressId(int typeIn, const uint160& hashIn) : type(typeIn), hash(hashIn) {}
+
+    friend bool operator==(const CMempoolAddressId& a, const CMempoolAddressId& b)
+    {
+        return a.type == b.type && a.hash == b.hash;
+    }
+};
+
+/**
+ * Read the address of a pay-to-script-hash (type 2) or pay-to-pubkey-hash
+ * (type 1) script straight from the script bytes. Returns false for any other
+ * script.
+ */
+bool GetScriptAddressId(const CScript& script, CMempoolAddressId& id);
+
+/**
+ * Address deltas of the transactions in the mempool. Entries live in an
+ * unordered map per shard, each with its own lock, so that filing the entries
+ * of a new transaction does not wait for the mempool lock or for readers of
+ * other addresses. Writers and readers hold the locks of all the shards they
+ * touch at once, taken in ascending shard order, so a reader sees either all
+ * or none of a transaction's entries.
+ */
+class CMempoolAddressIndex
+{
+public:
+    typedef std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> Entry;
+
+    /** File the entries of transaction txhash. */
+    void Add(const uint256& txhash, const std::vector<Entry>& entries);
+    /** Drop the entries of transaction txhash. */
+    void Remove(const uint256& txhash);
+    /** Append the entries of each of the given (hash, type) addresses to results, as of one point in time. */
+    void Get(const std::vector<std::pair<uint160, int> >& addresses, std::vector<Entry>& results) const;
+
+private:
+    class Hasher
+    {
+    private:
+        /** Salt */
+        const uint64_t k0, k1;
+
+    public:
+        Hasher();
+
+        size_t operator()(const CMempoolAddressId& id) const;
+        size_t operator()(const uint256& txhash) const;
+    };
+
+    struct AddressShard
+    {
+        mutable CCriticalSection cs;
+        std::unordered_map<CMempoolAddressId, std::vector<Entry>, Hasher> map;
+    };
+
+    struct TxShard
+    {
+        CCriticalSection cs;
+        //! Addresses each transaction has entries under
+        std::unordered_map<uint256, std::vector<CMempoolAddressId>, Hasher> map;
+    };
+
+    const Hasher hasher;
+    AddressShard vAddressShards[MEMPOOL_INDEX_SHARDS];
+    TxShard vTxShards[MEMPOOL_INDEX_SHARDS];
+
+    size_t GetShard(const CMempoolAddressId& id) const { return hasher(id) % MEMPOOL_INDEX_SHARDS; }
+    size_t GetShard(const uint256& txhash) const { return hasher(txhash) % MEMPOOL_INDEX_SHARDS; }
+
+    /** Lock the address shards of ids, in ascending shard order. The locks are held until locks is destroyed. */
+    void LockAddressShards(const std::vector<CMempoolAddressId>& ids, std::vector<std::unique_ptr<CCriticalBlock> >& locks) const;
+};
+
+/**
+ * Mempool spenders of outputs, sharded the same way as the address index.
+ * The key of an entry is one of the inputs of the spending transaction, so
+ * removal needs no record of what was inserted.
+ */
+class CMempoolSpentIndex
+{
+public:
+    void Add(const CSpentIndexKey& key, const CSpentIndexValue& value);
+    /** Drop the entry for key if it was filed by transaction txhash. */
+    void Remove(const CSpentIndexKey& key, const uint256& txhash);
+    bool Get(const CSpentIndexKey& key, CSpentIndexValue& value) const;
+
+private:
+    class Hasher
+    {
+    private:
+        /** Salt */
+        const uint64_t k0, k1;
+
+    public:
+        Hasher();
+
+        size_t operator()(const CSpentIndexKey& key) const;
+    };
+
+    struct KeyEqual
+    {
+        bool operator()(const CSpentIndexKey& a, const CSpentIndexKey& b) const
+        {
+            return a.txid == b.txid && a.outputIndex == b.outputIndex;
+        }
+    };
+
+    struct Shard
+    {
+        mutable CCriticalSection cs;
+        std::unordered_map<CSpentIndexKey, CSpentIndexValue, Hasher, KeyEqual> map;
+    };
+
+    const Hasher hasher;
+    Shard vShards[MEMPOOL_INDEX_SHARDS];
+
+    size_t GetShard(const CSpentIndexKey& key) const { return hasher(key) % MEMPOOL_INDEX_SHARDS; }
+};
+
+#endif // GENESIS_MEMPOOLINDEX_H
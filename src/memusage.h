@@ -6,9 +6,11 @@
 #define GENESIS_MEMUSAGE_H
 
 #include <indirectmap.h>
+#include <support/allocators/pool.h>
 
 #include <stdlib.h>
 
+#include <functional>
 #include <map>
 #include <memory>
 #include <set>
@@ -165,6 +167,16 @@ static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+template<typename X, typename Y, typename Z, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z, std::equal_to<X>, PoolAllocator<std::pair<const X, Y>, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> >& m)
+{
+    // Nodes live in the chunks of the pool, the bucket array on the heap
+    const auto& pResource = m.get_allocator().resource();
+    if (!pResource)
+        return MallocUsage(sizeof(unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
+    return pResource->ChunkBytes() + MallocUsage(sizeof(void*) * m.bucket_count());
+}
+
 }
 
 #endif // GENESIS_MEMUSAGE_H
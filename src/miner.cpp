@@ -38,6 +38,8 @@
 #include <boost/thread.hpp>
 #include <sodium.h>
 #include <crypto/equihash/equihash.h>
+// Bucket slot and solution counters must be atomic for -equihashsolverthreads > 1.
+#define EQUIHASH_TROMP_ATOMIC
 #include <pow/tromp/equi_miner.h>
 #include <functional>
 #include <mutex>
@@ -618,6 +620,125 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+CTrompSolver::CTrompSolver(unsigned int n, unsigned int k, int nThreads, bool fHugePages) : eq(newequi(n, k, std::max(1, nThreads), fHugePages))
+{
+    assert(eq);
+}
+
+CTrompSolver::~CTrompSolver()
+{
+}
+
+std::vector<std::vector<unsigned char>> CTrompSolver::Solve(const crypto_generichash_blake2b_state& curr_state,
+                                                            const std::function<bool()>& cancelled)
+{
+    // Run all rounds on this thread and nThreads-1 helpers sharing the arena.
+    if (!eq->run(&curr_state, cancelled))
+        throw EhSolverCancelledException();
+
+    // Convert solution indices to byte arrays (decompress).
+    const size_t nSols = eq->nsolutions();
+    std::vector<std::vector<unsigned char>> solutions;
+    solutions.reserve(nSols);
+    for (size_t s = 0; s < nSols; s++)
+    {
+        std::vector<eh_index> index_vector(eq->solution(s), eq->solution(s) + eq->proofsize());
+        solutions.push_back(GetMinimalFromIndices(index_vector, eq->digitbits()));
+    }
+    return solutions;
+}
+
+bool CTrompSolver::Supports(unsigned int n, unsigned int k)
+{
+    // The parameter sets newequi instantiates.
+    return (n == 192 && k == 7) || (n == 200 && k == 9) || (n == 96 && k == 5) ||
+           (n == 96 && k == 3) || (n == 48 && k == 5);
+}
+
+bool CTrompSolver::Solve(const crypto_generichash_blake2b_state& curr_state,
+                         const std::function<bool(std::vector<unsigned char>)>& validBlock,
+                         const std::function<bool(EhSolverCancelCheck)>& cancelled)
+{
+    std::function<bool()> roundEnd = [&cancelled]() { return cancelled(RoundEnd); };
+    for (const std::vector<unsigned char>& soln : Solve(curr_state, roundEnd))
+    {
+        if (validBlock(soln))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * The optimised solver of crypto/equihash, for any (n, k), ordering its lists
+ * with std::sort ("default") or by a radix sort of the collision bits ("radix").
+ */
+class CPortableEquihashSolver : public CEquihashSolver
+{
+public:
+    CPortableEquihashSolver(unsigned int nIn, unsigned int kIn, bool fRadixSortIn) : n(nIn), k(kIn), fRadixSort(fRadixSortIn) {}
+
+    std::string GetName() const override { return fRadixSort ? "radix" : "default"; }
+
+    bool Solve(const crypto_generichash_blake2b_state& curr_state,
+               const std::function<bool(std::vector<unsigned char>)>& validBlock,
+               const std::function<bool(EhSolverCancelCheck)>& cancelled) override
+    {
+        return EhOptimisedSolve(n, k, curr_state, validBlock, cancelled, fRadixSort);
+    }
+
+private:
+    const unsigned int n;
+    const unsigned int k;
+    const bool fRadixSort;
+};
+
+std::unique_ptr<CEquihashSolver> MakeEquihashSolver(const std::string& strName, unsigned int n, unsigned int k, int nThreads, bool fHugePages)
+{
+    if (strName == "tromp")
+    {
+        if (CTrompSolver::Supports(n, k))
+            return std::unique_ptr<CEquihashSolver>(new CTrompSolver(n, k, nThreads, fHugePages));
+    }
+    else if (strName != "radix" && strName != "default")
+        throw std::runtime_error(strprintf("Unknown Equihash solver \"%s\"", strName));
+    return std::unique_ptr<CEquihashSolver>(new CPortableEquihashSolver(n, k, strName != "default"));
+}
+
+/**
+ * Tracks the active tip for the miner threads so that a solve on a block
+ * whose parent is no longer the tip can be abandoned between solver rounds,
+ * rather than noticed only after the solve has run to completion. It is
+ * registered once and lives until shutdown, since miner threads are
+ * interrupted but never joined.
+ */
+class CMinerTipWatcher : public CValidationInterface
+{
+public:
+    /** Whether a tip other than hashPrev, at least as high, has been reported. */
+    bool IsStale(const uint256& hashPrev, int nHeightPrev)
+    {
+        std::lock_guard<std::mutex> lock{m_cs};
+        // Notifications are delivered asynchronously, so one for an earlier
+        // tip may still arrive after work on its successor has begun.
+        return !hashTip.IsNull() && hashTip != hashPrev && nHeightTip >= nHeightPrev;
+    }
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override
+    {
+        std::lock_guard<std::mutex> lock{m_cs};
+        hashTip = pindexNew->GetBlockHash();
+        nHeightTip = pindexNew->nHeight;
+    }
+
+private:
+    std::mutex m_cs;
+    uint256 hashTip;
+    int nHeightTip = 0;
+};
+
+static CMinerTipWatcher minerTipWatcher;
+
 void static GenesisMiner(CWallet *pwallet)
 {
     LogPrintf("Genesis Miner started\n");
@@ -634,18 +755,20 @@ void static GenesisMiner(CWallet *pwallet)
     unsigned int n = chainparams.EquihashN();
     unsigned int k = chainparams.EquihashK();
 
-    std::string solver = gArgs.GetArg("-equihashsolver", "tromp");
-    assert(solver == "tromp" || solver == "default");
-    LogPrintf("Using Equihash solver \"%s\" with n = %u, k = %u\n", solver, n, k);
+    int nSolverThreads = std::max(1, (int)gArgs.GetArg("-equihashsolverthreads", DEFAULT_EQUIHASH_SOLVER_THREADS));
+    bool fHugePages = gArgs.GetBoolArg("-equihashhugepages", DEFAULT_EQUIHASH_HUGE_PAGES);
+    std::unique_ptr<CEquihashSolver> solver;
+    try
+    {
+        solver = MakeEquihashSolver(gArgs.GetArg("-equihashsolver", DEFAULT_EQUIHASH_SOLVER), n, k, nSolverThreads, fHugePages);
+    }
+    catch (const std::runtime_error& e)
+    {
+        LogPrintf("Genesis Miner: %s\n", e.what());
+        return;
+    }
+    LogPrintf("Using Equihash solver \"%s\" with n = %u, k = %u\n", solver->GetName(), n, k);
 
-    std::mutex m_cs;
-    bool cancelSolver = false;
-    // boost::signals2::connection c = uiInterface.NotifyBlockTip.connect(
-    //     [&m_cs, &cancelSolver](const uint256& hashNewTip) mutable {
-    //         std::lock_guard<std::mutex> lock{m_cs};
-    //         cancelSolver = true;
-    //     }
-    // );
     BlockAssembler blockassembler(chainparams);
     //miningTimer.start();
 
@@ -743,7 +866,7 @@ void static GenesisMiner(CWallet *pwallet)
                 //LogPrint("pow", "Running Equihash solver \"%s\" with nNonce = %s\n", solver, pblock->nNonce.ToString());
 
                 std::function<bool(std::vector<unsigned char>)> validBlock =
-                        [&pblock, &hashTarget, &pwallet, &reservekey, &m_cs, &cancelSolver, &chainparams, &blockassembler]
+                        [&pblock, &hashTarget, &pwallet, &reservekey, &chainparams, &blockassembler]
                         (std::vector<unsigned char> soln) 
                 {
                     // Write the solution to the hash and compute the result.
@@ -760,12 +883,7 @@ void static GenesisMiner(CWallet *pwallet)
                     //SetThreadPriority(THREAD_PRIORITY_NORMAL);
                     //LogPrintf("Genesis Miner:\n");
                     //LogPrintf("proof-of-work found  \n  hash: %s  \ntarget: %s\n", pblock->GetHash().GetHex(), hashTarget.GetHex());
-                    if (blockassembler.ProcessBlockFound(pblock, *pwallet, reservekey)) 
-                    {
-                        // Ignore chain updates caused by us
-                        std::lock_guard<std::mutex> lock{m_cs};
-                        cancelSolver = false;
-                    }
+                    blockassembler.ProcessBlockFound(pblock, *pwallet, reservekey);
                     //SetThreadPriority(THREAD_PRIORITY_LOWEST);
 
                     // In regression test mode, stop mining after a block is found.
@@ -778,69 +896,24 @@ void static GenesisMiner(CWallet *pwallet)
 
                     return true;
                 };
-                std::function<bool(EhSolverCancelCheck)> cancelled = [&m_cs, &cancelSolver](EhSolverCancelCheck pos) 
+                // Abandon the solve once the tip moves past pindexPrev or the thread is stopped
+                std::function<bool(EhSolverCancelCheck)> cancelled = [pindexPrev](EhSolverCancelCheck pos)
                 {
-                    std::lock_guard<std::mutex> lock{m_cs};
-                    return cancelSolver;
+                    return boost::this_thread::interruption_requested() ||
+                           minerTipWatcher.IsStale(pindexPrev->GetBlockHash(), pindexPrev->nHeight);
                 };
 
-                // TODO: factor this out into a function with the same API for each solver.
-                if (solver == "tromp") 
+                try 
                 {
-                    // Create solver and initialize it.
-                    equi eq(1);
-                    eq.setstate(&curr_state);
-
-                    // Initialization done, start algo driver.
-                    eq.digit0(0);
-                    eq.xfull = eq.bfull = eq.hfull = 0;
-                    eq.showbsizes(0);
-                    for (u32 r = 1; r < WK; r++) 
-                    {
-                        (r&1) ? eq.digitodd(r, 0) : eq.digiteven(r, 0);
-                        eq.xfull = eq.bfull = eq.hfull = 0;
-                        eq.showbsizes(r);
-                    }
-                    eq.digitK(0);
-                    //ehSolverRuns.increment();
-
-                    // Convert solution indices to byte array (decompress) and pass it to validBlock method.
-                    for (size_t s = 0; s < eq.nsols; s++) 
+                    // If we find a valid block, we rebuild
+                    if (solver->Solve(curr_state, validBlock, cancelled)) 
                     {
-                        //LogPrint("pow", "Checking solution %d\n", s+1);
-                        std::vector<eh_index> index_vector(PROOFSIZE);
-                        for (size_t i = 0; i < PROOFSIZE; i++) 
-                        {
-                            index_vector[i] = eq.sols[s][i];
-                        }
-                        std::vector<unsigned char> sol_char = GetMinimalFromIndices(index_vector, DIGITBITS);
-
-                        if (validBlock(sol_char)) 
-                        {
-                            // If we find a POW solution, do not try other solutions
-                            // because they become invalid as we created a new block in blockchain.
-                            break;
-                        }
+                        break;
                     }
                 } 
-                else 
+                catch (EhSolverCancelledException&) 
                 {
-                    try 
-                    {
-                        // If we find a valid block, we rebuild
-                        bool found = EhOptimisedSolve(n, k, curr_state, validBlock, cancelled);
-                        //ehSolverRuns.increment();
-                        if (found) 
-                        {
-                            break;
-                        }
-                    } 
-                    catch (EhSolverCancelledException&) 
-                    {
-                        //LogPrint("pow", "Equihash solver cancelled\n");
-                        std::lock_guard<std::mutex> lock{m_cs};
-                        cancelSolver = false;
-                    }
+                    LogPrint(BCLog::POW, "Equihash solver cancelled\n");
                 }
 
                 // Check for stop or if block needs to be rebuilt
@@ -908,6 +981,13 @@ void GenerateGenesis(bool fGenerate, CWallet* pwallet, int nThreads)
     if (nThreads == 0 || !fGenerate)
         return;
 
+    static bool fWatchingTip = false;
+    if (!fWatchingTip)
+    {
+        RegisterValidationInterface(&minerTipWatcher);
+        fWatchingTip = true;
+    }
+
     minerThreads = new boost::thread_group();
     for (int i = 0; i < nThreads; i++)
     {
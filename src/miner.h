@@ -6,24 +6,36 @@
 #ifndef GENESIS_MINER_H
 #define GENESIS_MINER_H
 
+#include <crypto/equihash/equihash.h>
 #include <primitives/block.h>
 #include <txmempool.h>
 
 #include <stdint.h>
+#include <functional>
 #include <memory>
+#include <string>
+#include <vector>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
 #include <stdint.h>
+#include <sodium.h>
 
 class CBlockIndex;
 class CChainParams;
 class CScript;
 class CReserveKey;
 class CWallet;
+struct equibase;
 
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -equihashsolver */
+static const char* const DEFAULT_EQUIHASH_SOLVER = "tromp";
+/** Default for -equihashsolverthreads, threads cooperating on each tromp solver run */
+static const int DEFAULT_EQUIHASH_SOLVER_THREADS = 1;
+/** Default for -equihashhugepages, back the tromp solver's buckets with huge pages */
+static const bool DEFAULT_EQUIHASH_HUGE_PAGES = false;
 
 struct CBlockTemplate
 {
@@ -215,6 +227,68 @@ private:
     int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
 };
 
+/**
+ * An Equihash solver for one (n, k), kept across nonces so that any buffers
+ * it allocates are reused.
+ */
+class CEquihashSolver
+{
+public:
+    virtual ~CEquihashSolver() {}
+
+    /** Name of the backend, as given to -equihashsolver */
+    virtual std::string GetName() const = 0;
+
+    /**
+     * Pass the solutions for curr_state to validBlock, minimally encoded,
+     * until it returns true. Returns whether it did. Throws
+     * EhSolverCancelledException once cancelled returns true.
+     */
+    virtual bool Solve(const crypto_generichash_blake2b_state& curr_state,
+                       const std::function<bool(std::vector<unsigned char>)>& validBlock,
+                       const std::function<bool(EhSolverCancelCheck)>& cancelled) = 0;
+};
+
+/**
+ * Create the solver strName ("tromp", "radix" or "default") for n, k. The
+ * tromp solver is instantiated for the parameter sets of Equihash<N,K>; for
+ * any other it falls back to "radix". Throws std::runtime_error for an
+ * unknown name.
+ */
+std::unique_ptr<CEquihashSolver> MakeEquihashSolver(const std::string& strName, unsigned int n, unsigned int k, int nThreads, bool fHugePages);
+
+/**
+ * A tromp Equihash solver kept for the lifetime of a miner thread. Its bucket
+ * arena, several hundred megabytes for 192,7, is allocated once; each Solve
+ * only resets the bucket counters rather than allocating and zeroing it again.
+ * n, k must be a parameter set for which Supports returns true.
+ */
+class CTrompSolver : public CEquihashSolver
+{
+public:
+    CTrompSolver(unsigned int n, unsigned int k, int nThreads, bool fHugePages);
+    ~CTrompSolver();
+
+    /** Whether the tromp solver is instantiated for n, k */
+    static bool Supports(unsigned int n, unsigned int k);
+
+    std::string GetName() const override { return "tromp"; }
+    bool Solve(const crypto_generichash_blake2b_state& curr_state,
+               const std::function<bool(std::vector<unsigned char>)>& validBlock,
+               const std::function<bool(EhSolverCancelCheck)>& cancelled) override;
+
+    /**
+     * Run all rounds on curr_state and return the solutions found, minimally
+     * encoded. cancelled, if set, is polled between rounds; when it returns
+     * true the run is abandoned and EhSolverCancelledException is thrown.
+     */
+    std::vector<std::vector<unsigned char>> Solve(const crypto_generichash_blake2b_state& curr_state,
+                                                  const std::function<bool()>& cancelled = nullptr);
+
+private:
+    std::unique_ptr<equibase> eq;
+};
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
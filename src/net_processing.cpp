@@ -2095,7 +2095,10 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         LogPrint(BCLog::NET, "getheaders %d to %s from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.IsNull() ? "end" : hashStop.ToString(), pfrom->GetId());
         for (; pindex; pindex = chainActive.Next(pindex))
         {
-            vHeaders.push_back(pindex->GetBlockHeader());
+            CBlockHeader header;
+            if (!ReadBlockHeader(pindex, header))
+                return error("getheaders: failed to read the header of block %s", pindex->GetBlockHash().ToString());
+            vHeaders.push_back(header);
             if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
                 break;
         }
@@ -3329,16 +3332,25 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                         break;
                     }
                     pBestIndex = pindex;
+                    CBlockHeader header;
                     if (fFoundStartingHeader) {
                         // add this to the headers message
-                        vHeaders.push_back(pindex->GetBlockHeader());
+                        if (!ReadBlockHeader(pindex, header)) {
+                            fRevertToInv = true;
+                            break;
+                        }
+                        vHeaders.push_back(header);
                     } else if (PeerHasHeader(&state, pindex)) {
                         continue; // keep looking for the first new block
                     } else if (pindex->pprev == nullptr || PeerHasHeader(&state, pindex->pprev)) {
                         // Peer doesn't have this header but they do have the prior one.
                         // Start sending headers.
                         fFoundStartingHeader = true;
-                        vHeaders.push_back(pindex->GetBlockHeader());
+                        if (!ReadBlockHeader(pindex, header)) {
+                            fRevertToInv = true;
+                            break;
+                        }
+                        vHeaders.push_back(header);
                     } else {
                         // Peer doesn't have this header or the prior one -- nothing will
                         // connect, so bail out.
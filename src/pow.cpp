@@ -89,6 +89,39 @@ unsigned int LwmaCalculateNextWorkRequired(const CBlockIndex* pindexLast, const
     return next_target.GetCompact();
 }
 
+/**
+ * Copy the initialised Equihash state for (n, k, personalization) into state.
+ * Only a couple of combinations are ever used, so they are kept in a small
+ * fixed cache instead of being re-initialised for every header.
+ */
+static void GetEquihashBaseState(unsigned int n, unsigned int k, const std::string& personalizationString, crypto_generichash_blake2b_state& state)
+{
+    static const size_t EQUIHASH_STATE_CACHE_SIZE = 4;
+    static struct {
+        unsigned int n;
+        unsigned int k;
+        std::string personalization;
+        crypto_generichash_blake2b_state state;
+    } cache[EQUIHASH_STATE_CACHE_SIZE];
+    static size_t nCached = 0;
+    static CCriticalSection cs_cache;
+
+    LOCK(cs_cache);
+    for (size_t i = 0; i < nCached; i++) {
+        if (cache[i].n == n && cache[i].k == k && cache[i].personalization == personalizationString) {
+            state = cache[i].state;
+            return;
+        }
+    }
+
+    EhInitialiseState(n, k, state, personalizationString);
+    size_t slot = nCached < EQUIHASH_STATE_CACHE_SIZE ? nCached++ : 0;
+    cache[slot].n = n;
+    cache[slot].k = k;
+    cache[slot].personalization = personalizationString;
+    cache[slot].state = state;
+}
+
 bool CheckEquihashSolution(const CBlockHeader *pblock, const CChainParams& params, std::string personalizationString)
 {
     unsigned int n = params.EquihashN();
@@ -96,7 +129,7 @@ bool CheckEquihashSolution(const CBlockHeader *pblock, const CChainParams& param
 
     // Hash state
     crypto_generichash_blake2b_state state;
-    EhInitialiseState(n, k, state, personalizationString);
+    GetEquihashBaseState(n, k, personalizationString, state);
 
     // I = the block header minus nonce and solution.
     CEquihashInput I{*pblock};
@@ -18,11 +18,20 @@
 // the i*n 0s, each bucket having 4 * 2^RESTBITS slots,
 // twice the number of subtrees expected to land there.
 
+// N, K and RESTBITS are template arguments of equi; newequi picks the
+// instance for parameters known only at runtime.
+
 #include "pow/tromp/equi.h"
+#include "crypto/blake2b.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <assert.h>
+#include <functional>
+#include <type_traits>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
 
 typedef uint16_t u16;
 typedef uint64_t u64;
@@ -34,137 +43,176 @@ typedef std::atomic<u32> au32;
 typedef u32 au32;
 #endif
 
-#ifndef RESTBITS
-#define RESTBITS	4
-#endif
+union hashunit {
+  u32 word;
+  uchar bytes[sizeof(u32)];
+};
 
-// 2_log of number of buckets
-#define BUCKBITS (DIGITBITS-RESTBITS)
-
-#ifndef SAVEMEM
-#if RESTBITS == 4
-// can't save memory in such small buckets
-#define SAVEMEM 1
-#elif RESTBITS >= 8
-// take advantage of law of large numbers (sum of 2^8 random numbers)
-// this reduces (200,9) memory to under 144MB, with negligible discarding
-#define SAVEMEM 9/14
-#endif
-#endif
+#define WORDS(bits)	((bits + 31) / 32)
 
-// number of buckets
-static const u32 NBUCKETS = 1<<BUCKBITS;
-// 2_log of number of slots per bucket
-static const u32 SLOTBITS = RESTBITS+1+1;
-static const u32 SLOTRANGE = 1<<SLOTBITS;
-static const u32 SLOTMSB = 1<<(SLOTBITS-1);
-// number of slots per bucket
-static const u32 NSLOTS = SLOTRANGE * SAVEMEM;
-// number of per-xhash slots
-static const u32 XFULL = 16;
-// SLOTBITS mask
-static const u32 SLOTMASK = SLOTRANGE-1;
-// number of possible values of xhash (rest of n) bits
-static const u32 NRESTS = 1<<RESTBITS;
-// number of blocks of hashes extracted from single 512 bit blake2b output
-static const u32 NBLOCKS = (NHASHES+HASHESPERBLAKE-1)/HASHESPERBLAKE;
-// nothing larger found in 100000 runs
-static const u32 MAXSOLS = 8;
-
-// tree node identifying its children as two different slots in
-// a bucket on previous layer with the same rest bits (x-tra hash)
-struct tree {
-  u32 bid_s0_s1; // manual bitfields
-
-  tree(const u32 idx) {
-    bid_s0_s1 = idx;
-  }
-  tree(const u32 bid, const u32 s0, const u32 s1) {
-#ifdef SLOTDIFF
-    u32 ds10 = (s1 - s0) & SLOTMASK;
-    if (ds10 & SLOTMSB) {
-      bid_s0_s1 = (((bid << SLOTBITS) | s1) << (SLOTBITS-1)) | (SLOTMASK & ~ds10);
-    } else {
-      bid_s0_s1 = (((bid << SLOTBITS) | s0) << (SLOTBITS-1)) | (ds10 - 1);
+u32 hashwords(u32 bytes) {
+  return (bytes + 3) / 4;
+}
+
+u32 min(const u32 a, const u32 b) {
+  return a < b ? a : b;
+}
+
+// the n <= 25 bits at bit offset bit of big-endian bytes,
+// reading only the bytes that hold them
+inline u32 getbits(const uchar *bytes, const u32 bit, const u32 n) {
+  const uchar *p = bytes + bit/8;
+  const u32 shift = bit%8;
+  const u32 nbytes = (shift + n + 7) / 8;
+  u32 word = 0;
+  for (u32 i = 0; i < nbytes; i++)
+    word = word << 8 | p[i];
+  return (word >> (8*nbytes - shift - n)) & ((1U << n) - 1);
+}
+
+// The solver of one parameter set behind an interface, for callers
+// choosing N and K at runtime
+struct equibase {
+  virtual ~equibase() {}
+  virtual u32 digitbits() const = 0;
+  virtual u32 proofsize() const = 0;
+  // run all rounds on ctx using nthreads cooperating threads, polling
+  // cancelled between rounds; returns false if the run was abandoned
+  virtual bool run(const crypto_generichash_blake2b_state *ctx, const std::function<bool()> &cancelled) = 0;
+  virtual u32 nsolutions() const = 0;
+  virtual const u32 *solution(const u32 i) const = 0;
+};
+
+template <u32 WN, u32 WK, u32 RESTBITS>
+struct equi : public equibase {
+  static_assert(WK & 1, "the last round assumes WK odd");
+
+  static const u32 NDIGITS = WK+1;
+  static const u32 DIGITBITS = WN/NDIGITS;
+  static const u32 PROOFSIZE = 1<<WK;
+  static const u32 BASE = 1<<DIGITBITS;
+  static const u32 NHASHES = 2*BASE;
+  static const u32 HASHESPERBLAKE = 512/WN;
+  static const u32 HASHOUT = HASHESPERBLAKE*WN/8;
+
+  // 2_log of number of buckets
+  static const u32 BUCKBITS = DIGITBITS-RESTBITS;
+  // number of buckets
+  static const u32 NBUCKETS = 1<<BUCKBITS;
+  // 2_log of number of slots per bucket
+  static const u32 SLOTBITS = RESTBITS+1+1;
+  static const u32 SLOTRANGE = 1<<SLOTBITS;
+  static const u32 SLOTMSB = 1<<(SLOTBITS-1);
+  // number of slots per bucket; with RESTBITS >= 8, take advantage of law of
+  // large numbers (sum of 2^8 random numbers) to reduce (200,9) memory to
+  // under 144MB, with negligible discarding
+  static const u32 NSLOTS = RESTBITS >= 8 ? SLOTRANGE * 9/14 : SLOTRANGE;
+  // number of per-xhash slots
+  static const u32 XFULL = 16;
+  // SLOTBITS mask
+  static const u32 SLOTMASK = SLOTRANGE-1;
+  // number of possible values of xhash (rest of n) bits
+  static const u32 NRESTS = 1<<RESTBITS;
+  // number of blocks of hashes extracted from single 512 bit blake2b output
+  static const u32 NBLOCKS = (NHASHES+HASHESPERBLAKE-1)/HASHESPERBLAKE;
+  // nothing larger found in 100000 runs
+  static const u32 MAXSOLS = 8;
+
+  static const u32 HASHWORDS0 = WORDS(WN - DIGITBITS + RESTBITS);
+  static const u32 HASHWORDS1 = WORDS(WN - 2*DIGITBITS + RESTBITS);
+
+  static_assert(BUCKBITS + 2*SLOTBITS <= 32, "tree nodes must fit in 32 bits");
+  static_assert(BUCKBITS <= 25 && RESTBITS <= 25, "getbits reads at most 25 bits");
+  static_assert(DIGITBITS + RESTBITS <= 32, "the last round compares a single hash word");
+
+  typedef u32 proof[PROOFSIZE];
+
+  // tree node identifying its children as two different slots in
+  // a bucket on previous layer with the same rest bits (x-tra hash)
+  struct tree {
+    u32 bid_s0_s1; // manual bitfields
+
+    tree(const u32 idx) {
+      bid_s0_s1 = idx;
     }
+    tree(const u32 bid, const u32 s0, const u32 s1) {
+#ifdef SLOTDIFF
+      u32 ds10 = (s1 - s0) & SLOTMASK;
+      if (ds10 & SLOTMSB) {
+        bid_s0_s1 = (((bid << SLOTBITS) | s1) << (SLOTBITS-1)) | (SLOTMASK & ~ds10);
+      } else {
+        bid_s0_s1 = (((bid << SLOTBITS) | s0) << (SLOTBITS-1)) | (ds10 - 1);
+      }
 #else
-    bid_s0_s1 = (((bid << SLOTBITS) | s0) << SLOTBITS) | s1;
+      bid_s0_s1 = (((bid << SLOTBITS) | s0) << SLOTBITS) | s1;
 #endif
-  }
-  u32 getindex() const {
-    return bid_s0_s1;
-  }
-  u32 bucketid() const {
+    }
+    u32 getindex() const {
+      return bid_s0_s1;
+    }
+    u32 bucketid() const {
 #ifdef SLOTDIFF
-    return bid_s0_s1 >> (2 * SLOTBITS - 1);
+      return bid_s0_s1 >> (2 * SLOTBITS - 1);
 #else
-    return bid_s0_s1 >> (2 * SLOTBITS);
+      return bid_s0_s1 >> (2 * SLOTBITS);
 #endif
-  }
-  u32 slotid0() const {
+    }
+    u32 slotid0() const {
 #ifdef SLOTDIFF
-    return (bid_s0_s1 >> (SLOTBITS-1)) & SLOTMASK;
+      return (bid_s0_s1 >> (SLOTBITS-1)) & SLOTMASK;
 #else
-    return (bid_s0_s1 >> SLOTBITS) & SLOTMASK;
+      return (bid_s0_s1 >> SLOTBITS) & SLOTMASK;
 #endif
-  }
-  u32 slotid1() const {
+    }
+    u32 slotid1() const {
 #ifdef SLOTDIFF
-    return (slotid0() + 1 + (bid_s0_s1 & (SLOTMASK>>1))) & SLOTMASK;
+      return (slotid0() + 1 + (bid_s0_s1 & (SLOTMASK>>1))) & SLOTMASK;
 #else
-    return bid_s0_s1 & SLOTMASK;
+      return bid_s0_s1 & SLOTMASK;
 #endif
-  }
-};
-
-union hashunit {
-  u32 word;
-  uchar bytes[sizeof(u32)];
-};
-
-#define WORDS(bits)	((bits + 31) / 32)
-#define HASHWORDS0 WORDS(WN - DIGITBITS + RESTBITS)
-#define HASHWORDS1 WORDS(WN - 2*DIGITBITS + RESTBITS)
-
-struct slot0 {
-  tree attr;
-  hashunit hash[HASHWORDS0];
-};
+    }
+  };
 
-struct slot1 {
-  tree attr;
-  hashunit hash[HASHWORDS1];
-};
+  struct slot0 {
+    tree attr;
+    hashunit hash[HASHWORDS0];
+  };
 
-// a bucket is NSLOTS treenodes
-typedef slot0 bucket0[NSLOTS];
-typedef slot1 bucket1[NSLOTS];
-// the N-bit hash consists of K+1 n-bit "digits"
-// each of which corresponds to a layer of NBUCKETS buckets
-typedef bucket0 digit0[NBUCKETS];
-typedef bucket1 digit1[NBUCKETS];
-
-// size (in bytes) of hash in round 0 <= r < WK
-u32 hashsize(const u32 r) {
-  const u32 hashbits = WN - (r+1) * DIGITBITS + RESTBITS;
-  return (hashbits + 7) / 8;
-}
+  struct slot1 {
+    tree attr;
+    hashunit hash[HASHWORDS1];
+  };
 
-u32 hashwords(u32 bytes) {
-  return (bytes + 3) / 4;
-}
+  // a bucket is NSLOTS treenodes
+  typedef slot0 bucket0[NSLOTS];
+  typedef slot1 bucket1[NSLOTS];
+  // the N-bit hash consists of K+1 n-bit "digits"
+  // each of which corresponds to a layer of NBUCKETS buckets
+  typedef bucket0 layer0[NBUCKETS];
+  typedef bucket1 layer1[NBUCKETS];
 
-// manages hash and tree data
-struct htalloc {
-  u32 *heap0;
-  u32 *heap1;
-  bucket0 *trees0[(WK+1)/2];
-  bucket1 *trees1[WK/2];
-  u32 alloced;
-  htalloc() {
-    alloced = 0;
+  // size (in bytes) of hash in round 0 <= r < WK
+  static u32 hashsize(const u32 r) {
+    const u32 hashbits = WN - (r+1) * DIGITBITS + RESTBITS;
+    return (hashbits + 7) / 8;
   }
-  void alloctrees() {
+
+  // manages hash and tree data
+  struct htalloc {
+    void *heaps[WK];
+    size_t heapsizes[WK];
+    bool heapsmapped[WK];
+    u32 nheaps;
+    bucket0 *trees0[(WK+1)/2];
+    bucket1 *trees1[WK/2];
+    u32 alloced;
+    bool hugepages;
+    htalloc(const bool huge_pages = false) {
+      nheaps = 0;
+      alloced = 0;
+      hugepages = huge_pages;
+    }
+    void alloctrees() {
 // optimize xenoncat's fixed memory layout, avoiding any waste
 // digit  trees  hashes  trees hashes
 // 0      0 A A A A A A   . . . . . .
@@ -176,34 +224,79 @@ struct htalloc {
 // 6      0 2 4 6 . G G   1 3 5 F F F
 // 7      0 2 4 6 . G G   1 3 5 7 H H
 // 8      0 2 4 6 8 . I   1 3 5 7 H H
-    assert(DIGITBITS >= 16); // ensures hashes shorten by 1 unit every 2 digits
-    heap0 = (u32 *)alloc(1, sizeof(digit0));
-    heap1 = (u32 *)alloc(1, sizeof(digit1));
-    for (int r=0; r<WK; r++)
-      if ((r&1) == 0)
-        trees0[r/2]  = (bucket0 *)(heap0 + r/2);
-      else
-        trees1[r/2]  = (bucket1 *)(heap1 + r/2);
-  }
-  void dealloctrees() {
-    free(heap0);
-    free(heap1);
-  }
-  void *alloc(const u32 n, const u32 sz) {
-    void *mem  = calloc(n, sz);
-    assert(mem);
-    alloced += n * sz;
-    return mem;
-  }
-};
-
-typedef au32 bsizes[NBUCKETS];
+      // This needs hashes to shorten by 1 unit every 2 digits. Smaller
+      // digits, as in the tiny test parameter sets, get a heap per layer.
+      const bool overlay = DIGITBITS >= 16;
+      nheaps = overlay ? 2 : WK;
+      for (u32 h = 0; h < nheaps; h++) {
+        heapsizes[h] = (h&1) == 0 ? sizeof(layer0) : sizeof(layer1);
+        heaps[h] = allocheap(heapsizes[h], heapsmapped[h]);
+      }
+      for (u32 r=0; r<WK; r++) {
+        u32 *heap = (u32 *)heaps[overlay ? (r&1) : r];
+        if ((r&1) == 0)
+          trees0[r/2]  = (bucket0 *)(overlay ? heap + r/2 : heap);
+        else
+          trees1[r/2]  = (bucket1 *)(overlay ? heap + r/2 : heap);
+      }
+    }
+    void dealloctrees() {
+      for (u32 h = 0; h < nheaps; h++)
+        freeheap(heaps[h], heapsizes[h], heapsmapped[h]);
+      nheaps = 0;
+    }
+    void *alloc(const u32 n, const u32 sz) {
+      void *mem  = calloc(n, sz);
+      assert(mem);
+      alloced += n * sz;
+      return mem;
+    }
+    // The tree heaps are written before they are read, so unlike alloc they
+    // need not be zeroed. With hugepages, prefer explicitly reserved huge pages
+    // and fall back to asking for transparent ones, which cuts the TLB misses
+    // of the random bucket accesses in every round.
+    void *allocheap(size_t &sz, bool &mapped) {
+      mapped = false;
+#if defined(__linux__)
+      if (hugepages) {
+        const size_t HUGEPAGESIZE = 2 << 20;
+        sz = (sz + HUGEPAGESIZE - 1) & ~(HUGEPAGESIZE - 1);
+        void *mem = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        mem = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+        if (mem == MAP_FAILED) {
+          mem = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+          if (mem != MAP_FAILED)
+            madvise(mem, sz, MADV_HUGEPAGE);
+#endif
+        }
+        if (mem != MAP_FAILED) {
+          mapped = true;
+          alloced += sz;
+          return mem;
+        }
+      }
+#endif
+      void *mem = malloc(sz);
+      assert(mem);
+      alloced += sz;
+      return mem;
+    }
+    void freeheap(void *mem, const size_t sz, const bool mapped) {
+#if defined(__linux__)
+      if (mapped) {
+        munmap(mem, sz);
+        return;
+      }
+#endif
+      free(mem);
+    }
+  };
 
-u32 min(const u32 a, const u32 b) {
-  return a < b ? a : b;
-}
+  typedef au32 bsizes[NBUCKETS];
 
-struct equi {
   crypto_generichash_blake2b_state blake_ctx;
   htalloc hta;
   bsizes *nslots; // PUT IN BUCKET STRUCT
@@ -213,10 +306,15 @@ struct equi {
   u32 xfull;
   u32 hfull;
   u32 bfull;
+  // polled by thread 0 between rounds; once it returns true all threads
+  // abandon the run at the next barrier and leave aborted set
+  std::function<bool()> cancelled;
+  bool aborted;
   pthread_barrier_t barry;
-  equi(const u32 n_threads) {
+  equi(const u32 n_threads, const bool huge_pages = false) : hta(huge_pages) {
     assert(sizeof(hashunit) == 4);
     nthreads = n_threads;
+    aborted = false;
     const int err = pthread_barrier_init(&barry, NULL, nthreads);
     assert(!err);
     hta.alloctrees();
@@ -230,11 +328,33 @@ struct equi {
   }
   void setstate(const crypto_generichash_blake2b_state *ctx) {
     blake_ctx = *ctx;
-    memset(nslots, 0, NBUCKETS * sizeof(au32)); // only nslots[0] needs zeroing
+    // A completed run leaves every counter zero, but one abandoned between
+    // rounds does not, so clear both halves to make the arena reusable.
+    memset(nslots, 0, 2 * NBUCKETS * sizeof(au32));
     nsols = 0;
+    aborted = false;
+  }
+  u32 digitbits() const override {
+    return DIGITBITS;
+  }
+  u32 proofsize() const override {
+    return PROOFSIZE;
+  }
+  bool run(const crypto_generichash_blake2b_state *ctx, const std::function<bool()> &cancel) override;
+  u32 nsolutions() const override {
+    return min(nsols, MAXSOLS);
+  }
+  const u32 *solution(const u32 i) const override {
+    return sols[i];
   }
   u32 getslot(const u32 r, const u32 bucketi) {
 #ifdef EQUIHASH_TROMP_ATOMIC
+    if (nthreads == 1) {
+      // no contention, so avoid the cost of a locked increment
+      const u32 n = nslots[r&1][bucketi].load(std::memory_order_relaxed);
+      nslots[r&1][bucketi].store(n + 1, std::memory_order_relaxed);
+      return n;
+    }
     return std::atomic_fetch_add_explicit(&nslots[r&1][bucketi], 1U, std::memory_order_relaxed);
 #else
     return nslots[r&1][bucketi]++;
@@ -242,8 +362,14 @@ struct equi {
   }
   u32 getnslots(const u32 r, const u32 bid) { // SHOULD BE METHOD IN BUCKET STRUCT
     au32 &nslot = nslots[r&1][bid];
+#ifdef EQUIHASH_TROMP_ATOMIC
+    // rounds are separated by barriers, so relaxed accesses suffice
+    const u32 n = min(nslot.load(std::memory_order_relaxed), NSLOTS);
+    nslot.store(0, std::memory_order_relaxed);
+#else
     const u32 n = min(nslot, NSLOTS);
     nslot = 0;
+#endif
     return n;
   }
   void orderindices(u32 *indices, u32 size) {
@@ -323,8 +449,12 @@ struct equi {
     u32 dunits;
     u32 prevbo;
     u32 nextbo;
-  
-    htlayout(equi *eq, u32 r): hta(eq->hta), prevhashunits(0), dunits(0) {
+    // bit offsets, from prevbo, of the rest bits of the previous digit
+    // and of the bucket bits of this one
+    u32 xhashbit;
+    u32 bucketbit;
+
+    htlayout(equi *eq, u32 r): hta(eq->hta), prevhashunits(0), dunits(0), xhashbit(0), bucketbit(0) {
       u32 nexthashbytes = hashsize(r);
       nexthashunits = hashwords(nexthashbytes);
       prevbo = 0;
@@ -334,37 +464,19 @@ struct equi {
         prevhashunits = hashwords(prevhashbytes);
         prevbo = prevhashunits * sizeof(hashunit) - prevhashbytes; // 0-3
         dunits = prevhashunits - nexthashunits;
+        // the previous hash holds the last prevhashbytes bytes of the N bits
+        xhashbit = r * DIGITBITS - RESTBITS - (WN - 8 * prevhashbytes);
+        bucketbit = xhashbit + RESTBITS;
       }
     }
     u32 getxhash0(const slot0* pslot) const {
-#if WN == 200 && RESTBITS == 4
-      return pslot->hash->bytes[prevbo] >> 4;
-#elif WN == 200 && RESTBITS == 8
-      return (pslot->hash->bytes[prevbo] & 0xf) << 4 | pslot->hash->bytes[prevbo+1] >> 4;
-#elif WN == 200 && RESTBITS == 9
-      return (pslot->hash->bytes[prevbo] & 0x1f) << 4 | pslot->hash->bytes[prevbo+1] >> 4;
-#elif WN == 144 && RESTBITS == 4
-      return pslot->hash->bytes[prevbo] & 0xf;
-#elif WN == 192 && RESTBITS == 4
-      return pslot->hash->bytes[prevbo] & 0xf;
-#else
-#error non implemented
-#endif
+      return getbits(pslot->hash->bytes + prevbo, xhashbit, RESTBITS);
     }
     u32 getxhash1(const slot1* pslot) const {
-#if WN == 200 && RESTBITS == 4
-      return pslot->hash->bytes[prevbo] & 0xf;
-#elif WN == 200 && RESTBITS == 8
-      return pslot->hash->bytes[prevbo];
-#elif WN == 200 && RESTBITS == 9
-      return (pslot->hash->bytes[prevbo]&1) << 8 | pslot->hash->bytes[prevbo+1];
-#elif WN == 144 && RESTBITS == 4
-      return pslot->hash->bytes[prevbo] & 0xf;
-#elif WN == 192 && RESTBITS == 4
-      return pslot->hash->bytes[prevbo] & 0xf;
-#else
-#error non implemented
-#endif
+      return getbits(pslot->hash->bytes + prevbo, xhashbit, RESTBITS);
+    }
+    u32 getxorbucketid(const uchar *bytes0, const uchar *bytes1) const {
+      return getbits(bytes0 + prevbo, bucketbit, BUCKBITS) ^ getbits(bytes1 + prevbo, bucketbit, BUCKBITS);
     }
     bool equal(const hashunit *hash0, const hashunit *hash1) const {
       return hash0[prevhashunits-1].word == hash1[prevhashunits-1].word;
@@ -373,17 +485,11 @@ struct equi {
 
   struct collisiondata {
 #ifdef XBITMAP
-#if NSLOTS > 64
-#error cant use XBITMAP with more than 64 slots
-#endif
+    static_assert(NSLOTS <= 64, "cant use XBITMAP with more than 64 slots");
     u64 xhashmap[NRESTS];
     u64 xmap;
 #else
-#if RESTBITS <= 6
-    typedef uchar xslot;
-#else
-    typedef u16 xslot;
-#endif
+    typedef typename std::conditional<RESTBITS <= 6, uchar, u16>::type xslot;
     xslot nxhashslots[NRESTS];
     xslot xhashslots[NRESTS][XFULL];
     xslot *xx;
@@ -434,45 +540,50 @@ struct equi {
   };
 
   void digit0(const u32 id) {
-    uchar hash[HASHOUT];
+    uchar hashes[BLAKE2B_LANES][HASHOUT];
+    u32 blocks[BLAKE2B_LANES];
     crypto_generichash_blake2b_state state;
+    CBlake2bLanes lanes;
+    const bool uselanes = Blake2bPrepareLanes(blake_ctx, lanes);
     htlayout htl(this, 0);
     const u32 hashbytes = hashsize(0);
-    for (u32 block = id; block < NBLOCKS; block += nthreads) {
-      state = blake_ctx;
-      u32 leb = htole32(block);
-      crypto_generichash_blake2b_update(&state, (uchar *)&leb, sizeof(u32));
-      crypto_generichash_blake2b_final(&state, hash, HASHOUT);
-      for (u32 i = 0; i<HASHESPERBLAKE; i++) {
-        const uchar *ph = hash + i * WN/8;
-#if BUCKBITS == 16 && RESTBITS == 4
-        const u32 bucketid = ((u32)ph[0] << 8) | ph[1];
-#elif BUCKBITS == 12 && RESTBITS == 8
-        const u32 bucketid = ((u32)ph[0] << 4) | ph[1] >> 4;
-#elif BUCKBITS == 11 && RESTBITS == 9
-        const u32 bucketid = ((u32)ph[0] << 3) | ph[1] >> 5;
-#elif BUCKBITS == 20 && RESTBITS == 4
-        const u32 bucketid = ((((u32)ph[0] << 8) | ph[1]) << 4) | ph[2] >> 4;
-#elif BUCKBITS == 12 && RESTBITS == 4
-        const u32 bucketid = ((u32)ph[0] << 4) | ph[1] >> 4;
-        const u32 xhash = ph[1] & 0xf;
-#elif BUCKBITS == 20 && RESTBITS == 4
-        const u32 bucketid = ((((u32)ph[0] << 8) | ph[1]) << 4) | ph[2] >> 4;
-#else
-#error not implemented
-#endif
-        const u32 slot = getslot(0, bucketid);
-        if (slot >= NSLOTS) {
-          bfull++;
-          continue;
+    for (u32 first = id; first < NBLOCKS; first += BLAKE2B_LANES * nthreads) {
+      // hash this thread's next BLAKE2B_LANES blocks together
+      u32 nblocks = 0;
+      for (u32 block = first; nblocks < BLAKE2B_LANES && block < NBLOCKS; block += nthreads)
+        blocks[nblocks++] = block;
+      if (uselanes && nblocks == BLAKE2B_LANES) {
+        Blake2bFinalizeLanes(lanes, blocks, hashes[0], HASHOUT);
+      } else {
+        for (u32 j = 0; j < nblocks; j++) {
+          state = blake_ctx;
+          u32 leb = htole32(blocks[j]);
+          crypto_generichash_blake2b_update(&state, (uchar *)&leb, sizeof(u32));
+          crypto_generichash_blake2b_final(&state, hashes[j], HASHOUT);
+        }
+      }
+      for (u32 j = 0; j < nblocks; j++) {
+        const u32 block = blocks[j];
+        const uchar *hash = hashes[j];
+        // the last block can hold more hashes than there are indices
+        for (u32 i = 0; i<HASHESPERBLAKE && block * HASHESPERBLAKE + i < NHASHES; i++) {
+          const uchar *ph = hash + i * WN/8;
+          const u32 bucketid = getbits(ph, 0, BUCKBITS);
+          const u32 slot = getslot(0, bucketid);
+          if (slot >= NSLOTS) {
+            bfull++;
+            continue;
+          }
+          slot0 &s = hta.trees0[0][bucketid][slot];
+          s.attr = tree(block * HASHESPERBLAKE + i);
+          // zero the padding, which later rounds xor along with the hash
+          memset(s.hash->bytes, 0, htl.nextbo);
+          memcpy(s.hash->bytes+htl.nextbo, ph+WN/8-hashbytes, hashbytes);
         }
-        slot0 &s = hta.trees0[0][bucketid][slot];
-        s.attr = tree(block * HASHESPERBLAKE + i);
-        memcpy(s.hash->bytes+htl.nextbo, ph+WN/8-hashbytes, hashbytes);
       }
     }
   }
-  
+
   void digitodd(const u32 r, const u32 id) {
     htlayout htl(this, r);
     collisiondata cd;
@@ -493,28 +604,7 @@ struct equi {
             hfull++;
             continue;
           }
-          u32 xorbucketid;
-          const uchar *bytes0 = pslot0->hash->bytes, *bytes1 = pslot1->hash->bytes;
-#if WN == 200 && BUCKBITS == 12 && RESTBITS == 8
-          xorbucketid = (((u32)(bytes0[htl.prevbo+1] ^ bytes1[htl.prevbo+1]) & 0xf) << 8)
-                             | (bytes0[htl.prevbo+2] ^ bytes1[htl.prevbo+2]);
-#elif WN == 200 && BUCKBITS == 11 && RESTBITS == 9
-          xorbucketid = (((u32)(bytes0[htl.prevbo+1] ^ bytes1[htl.prevbo+1]) & 0xf) << 7)
-                             | (bytes0[htl.prevbo+2] ^ bytes1[htl.prevbo+2]) >> 1;
-#elif WN == 144 && BUCKBITS == 20 && RESTBITS == 4
-          xorbucketid = ((((u32)(bytes0[htl.prevbo+1] ^ bytes1[htl.prevbo+1]) << 8)
-                              | (bytes0[htl.prevbo+2] ^ bytes1[htl.prevbo+2])) << 4)
-                              | (bytes0[htl.prevbo+3] ^ bytes1[htl.prevbo+3]) >> 4;
-#elif WN == 96 && BUCKBITS == 12 && RESTBITS == 4
-          xorbucketid = ((u32)(bytes0[htl.prevbo+1] ^ bytes1[htl.prevbo+1]) << 4)
-                            | (bytes0[htl.prevbo+2] ^ bytes1[htl.prevbo+2]) >> 4;
-#elif WN == 192 && BUCKBITS == 20 && RESTBITS == 4
-          xorbucketid = ((((u32)(bytes0[htl.prevbo+1] ^ bytes1[htl.prevbo+1]) << 8)
-                              | (bytes0[htl.prevbo+2] ^ bytes1[htl.prevbo+2])) << 4)
-                              | (bytes0[htl.prevbo+3] ^ bytes1[htl.prevbo+3]) >> 4;
-#else
-#error not implemented
-#endif
+          const u32 xorbucketid = htl.getxorbucketid(pslot0->hash->bytes, pslot1->hash->bytes);
           const u32 xorslot = getslot(r, xorbucketid);
           if (xorslot >= NSLOTS) {
             bfull++;
@@ -528,7 +618,7 @@ struct equi {
       }
     }
   }
-  
+
   void digiteven(const u32 r, const u32 id) {
     htlayout htl(this, r);
     collisiondata cd;
@@ -549,28 +639,7 @@ struct equi {
             hfull++;
             continue;
           }
-          u32 xorbucketid;
-          const uchar *bytes0 = pslot0->hash->bytes, *bytes1 = pslot1->hash->bytes;
-#if WN == 200 && BUCKBITS == 12 && RESTBITS == 8
-          xorbucketid = ((u32)(bytes0[htl.prevbo+1] ^ bytes1[htl.prevbo+1]) << 4)
-                            | (bytes0[htl.prevbo+2] ^ bytes1[htl.prevbo+2]) >> 4;
-#elif WN == 200 && BUCKBITS == 11 && RESTBITS == 9
-          xorbucketid = ((u32)(bytes0[htl.prevbo+2] ^ bytes1[htl.prevbo+2]) << 3)
-                            | (bytes0[htl.prevbo+3] ^ bytes1[htl.prevbo+3]) >> 5;
-#elif WN == 144 && BUCKBITS == 20 && RESTBITS == 4
-          xorbucketid = ((((u32)(bytes0[htl.prevbo+1] ^ bytes1[htl.prevbo+1]) << 8)
-                              | (bytes0[htl.prevbo+2] ^ bytes1[htl.prevbo+2])) << 4)
-                              | (bytes0[htl.prevbo+3] ^ bytes1[htl.prevbo+3]) >> 4;
-#elif WN == 96 && BUCKBITS == 12 && RESTBITS == 4
-          xorbucketid = ((u32)(bytes0[htl.prevbo+1] ^ bytes1[htl.prevbo+1]) << 4)
-                            | (bytes0[htl.prevbo+2] ^ bytes1[htl.prevbo+2]) >> 4;
-#elif WN == 192 && BUCKBITS == 20 && RESTBITS == 4
-          xorbucketid = ((((u32)(bytes0[htl.prevbo+1] ^ bytes1[htl.prevbo+1]) << 8)
-                              | (bytes0[htl.prevbo+2] ^ bytes1[htl.prevbo+2])) << 4)
-                              | (bytes0[htl.prevbo+3] ^ bytes1[htl.prevbo+3]) >> 4;
-#else
-#error not implemented
-#endif
+          const u32 xorbucketid = htl.getxorbucketid(pslot0->hash->bytes, pslot1->hash->bytes);
           const u32 xorslot = getslot(r, xorbucketid);
           if (xorslot >= NSLOTS) {
             bfull++;
@@ -584,7 +653,7 @@ struct equi {
       }
     }
   }
-  
+
   void digitK(const u32 id) {
     collisiondata cd;
     htlayout htl(this, WK);
@@ -608,12 +677,6 @@ nc++,       candidate(tree(bucketid, s0, s1));
   }
 };
 
-typedef struct {
-  u32 id;
-  pthread_t thread;
-  equi *eq;
-} thread_ctx;
-
 void barrier(pthread_barrier_t *barry) {
   const int rc = pthread_barrier_wait(barry);
   if (rc != 0 && rc != PTHREAD_BARRIER_SERIAL_THREAD) {
@@ -622,37 +685,99 @@ void barrier(pthread_barrier_t *barry) {
   }
 }
 
-void *worker(void *vp) {
-  thread_ctx *tp = (thread_ctx *)vp;
-  equi *eq = tp->eq;
+template <typename EQUI>
+struct thread_ctx {
+  u32 id;
+  pthread_t thread;
+  EQUI *eq;
+};
 
-  if (tp->id == 0)
-//    printf("Digit 0\n");
+// run all rounds as thread id of eq, in lockstep with the other eq->nthreads-1 threads
+template <typename EQUI>
+void solvethread(EQUI *eq, const u32 id) {
+//  if (id == 0) printf("Digit 0\n");
   barrier(&eq->barry);
-  eq->digit0(tp->id);
+  eq->digit0(id);
   barrier(&eq->barry);
-  if (tp->id == 0) {
+  if (id == 0) {
     eq->xfull = eq->bfull = eq->hfull = 0;
     eq->showbsizes(0);
+    eq->aborted = eq->cancelled && eq->cancelled();
   }
   barrier(&eq->barry);
-  for (u32 r = 1; r < WK; r++) {
-    if (tp->id == 0)
-//      printf("Digit %d", r);
+  if (eq->aborted)
+    return;
+  for (u32 r = 1; r < EQUI::NDIGITS - 1; r++) {
+//    if (id == 0) printf("Digit %d", r);
     barrier(&eq->barry);
-    r&1 ? eq->digitodd(r, tp->id) : eq->digiteven(r, tp->id);
+    r&1 ? eq->digitodd(r, id) : eq->digiteven(r, id);
     barrier(&eq->barry);
-    if (tp->id == 0) {
+    if (id == 0) {
 //      printf(" x%d b%d h%d\n", eq->xfull, eq->bfull, eq->hfull);
       eq->xfull = eq->bfull = eq->hfull = 0;
       eq->showbsizes(r);
+      eq->aborted = eq->cancelled && eq->cancelled();
     }
     barrier(&eq->barry);
+    if (eq->aborted)
+      return;
   }
-  if (tp->id == 0)
-//    printf("Digit %d\n", WK);
-  eq->digitK(tp->id);
+//  if (id == 0) printf("Digit %d\n", WK);
+  eq->digitK(id);
   barrier(&eq->barry);
+}
+
+template <typename EQUI>
+void *worker(void *vp) {
+  thread_ctx<EQUI> *tp = (thread_ctx<EQUI> *)vp;
+  solvethread(tp->eq, tp->id);
   pthread_exit(NULL);
   return 0;
 }
+
+// solve the state set with setstate using eq->nthreads cooperating threads,
+// the calling thread acting as thread 0; solutions are left in eq->sols
+template <typename EQUI>
+void solve(EQUI *eq) {
+  if (eq->nthreads == 1) {
+    solvethread(eq, 0);
+    return;
+  }
+  thread_ctx<EQUI> *threads = (thread_ctx<EQUI> *)calloc(eq->nthreads, sizeof(thread_ctx<EQUI>));
+  assert(threads);
+  for (u32 t = 1; t < eq->nthreads; t++) {
+    threads[t].id = t;
+    threads[t].eq = eq;
+    const int err = pthread_create(&threads[t].thread, NULL, worker<EQUI>, (void *)&threads[t]);
+    assert(!err);
+  }
+  solvethread(eq, 0);
+  for (u32 t = 1; t < eq->nthreads; t++)
+    pthread_join(threads[t].thread, NULL);
+  free(threads);
+}
+
+template <u32 WN, u32 WK, u32 RESTBITS>
+bool equi<WN, WK, RESTBITS>::run(const crypto_generichash_blake2b_state *ctx, const std::function<bool()> &cancel) {
+  setstate(ctx);
+  cancelled = cancel;
+  solve(this);
+  cancelled = nullptr;
+  return !aborted;
+}
+
+// the solver for the Equihash parameters n, k, or NULL if there is none;
+// these are the parameter sets of Equihash<N,K> in crypto/equihash
+equibase *newequi(const u32 n, const u32 k, const u32 n_threads, const bool huge_pages = false) {
+  if (n == 192 && k == 7)
+    return new equi<192, 7, 4>(n_threads, huge_pages);
+  if (n == 200 && k == 9)
+    return new equi<200, 9, 8>(n_threads, huge_pages);
+  if (n == 96 && k == 5)
+    return new equi<96, 5, 4>(n_threads, huge_pages);
+  if (n == 96 && k == 3)
+    return new equi<96, 3, 4>(n_threads, huge_pages);
+  if (n == 48 && k == 5)
+    return new equi<48, 5, 4>(n_threads, huge_pages);
+  return NULL;
+}
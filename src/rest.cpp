@@ -145,6 +145,7 @@ static bool rest_headers(HTTPRequest* req,
 
     std::vector<const CBlockIndex *> headers;
     headers.reserve(count);
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
     {
         LOCK(cs_main);
         BlockMap::const_iterator it = mapBlockIndex.find(hash);
@@ -155,11 +156,14 @@ static bool rest_headers(HTTPRequest* req,
                 break;
             pindex = chainActive.Next(pindex);
         }
-    }
 
-    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
-    for (const CBlockIndex *pindex : headers) {
-        ssHeader << pindex->GetBlockHeader();
+        // The in-memory solution may be trimmed by a flush, so read it under cs_main
+        for (const CBlockIndex *pindexHeader : headers) {
+            CBlockHeader header;
+            if (!ReadBlockHeader(pindexHeader, header))
+                return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, pindexHeader->GetBlockHash().GetHex() + " header not readable");
+            ssHeader << header;
+        }
     }
 
     switch (rf) {
@@ -498,12 +502,14 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
         if (fCheckMemPool)
             view.SetBackend(viewMempool); // switch cache backend to db+mempool in case user likes to query mempool
 
+        std::vector<Coin> coins;
+        std::vector<bool> found;
+        view.GetCoins(vOutPoints, coins, found);
         for (size_t i = 0; i < vOutPoints.size(); i++) {
             bool hit = false;
-            Coin coin;
-            if (view.GetCoin(vOutPoints[i], coin) && !mempool.isSpent(vOutPoints[i])) {
+            if (found[i] && !mempool.isSpent(vOutPoints[i])) {
                 hit = true;
-                outs.emplace_back(std::move(coin));
+                outs.emplace_back(std::move(coins[i]));
             }
 
             hits.push_back(hit);
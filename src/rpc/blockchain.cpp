@@ -12,6 +12,7 @@
 #include <checkpoints.h>
 #include <coins.h>
 #include <consensus/validation.h>
+#include <indexbuilder.h>
 #include <validation.h>
 #include <core_io.h>
 #include <policy/feerate.h>
@@ -115,7 +116,10 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     result.push_back(Pair("mediantime", (int64_t)blockindex->GetMedianTimePast()));
     result.push_back(Pair("nonceUint32", (uint64_t)((uint32_t)blockindex->nNonce.GetUint64(0))));
     result.push_back(Pair("nonce", blockindex->nNonce.GetHex()));
-    result.push_back(Pair("solution", HexStr(blockindex->nSolution)));
+    std::vector<unsigned char> solution;
+    if (!ReadBlockSolution(blockindex, solution))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Can't read block solution from the block index database");
+    result.push_back(Pair("solution", HexStr(solution)));
     result.push_back(Pair("bits", strprintf("%08x", blockindex->nBits)));
     result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
     result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
@@ -145,6 +149,18 @@ UniValue blockToDeltasJSON(const CBlock& block, const CBlockIndex* blockindex)
     result.push_back(Pair("height", blockindex->nHeight));
     result.push_back(Pair("version", block.nVersion));
     result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
+     // Spent info of every input in the block, read in one batch
+    std::vector<CSpentIndexKey> spentKeys;
+    for (const CTransactionRef& ptx : block.vtx) {
+        if (ptx->IsCoinBase())
+            continue;
+        for (const CTxIn& txin : ptx->vin)
+            spentKeys.push_back(CSpentIndexKey(txin.prevout.hash, txin.prevout.n));
+    }
+    std::vector<CSpentIndexValue> spentInfos;
+    std::vector<bool> spentFound;
+    GetSpentIndexes(spentKeys, spentInfos, spentFound);
+    size_t nSpent = 0;
      UniValue deltas(UniValue::VARR);
      for (unsigned int i = 0; i < block.vtx.size(); i++) {
         const CTransaction &tx = *(block.vtx[i]);
@@ -154,12 +170,11 @@ UniValue blockToDeltasJSON(const CBlock& block, const CBlockIndex* blockindex)
         entry.push_back(Pair("index", (int)i));
          UniValue inputs(UniValue::VARR);
          if (!tx.IsCoinBase()) {
-             for (size_t j = 0; j < tx.vin.size(); j++) {
-                const CTxIn input = tx.vin[j];
+             for (size_t j = 0; j < tx.vin.size(); j++, nSpent++) {
+                const CTxIn& input = tx.vin[j];
                  UniValue delta(UniValue::VOBJ);
-                 CSpentIndexValue spentInfo;
-                CSpentIndexKey spentKey(input.prevout.hash, input.prevout.n);
-                 if (GetSpentIndex(spentKey, spentInfo)) {
+                 const CSpentIndexValue& spentInfo = spentInfos[nSpent];
+                 if (spentFound[nSpent]) {
                     if (spentInfo.addressType == 1) {
                         delta.push_back(Pair("address", CGenesisAddress(CKeyID(spentInfo.addressHash)).ToString()));
                     } else if (spentInfo.addressType == 2)  {
@@ -758,7 +773,7 @@ UniValue getblockdeltas(const JSONRPCRequest& request)
             "2. low          (numeric, required) The older block timestamp\n"
             "3. options      (string, required) A json object\n"
             "    {\n"
-            "      \"noOrphans\":true   (boolean) will only include blocks on the main chain\n"
+            "      \"noOrphans\":true   (boolean) will only include blocks on the main chain; does not need -timestampindex\n"
             "      \"logicalTimes\":true   (boolean) will include logical timestamps with hashes\n"
             "    }\n"
             "\nResult:\n"
@@ -791,8 +806,6 @@ UniValue getblockdeltas(const JSONRPCRequest& request)
         }
     }
      std::vector<std::pair<uint256, unsigned int> > blockHashes;
-     if (fActiveOnly)
-        LOCK(cs_main);
      if (!GetTimestampIndex(high, low, fActiveOnly, blockHashes)) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for block hashes");
     }
@@ -886,8 +899,11 @@ UniValue getblockheader(const JSONRPCRequest& request)
 
     if (!fVerbose)
     {
+        CBlockHeader header;
+        if (!ReadBlockHeader(pblockindex, header))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Can't read block header from the block index database");
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-        ssBlock << pblockindex->GetBlockHeader();
+        ssBlock << header;
         std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
         return strHex;
     }
@@ -1445,6 +1461,48 @@ struct CompareBlocksByHeight
     }
 };
 
+UniValue getindexinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getindexinfo\n"
+            "Returns how far the enabled optional indexes have been built.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"name\": {                  (json object) the index, e.g. addressindex\n"
+            "    \"synced\": true|false,     (boolean) whether it has caught up with the chain and follows it\n"
+            "    \"bestblockheight\": xxxx,  (numeric) height of the last block in the index, -1 if none\n"
+            "    \"bestblockhash\": \"xxxx\", (string) hash of that block\n"
+            "    \"progress\": xxx           (numeric) bestblockheight as a fraction of the chain height\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getindexinfo", "")
+            + HelpExampleRpc("getindexinfo", "")
+        );
+
+    int nChainHeight;
+    {
+        LOCK(cs_main);
+        nChainHeight = chainActive.Height();
+    }
+
+    UniValue result(UniValue::VOBJ);
+    for (const CIndexBuilder* builder : GetIndexBuilders()) {
+        const bool fSynced = builder->IsSynced();
+        const CBlockIndex* pindex = builder->GetBestBlock();
+        const int nHeight = pindex ? pindex->nHeight : -1;
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("synced", fSynced));
+        obj.push_back(Pair("bestblockheight", nHeight));
+        obj.push_back(Pair("bestblockhash", pindex ? pindex->GetBlockHash().GetHex() : ""));
+        obj.push_back(Pair("progress", fSynced || nChainHeight <= 0 ? 1.0 : std::max(nHeight, 0) / (double)nChainHeight));
+        result.push_back(Pair(builder->GetName(), obj));
+    }
+    return result;
+}
+
 UniValue getchaintips(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 0)
@@ -1809,6 +1867,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getblockhash",           &getblockhash,           {"height"} },
     { "blockchain",         "getblockheader",         &getblockheader,         {"blockhash","verbose"} },
     { "blockchain",         "getchaintips",           &getchaintips,           {} },
+    { "blockchain",         "getindexinfo",           &getindexinfo,           {} },
     { "blockchain",         "getdifficulty",          &getdifficulty,          {} },
     { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    {"txid","verbose"} },
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  {"txid","verbose"} },
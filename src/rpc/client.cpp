@@ -66,6 +66,9 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "listaccounts", 1, "include_watchonly" },
     { "walletpassphrase", 1, "timeout" },
     { "getblocktemplate", 0, "template_request" },
+    { "getblocksubsidy", 0, "height" },
+    { "getblocksubsidies", 0, "height" },
+    { "getblocksubsidies", 1, "count" },
     { "listsinceblock", 1, "target_confirmations" },
     { "listsinceblock", 2, "include_watchonly" },
     { "listsinceblock", 3, "include_removed" },
@@ -21,6 +21,7 @@
 #include <rpc/blockchain.h>
 #include <rpc/mining.h>
 #include <rpc/server.h>
+#include <subsidycache.h>
 #include <txmempool.h>
 #include <util.h>
 #include <utilstrencodings.h>
@@ -123,6 +124,15 @@ UniValue generateBlocks(std::shared_ptr<CReserveScript> coinbaseScript, int nGen
     const CChainParams& params = Params();
     unsigned int n = params.EquihashN();
     unsigned int k = params.EquihashK();
+    std::unique_ptr<CEquihashSolver> solver;
+    try {
+        solver = MakeEquihashSolver(gArgs.GetArg("-equihashsolver", DEFAULT_EQUIHASH_SOLVER), n, k,
+                                    std::max(1, (int)gArgs.GetArg("-equihashsolverthreads", DEFAULT_EQUIHASH_SOLVER_THREADS)),
+                                    gArgs.GetBoolArg("-equihashhugepages", DEFAULT_EQUIHASH_HUGE_PAGES));
+    } catch (const std::runtime_error& e) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, e.what());
+    }
+    std::function<bool(EhSolverCancelCheck)> cancelled = [](EhSolverCancelCheck pos) { return false; };
     while (nHeight < nHeightEnd)
     {
         std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewBlock(coinbaseScript->reserveScript));
@@ -170,7 +180,7 @@ UniValue generateBlocks(std::shared_ptr<CReserveScript> coinbaseScript, int nGen
 		    pblock->nSolution = soln;
 		    return CheckProofOfWork(pblock->GetHash(), pblock->nBits, Params().GetConsensus());
 	    };
-	    bool found = EhBasicSolveUncancellable(n, k, curr_state, validBlock);
+	    bool found = solver->Solve(curr_state, validBlock, cancelled);
             --nMaxTries;
 	    if (found) {
 		break;
@@ -893,40 +903,10 @@ UniValue submitblock(const JSONRPCRequest& request)
     return BIP22ValidationResult(sc.state);
 }
 
-UniValue getblocksubsidy(const JSONRPCRequest& request)
+/** Split the subsidy at nHeight into the miner's share and the deductions. */
+static UniValue BlockSubsidyToJSON(int nHeight, CAmount nReward)
 {
-  if (request.fHelp || request.params.size() > 1)
-    throw std::runtime_error(
-      "getblocksubsidy height\n"
-      "\nReturns block subsidy reward of block at index provided, taking block deductions into account.\n"
-      "\nArguments:\n"
-      "1. height          (numeric, optional) The block height. If not provided, defaults to the current height of the chain.\n"
-      "\nResult:\n"
-      "{\n"
-      "\"miner\": n,    (numeric) The mining reward amount in genxis.\n"
-      "\"founders-chris\": f, (numeric) The founders reward in genxis (Chris) ()\n"
-      "\"founders-jimmy\": f, (numeric) The founders reward in genxis (Jimmy) ()\n"
-      "\"founders-scott\": f, (numeric) The founders reward in genxis (Scott) ()\n"
-      "\"founders-shelby\": f, (numeric) The founders reward in genxis (Shelby) ()\n"
-      "\"founders-loki\": f, (numeric) The founders reward in genxis (Loki) ()\n"
-      "\"infrastructure\": f, (numeric) Infrastructure deduction in genxis \n"
-      "\"giveaways\": f, (numeric) Giveaways deduction in genxis \n"
-      "}\n"
-      "\nExamples:\n"
-      + HelpExampleCli("getblocksubsidy", "1000")
-      + HelpExampleRpc("getblocksubsidy", "1000")
-    );
-
-  RPCTypeCheck(request.params, {UniValue::VNUM});
-
-  LOCK(cs_main);
-  int nHeight = (request.params.size() == 1) ? request.params[0].get_int() : chainActive.Height() + 1;
-  if (nHeight < 0)
-    throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range.");
-
-  UniValue result(UniValue::VOBJ);
-
-  CAmount nReward = GetBlockSubsidy(nHeight, Params().GetConsensus());
+    UniValue result(UniValue::VOBJ);
 
     CAmount deductions = nReward / 4;
     CAmount miner = nReward - deductions;
@@ -960,6 +940,88 @@ UniValue getblocksubsidy(const JSONRPCRequest& request)
     result.push_back(Pair("infrastructure", (deductions / 5)));
     result.push_back(Pair("giveaways", (deductions / 5) * 2));
 
+    return result;
+}
+
+//! Maximum number of heights getblocksubsidies returns at once
+static const int MAX_BLOCK_SUBSIDIES_RESULTS = 10000;
+
+UniValue getblocksubsidy(const JSONRPCRequest& request)
+{
+  if (request.fHelp || request.params.size() > 1)
+    throw std::runtime_error(
+      "getblocksubsidy height\n"
+      "\nReturns block subsidy reward of block at index provided, taking block deductions into account.\n"
+      "\nArguments:\n"
+      "1. height          (numeric, optional) The block height. If not provided, defaults to the current height of the chain.\n"
+      "\nResult:\n"
+      "{\n"
+      "\"miner\": n,    (numeric) The mining reward amount in genxis.\n"
+      "\"founders-chris\": f, (numeric) The founders reward in genxis (Chris) ()\n"
+      "\"founders-jimmy\": f, (numeric) The founders reward in genxis (Jimmy) ()\n"
+      "\"founders-scott\": f, (numeric) The founders reward in genxis (Scott) ()\n"
+      "\"founders-shelby\": f, (numeric) The founders reward in genxis (Shelby) ()\n"
+      "\"founders-loki\": f, (numeric) The founders reward in genxis (Loki) ()\n"
+      "\"infrastructure\": f, (numeric) Infrastructure deduction in genxis \n"
+      "\"giveaways\": f, (numeric) Giveaways deduction in genxis \n"
+      "}\n"
+      "\nExamples:\n"
+      + HelpExampleCli("getblocksubsidy", "1000")
+      + HelpExampleRpc("getblocksubsidy", "1000")
+    );
+
+  RPCTypeCheck(request.params, {UniValue::VNUM});
+
+  int nHeight;
+  if (request.params.size() == 1) {
+    nHeight = request.params[0].get_int();
+  } else {
+    LOCK(cs_main);
+    nHeight = chainActive.Height() + 1;
+  }
+  if (nHeight < 0)
+    throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range.");
+
+  CAmount nReward;
+  if (!subsidyCache.GetSubsidy(nHeight, nReward))
+    throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range.");
+
+  return BlockSubsidyToJSON(nHeight, nReward);
+}
+
+UniValue getblocksubsidies(const JSONRPCRequest& request)
+{
+  if (request.fHelp || request.params.size() != 2)
+    throw std::runtime_error(
+      "getblocksubsidies height count\n"
+      "\nReturns the block subsidy rewards of count consecutive blocks starting at height, as getblocksubsidy does for one.\n"
+      "\nArguments:\n"
+      "1. height          (numeric, required) The first block height.\n"
+      "2. count           (numeric, required) The number of blocks, at most " + std::to_string(MAX_BLOCK_SUBSIDIES_RESULTS) + ".\n"
+      "\nResult:\n"
+      "[\n"
+      "  {...},           (object) The same fields as getblocksubsidy, for each height\n"
+      "  ...\n"
+      "]\n"
+      "\nExamples:\n"
+      + HelpExampleCli("getblocksubsidies", "1000 100")
+      + HelpExampleRpc("getblocksubsidies", "1000, 100")
+    );
+
+  RPCTypeCheck(request.params, {UniValue::VNUM, UniValue::VNUM});
+
+  int nHeight = request.params[0].get_int();
+  int nCount = request.params[1].get_int();
+  if (nCount < 0 || nCount > MAX_BLOCK_SUBSIDIES_RESULTS)
+    throw JSONRPCError(RPC_INVALID_PARAMETER, "Count out of range.");
+
+  std::vector<CAmount> vSubsidy;
+  if (nHeight < 0 || !subsidyCache.GetSubsidies(nHeight, nCount, vSubsidy))
+    throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range.");
+
+  UniValue result(UniValue::VARR);
+  for (int i = 0; i < nCount; i++)
+    result.push_back(BlockSubsidyToJSON(nHeight + i, vSubsidy[i]));
   return result;
 }
 
@@ -1177,6 +1239,7 @@ static const CRPCCommand commands[] =
     { "mining",             "submitblock",            &submitblock,            {"hexdata","dummy"} },
 
     { "mining",             "getblocksubsidy",        &getblocksubsidy,        {"height"} },
+    { "mining",             "getblocksubsidies",      &getblocksubsidies,      {"height","count"} },
 
     { "generating",         "getgenerate",            &getgenerate,            {} },
     { "generating",         "setgenerate",            &setgenerate,            {"generate", "genproclimit"} },
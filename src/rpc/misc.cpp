@@ -28,6 +28,8 @@
 #include <warnings.h>
 
 #include <stdint.h>
+
+#include <functional>
 #ifdef HAVE_MALLOC_INFO
 #include <malloc.h>
 #endif
@@ -685,6 +687,102 @@ static UniValue getinfo_deprecated(const JSONRPCRequest& request)
                    std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> b) {
     return a.second.time < b.second.time;
 }
+
+//! Page size of the address calls when a cursor is given without a limit
+static const int DEFAULT_ADDRESS_PAGE_LIMIT = 1000;
+
+/** Paging options of an address call: the page size, the direction, and the
+ *  opaque cursor the previous page returned. */
+struct AddressPage {
+    bool fPaged = false;
+    bool fReverse = false;
+    size_t nLimit = DEFAULT_ADDRESS_PAGE_LIMIT;
+    std::string strCursor;
+};
+
+static AddressPage getAddressPageFromParams(const UniValue& params)
+{
+    AddressPage page;
+    if (!params[0].isObject()) {
+        return page;
+    }
+    UniValue limitValue = find_value(params[0].get_obj(), "limit");
+    UniValue cursorValue = find_value(params[0].get_obj(), "cursor");
+    UniValue reverseValue = find_value(params[0].get_obj(), "reverse");
+    if (limitValue.isNum()) {
+        if (limitValue.get_int() <= 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Limit is expected to be greater than zero");
+        }
+        page.nLimit = limitValue.get_int();
+        page.fPaged = true;
+    }
+    if (cursorValue.isStr()) {
+        page.strCursor = cursorValue.get_str();
+        page.fPaged = true;
+    }
+    if (reverseValue.isBool() && reverseValue.get_bool()) {
+        page.fReverse = true;
+        page.fPaged = true;
+    }
+    return page;
+}
+
+/** A cursor names the address a page stopped at and, unless the page ended
+ *  between two addresses, the index key to resume that address from. */
+template<typename Key>
+static std::string encodeAddressCursor(const std::pair<uint160, int>& address, const Key& key)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << address.first << address.second << key;
+    return HexStr(ss.begin(), ss.end());
+}
+
+template<typename Key>
+static size_t decodeAddressCursor(const std::string& strCursor, const std::vector<std::pair<uint160, int> >& addresses, Key& key)
+{
+    if (!IsHex(strCursor)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    }
+    std::pair<uint160, int> address;
+    CDataStream ss(ParseHex(strCursor), SER_DISK, CLIENT_VERSION);
+    try {
+        ss >> address.first >> address.second >> key;
+    } catch (const std::exception&) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    }
+    if (!ss.empty() || (!key.IsNull() && (key.hashBytes != address.first || (int)key.type != address.second))) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    }
+    for (size_t i = 0; i < addresses.size(); i++) {
+        if (addresses[i] == address) {
+            return i;
+        }
+    }
+    throw JSONRPCError(RPC_INVALID_PARAMETER, "Cursor does not belong to the addresses given");
+}
+
+/** Fill one page from the addresses in the order given, starting at the
+ *  page's cursor. Returns the cursor of the next page, or null after the last. */
+template<typename Key, typename Value>
+static UniValue readAddressPage(const std::vector<std::pair<uint160, int> >& addresses, const AddressPage& page,
+                                std::function<bool(const std::pair<uint160, int>&, size_t, Key&, std::vector<std::pair<Key, Value> >&)> read,
+                                std::vector<std::pair<Key, Value> >& entries)
+{
+    Key key;
+    size_t i = page.strCursor.empty() ? 0 : decodeAddressCursor(page.strCursor, addresses, key);
+    for (; i < addresses.size(); i++) {
+        if (entries.size() == page.nLimit) {
+            return encodeAddressCursor(addresses[i], key);
+        }
+        if (!read(addresses[i], page.nLimit - entries.size(), key, entries)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+        }
+        if (!key.IsNull()) {
+            return encodeAddressCursor(addresses[i], key);
+        }
+    }
+    return NullUniValue;
+}
  UniValue getaddressmempool(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -759,6 +857,9 @@ static UniValue getinfo_deprecated(const JSONRPCRequest& request)
             "      ,...\n"
             "    ],\n"
             "  \"chainInfo\"  (boolean) Include chain info with results\n"
+            "  \"limit\" (number, optional) Return a page of at most this many index entries, with a cursor to the next\n"
+            "  \"cursor\" (string, optional) The cursor returned with the previous page\n"
+            "  \"reverse\" (boolean, optional) Page backwards\n"
             "}\n"
             "\nResult\n"
             "[\n"
@@ -771,8 +872,11 @@ static UniValue getinfo_deprecated(const JSONRPCRequest& request)
             "    \"satoshis\"  (number) The number of satoshis of the output\n"
             "  }\n"
             "]\n"
+            "\nWith chainInfo, or when paging, the outputs are returned in a \"utxos\" field of an object. Pages follow\n"
+            "the index order of each address in turn rather than height, and carry the next page's \"cursor\" (null after the last).\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressutxos", "'{\"addresses\": [\"12c6DSiU4Rq3P4ZxziKxzrL5LmMBrzjrJX\"]}'")
+            + HelpExampleCli("getaddressutxos", "'{\"addresses\": [\"12c6DSiU4Rq3P4ZxziKxzrL5LmMBrzjrJX\"], \"limit\": 1000}'")
             + HelpExampleRpc("getaddressutxos", "{\"addresses\": [\"12c6DSiU4Rq3P4ZxziKxzrL5LmMBrzjrJX\"]}")
             );
      bool includeChainInfo = false;
@@ -786,13 +890,23 @@ static UniValue getinfo_deprecated(const JSONRPCRequest& request)
      if (!getAddressesFromParams(request.params, addresses)) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
+     AddressPage page = getAddressPageFromParams(request.params);
      std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
-     for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (!GetAddressUnspent((*it).first, (*it).second, unspentOutputs)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    UniValue cursor;
+    if (page.fPaged) {
+        cursor = readAddressPage<CAddressUnspentKey, CAddressUnspentValue>(addresses, page,
+            [&page](const std::pair<uint160, int>& address, size_t nLimit, CAddressUnspentKey& key,
+                    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& entries) {
+                return GetAddressUnspentPage(address.first, address.second, page.fReverse, nLimit, key, entries);
+            }, unspentOutputs);
+    } else {
+        for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
+            if (!GetAddressUnspent((*it).first, (*it).second, unspentOutputs)) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+            }
         }
+        std::sort(unspentOutputs.begin(), unspentOutputs.end(), heightSort);
     }
-     std::sort(unspentOutputs.begin(), unspentOutputs.end(), heightSort);
      UniValue utxos(UniValue::VARR);
      for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=unspentOutputs.begin(); it!=unspentOutputs.end(); it++) {
         UniValue output(UniValue::VOBJ);
@@ -808,12 +922,17 @@ static UniValue getinfo_deprecated(const JSONRPCRequest& request)
         output.push_back(Pair("height", it->second.blockHeight));
         utxos.push_back(output);
     }
-     if (includeChainInfo) {
+     if (includeChainInfo || page.fPaged) {
         UniValue result(UniValue::VOBJ);
         result.push_back(Pair("utxos", utxos));
-         LOCK(cs_main);
-        result.push_back(Pair("hash", chainActive.Tip()->GetBlockHash().GetHex()));
-        result.push_back(Pair("height", (int)chainActive.Height()));
+        if (page.fPaged) {
+            result.push_back(Pair("cursor", cursor));
+        }
+        if (includeChainInfo) {
+            LOCK(cs_main);
+            result.push_back(Pair("hash", chainActive.Tip()->GetBlockHash().GetHex()));
+            result.push_back(Pair("height", (int)chainActive.Height()));
+        }
         return result;
     } else {
         return utxos;
@@ -835,6 +954,9 @@ static UniValue getinfo_deprecated(const JSONRPCRequest& request)
             "  \"start\" (number) The start block height\n"
             "  \"end\" (number) The end block height\n"
             "  \"chainInfo\" (boolean) Include chain info in results, only applies if start and end specified\n"
+            "  \"limit\" (number, optional) Return a page of at most this many index entries, with a cursor to the next\n"
+            "  \"cursor\" (string, optional) The cursor returned with the previous page\n"
+            "  \"reverse\" (boolean, optional) Page from the newest entries to the oldest\n"
             "}\n"
             "\nResult:\n"
             "[\n"
@@ -846,8 +968,11 @@ static UniValue getinfo_deprecated(const JSONRPCRequest& request)
             "    \"address\"  (string) The base58check encoded address\n"
             "  }\n"
             "]\n"
+            "\nWith chainInfo, or when paging, the changes are returned in a \"deltas\" field of an object. Pages go\n"
+            "through each address in turn, and carry the next page's \"cursor\" (null after the last).\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"12c6DSiU4Rq3P4ZxziKxzrL5LmMBrzjrJX\"]}'")
+            + HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"12c6DSiU4Rq3P4ZxziKxzrL5LmMBrzjrJX\"], \"limit\": 1000, \"reverse\": true}'")
             + HelpExampleRpc("getaddressdeltas", "{\"addresses\": [\"12c6DSiU4Rq3P4ZxziKxzrL5LmMBrzjrJX\"]}")
         );
      UniValue startValue = find_value(request.params[0].get_obj(), "start");
@@ -873,15 +998,25 @@ static UniValue getinfo_deprecated(const JSONRPCRequest& request)
      if (!getAddressesFromParams(request.params, addresses)) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
+     AddressPage page = getAddressPageFromParams(request.params);
      std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-     for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (start > 0 && end > 0) {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        } else {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    UniValue cursor;
+    if (page.fPaged) {
+        cursor = readAddressPage<CAddressIndexKey, CAmount>(addresses, page,
+            [&page, start, end](const std::pair<uint160, int>& address, size_t nLimit, CAddressIndexKey& key,
+                                std::vector<std::pair<CAddressIndexKey, CAmount> >& entries) {
+                return GetAddressIndexPage(address.first, address.second, start, end, page.fReverse, nLimit, key, entries);
+            }, addressIndex);
+    } else {
+        for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
+            if (start > 0 && end > 0) {
+                if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end)) {
+                    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+                }
+            } else {
+                if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
+                    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+                }
             }
         }
     }
@@ -917,7 +1052,14 @@ static UniValue getinfo_deprecated(const JSONRPCRequest& request)
          result.push_back(Pair("deltas", deltas));
         result.push_back(Pair("start", startInfo));
         result.push_back(Pair("end", endInfo));
+        if (page.fPaged) {
+            result.push_back(Pair("cursor", cursor));
+        }
          return result;
+    } else if (page.fPaged) {
+        result.push_back(Pair("deltas", deltas));
+        result.push_back(Pair("cursor", cursor));
+        return result;
     } else {
         return deltas;
     }
@@ -940,6 +1082,9 @@ static UniValue getinfo_deprecated(const JSONRPCRequest& request)
             "{\n"
             "  \"balance\"  (string) The current balance in satoshis\n"
             "  \"received\"  (string) The total number of satoshis received (including change)\n"
+            "  \"txcount\"  (number) The number of transactions involving the address(es), counted per address\n"
+            "  \"firstheight\"  (number) The height of the first block involving the address(es)\n"
+            "  \"lastheight\"  (number) The height of the last block involving the address(es)\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressbalance", "'{\"addresses\": [\"12c6DSiU4Rq3P4ZxziKxzrL5LmMBrzjrJX\"]}'")
@@ -949,23 +1094,33 @@ static UniValue getinfo_deprecated(const JSONRPCRequest& request)
      if (!getAddressesFromParams(request.params, addresses)) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
-     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+     CAmount balance = 0;
+    CAmount received = 0;
+    int64_t txCount = 0;
+    int firstHeight = 0;
+    int lastHeight = 0;
      for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
+        CAddressBalanceValue value;
+        if (!GetAddressBalance((*it).first, (*it).second, value)) {
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
         }
-    }
-     CAmount balance = 0;
-    CAmount received = 0;
-     for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++) {
-        if (it->second > 0) {
-            received += it->second;
+        if (value.IsNull()) {
+            continue;
         }
-        balance += it->second;
+        if (txCount == 0 || value.firstHeight < firstHeight) {
+            firstHeight = value.firstHeight;
+        }
+        lastHeight = std::max(lastHeight, value.lastHeight);
+        balance += value.balance;
+        received += value.received;
+        txCount += value.txCount;
     }
      UniValue result(UniValue::VOBJ);
     result.push_back(Pair("balance", balance));
     result.push_back(Pair("received", received));
+    result.push_back(Pair("txcount", txCount));
+    result.push_back(Pair("firstheight", firstHeight));
+    result.push_back(Pair("lastheight", lastHeight));
      return result;
  }
  UniValue getaddresstxids(const JSONRPCRequest& request)
@@ -983,14 +1138,21 @@ static UniValue getinfo_deprecated(const JSONRPCRequest& request)
             "    ]\n"
             "  \"start\" (number) The start block height\n"
             "  \"end\" (number) The end block height\n"
+            "  \"limit\" (number, optional) Return a page of at most this many index entries, with a cursor to the next\n"
+            "  \"cursor\" (string, optional) The cursor returned with the previous page\n"
+            "  \"reverse\" (boolean, optional) Page from the newest entries to the oldest\n"
             "}\n"
             "\nResult:\n"
             "[\n"
             "  \"transactionid\"  (string) The transaction id\n"
             "  ,...\n"
             "]\n"
+            "\nWhen paging, the txids are returned in a \"txids\" field of an object, with the next page's \"cursor\"\n"
+            "(null after the last). Pages go through each address in turn, and the limit counts index entries, so a\n"
+            "transaction with entries on both sides of a page boundary is listed on both pages.\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddresstxids", "'{\"addresses\": [\"12c6DSiU4Rq3P4ZxziKxzrL5LmMBrzjrJX\"]}'")
+            + HelpExampleCli("getaddresstxids", "'{\"addresses\": [\"12c6DSiU4Rq3P4ZxziKxzrL5LmMBrzjrJX\"], \"limit\": 1000, \"reverse\": true}'")
             + HelpExampleRpc("getaddresstxids", "{\"addresses\": [\"12c6DSiU4Rq3P4ZxziKxzrL5LmMBrzjrJX\"]}")
         );
      std::vector<std::pair<uint160, int> > addresses;
@@ -1006,6 +1168,27 @@ static UniValue getinfo_deprecated(const JSONRPCRequest& request)
             start = startValue.get_int();
             end = endValue.get_int();
         }
+    }
+     AddressPage page = getAddressPageFromParams(request.params);
+    if (page.fPaged) {
+        std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+        UniValue cursor = readAddressPage<CAddressIndexKey, CAmount>(addresses, page,
+            [&page, start, end](const std::pair<uint160, int>& address, size_t nLimit, CAddressIndexKey& key,
+                                std::vector<std::pair<CAddressIndexKey, CAmount> >& entries) {
+                return GetAddressIndexPage(address.first, address.second, start, end, page.fReverse, nLimit, key, entries);
+            }, addressIndex);
+
+        // The entries of one transaction are adjacent within an address
+        UniValue txids(UniValue::VARR);
+        for (size_t i = 0; i < addressIndex.size(); i++) {
+            if (i == 0 || addressIndex[i].first.txhash != addressIndex[i - 1].first.txhash) {
+                txids.push_back(addressIndex[i].first.txhash.GetHex());
+            }
+        }
+        UniValue result(UniValue::VOBJ);
+        result.push_back(Pair("txids", txids));
+        result.push_back(Pair("cursor", cursor));
+        return result;
     }
      std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
      for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
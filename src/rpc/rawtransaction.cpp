@@ -48,16 +48,25 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry,
 
     if (expanded) {
         uint256 txid = tx.GetHash();
+        // Spent info of all inputs and outputs, read in one batch if spentindex enabled
+        const size_t nInputs = tx.IsCoinBase() ? 0 : tx.vin.size();
+        std::vector<CSpentIndexKey> spentKeys;
+        spentKeys.reserve(nInputs + tx.vout.size());
+        for (size_t i = 0; i < nInputs; i++)
+            spentKeys.push_back(CSpentIndexKey(tx.vin[i].prevout.hash, tx.vin[i].prevout.n));
+        for (size_t i = 0; i < tx.vout.size(); i++)
+            spentKeys.push_back(CSpentIndexKey(txid, i));
+        std::vector<CSpentIndexValue> spentInfos;
+        std::vector<bool> spentFound;
+        GetSpentIndexes(spentKeys, spentInfos, spentFound);
         if (!(tx.IsCoinBase())) {
             const UniValue& oldVin = entry["vin"];
             UniValue newVin(UniValue::VARR);
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
-                const CTxIn& txin = tx.vin[i];
                 UniValue in = oldVin[i];
                  // Add address and value info if spentindex enabled
-                CSpentIndexValue spentInfo;
-                CSpentIndexKey spentKey(txin.prevout.hash, txin.prevout.n);
-                if (GetSpentIndex(spentKey, spentInfo)) {
+                const CSpentIndexValue& spentInfo = spentInfos[i];
+                if (spentFound[i]) {
                     in.pushKV("value", ValueFromAmount(spentInfo.satoshis));
                     in.pushKV("valueSat", spentInfo.satoshis);
                     if (spentInfo.addressType == 1) {
@@ -76,9 +85,8 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry,
             const CTxOut& txout = tx.vout[i];
             UniValue out = oldVout[i];
              // Add spent information if spentindex is enabled
-            CSpentIndexValue spentInfo;
-            CSpentIndexKey spentKey(txid, i);
-            if (GetSpentIndex(spentKey, spentInfo)) {
+            const CSpentIndexValue& spentInfo = spentInfos[nInputs + i];
+            if (spentFound[nInputs + i]) {
                 out.pushKV("spentTxId", spentInfo.txid.GetHex());
                 out.pushKV("spentIndex", (int)spentInfo.inputIndex);
                 out.pushKV("spentHeight", spentInfo.blockHeight);
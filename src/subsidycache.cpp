@@ -0,0 +1,109 @@
+// Copyright (c) 2018 The Genesis Official developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <subsidycache.h>
+
+#include <chain.h>
+#include <chainparams.h>
+#include <consensus/consensus.h>
+#include <validation.h>
+
+CSubsidyCache subsidyCache;
+
+void CSubsidyCache::Truncate(size_t nSize)
+{
+    if (nSize >= vSubsidy.size())
+        return;
+    size_t nRemove = vSubsidy.size() - nSize;
+    vSubsidy.resize(nSize);
+    vConfirmedHash.resize(vConfirmedHash.size() > nRemove ? vConfirmedHash.size() - nRemove : 0);
+}
+
+void CSubsidyCache::Append(const uint256& confirmedHash, CAmount nSubsidy)
+{
+    vSubsidy.push_back(nSubsidy);
+    vConfirmedHash.push_back(confirmedHash);
+    if (vConfirmedHash.size() > SUBSIDY_CACHE_REORG_DEPTH)
+        vConfirmedHash.pop_front();
+}
+
+bool CSubsidyCache::GetSubsidy(int nHeight, CAmount& nSubsidy)
+{
+    std::vector<CAmount> v;
+    if (!GetSubsidies(nHeight, 1, v))
+        return false;
+    nSubsidy = v[0];
+    return true;
+}
+
+bool CSubsidyCache::GetSubsidies(int nStart, int nCount, std::vector<CAmount>& vSubsidyOut)
+{
+    vSubsidyOut.clear();
+    if (nStart < 0 || nCount < 0)
+        return false;
+    const size_t nEnd = (size_t)nStart + nCount;
+
+    // Notifications may not have caught up with the active chain yet. Drop
+    // recent entries derived from blocks no longer in it; checking the newest
+    // is enough, as each entry's confirmed block descends from the last one's.
+    LOCK2(cs_main, cs_subsidy);
+    const size_t nKnown = std::max(chainActive.Height(), 0) + COINBASE_MATURITY + 1;
+    if (nEnd > nKnown)
+        return false;
+    while (!vConfirmedHash.empty()) {
+        const int nHeight = vSubsidy.size() - 1;
+        if (nHeight <= COINBASE_MATURITY)
+            break;
+        const CBlockIndex* pindex = chainActive[nHeight - COINBASE_MATURITY];
+        if (pindex && pindex->GetBlockHash() == vConfirmedHash.back())
+            break;
+        Truncate(vSubsidy.size() - 1);
+    }
+    if (vConfirmedHash.empty() && vSubsidy.size() > (size_t)COINBASE_MATURITY + 1)
+        Truncate(COINBASE_MATURITY + 1);
+
+    // Extend from the active chain as far as asked
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    vSubsidy.reserve(nKnown);
+    while (vSubsidy.size() < nEnd) {
+        const int nHeight = vSubsidy.size();
+        uint256 confirmedHash;
+        if (nHeight > COINBASE_MATURITY)
+            confirmedHash = chainActive[nHeight - COINBASE_MATURITY]->GetBlockHash();
+        Append(confirmedHash, GetBlockSubsidy(nHeight, confirmedHash, consensusParams));
+    }
+    vSubsidyOut.assign(vSubsidy.begin() + nStart, vSubsidy.begin() + nEnd);
+    return true;
+}
+
+void CSubsidyCache::BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex, const std::vector<CTransactionRef>& txnConflicted)
+{
+    // The block decides the subsidy COINBASE_MATURITY above it. Entries past
+    // that were derived from a branch that has been replaced.
+    const size_t nHeight = pindex->nHeight + COINBASE_MATURITY;
+    const uint256 confirmedHash = pindex->GetBlockHash();
+    LOCK(cs_subsidy);
+    const size_t nHashed = vSubsidy.size() - vConfirmedHash.size();
+    if (nHeight < vSubsidy.size() && nHeight >= nHashed && vConfirmedHash[nHeight - nHashed] == confirmedHash)
+        return; // already extended past this block from chainActive
+    Truncate(nHeight);
+    if (vSubsidy.size() == nHeight) {
+        Append(confirmedHash, GetBlockSubsidy(nHeight, confirmedHash, Params().GetConsensus()));
+    }
+}
+
+void CSubsidyCache::BlockDisconnected(const std::shared_ptr<const CBlock>& block)
+{
+    const uint256 hash = block->GetHash();
+    LOCK(cs_subsidy);
+    for (size_t i = vConfirmedHash.size(); i-- > 0; ) {
+        if (vConfirmedHash[i] == hash) {
+            Truncate(vSubsidy.size() - (vConfirmedHash.size() - i));
+            return;
+        }
+    }
+    // Deeper than the hashes we keep: start again from the active chain.
+    if (vSubsidy.size() > (size_t)COINBASE_MATURITY + 1)
+        Truncate(COINBASE_MATURITY + 1);
+}
@@ -0,0 +1,53 @@
+// Copyright (c) 2018 The Genesis Official developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef GENESIS_SUBSIDYCACHE_H
+#define GENESIS_SUBSIDYCACHE_H
+
+#include <amount.h>
+#include <sync.h>
+#include <uint256.h>
+#include <validationinterface.h>
+
+#include <deque>
+#include <vector>
+
+//! Number of confirmed block hashes kept to follow reorganizations without a rebuild
+static const size_t SUBSIDY_CACHE_REORG_DEPTH = 1000;
+
+/**
+ * Block subsidies of the active chain by height. The subsidy of a normal
+ * block is derived from the hash of the block COINBASE_MATURITY below it, so
+ * looking it up used to mean walking chainActive for every height. This
+ * cache follows connected and disconnected blocks through the validation
+ * interface instead. A lookup holds cs_main only long enough to check its
+ * newest entry against chainActive, which notifications may lag behind, and
+ * extends the cache from chainActive when a caller asks beyond what it holds.
+ */
+class CSubsidyCache : public CValidationInterface
+{
+public:
+    /** Subsidy at nHeight on the active chain. Returns false if not yet determined. */
+    bool GetSubsidy(int nHeight, CAmount& nSubsidy);
+    /** Subsidies at nStart .. nStart + nCount - 1. Returns false if any is not yet determined. */
+    bool GetSubsidies(int nStart, int nCount, std::vector<CAmount>& vSubsidy);
+
+protected:
+    void BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex, const std::vector<CTransactionRef>& txnConflicted) override;
+    void BlockDisconnected(const std::shared_ptr<const CBlock>& block) override;
+
+private:
+    void Truncate(size_t nSize);
+    void Append(const uint256& confirmedHash, CAmount nSubsidy);
+
+    CCriticalSection cs_subsidy;
+    //! Subsidy by height
+    std::vector<CAmount> vSubsidy;
+    //! Confirmed hashes the last entries of vSubsidy were derived from
+    std::deque<uint256> vConfirmedHash;
+};
+
+extern CSubsidyCache subsidyCache;
+
+#endif // GENESIS_SUBSIDYCACHE_H
@@ -0,0 +1,187 @@
+// Copyright (c) 2018 The Genesis Official developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef GENESIS_SUPPORT_ALLOCATORS_POOL_H
+#define GENESIS_SUPPORT_ALLOCATORS_POOL_H
+
+#include <array>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <new>
+#include <vector>
+
+/**
+ * Memory resource for node based containers. Blocks of up to
+ * MAX_BLOCK_SIZE_BYTES are carved out of large chunks, and freed blocks go on
+ * a free list per size to be handed out again, so a node costs its size
+ * rounded up to ALIGN_BYTES instead of a malloc call with its bookkeeping.
+ * Chunks are only returned when the resource is destroyed. Larger or more
+ * strictly aligned requests, like the bucket array of a hash map, go to the
+ * heap.
+ *
+ * Not thread safe: a resource belongs to the container it was made for.
+ */
+template <size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+class PoolResource
+{
+    static_assert(ALIGN_BYTES > 0 && (ALIGN_BYTES & (ALIGN_BYTES - 1)) == 0, "ALIGN_BYTES must be a power of two");
+    static_assert(ALIGN_BYTES >= sizeof(void*), "free blocks must hold a pointer");
+
+    //! First chunk size; later chunks double up to MAX_CHUNK_SIZE_BYTES
+    static const size_t MIN_CHUNK_SIZE_BYTES = 4096;
+    static const size_t MAX_CHUNK_SIZE_BYTES = 256 * 1024;
+    static const size_t NUM_FREE_LISTS = (MAX_BLOCK_SIZE_BYTES + ALIGN_BYTES - 1) / ALIGN_BYTES + 1;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    std::array<FreeBlock*, NUM_FREE_LISTS> vFreeLists;
+    std::vector<void*> vChunks;
+    char* pAvailableBegin;
+    char* pAvailableEnd;
+    size_t nNextChunkSize;
+    size_t nChunkBytes;
+
+    static size_t FreeListIndex(size_t bytes)
+    {
+        return (bytes + ALIGN_BYTES - 1) / ALIGN_BYTES;
+    }
+
+    void AllocateChunk()
+    {
+        // The rest of the current chunk goes to the free list it fits
+        const size_t nRemaining = pAvailableEnd - pAvailableBegin;
+        if (nRemaining >= ALIGN_BYTES) {
+            const size_t nIndex = nRemaining / ALIGN_BYTES;
+            FreeBlock* pBlock = reinterpret_cast<FreeBlock*>(pAvailableBegin);
+            pBlock->next = vFreeLists[nIndex];
+            vFreeLists[nIndex] = pBlock;
+        }
+
+        void* pChunk = ::operator new(nNextChunkSize);
+        vChunks.push_back(pChunk);
+        pAvailableBegin = static_cast<char*>(pChunk);
+        pAvailableEnd = pAvailableBegin + nNextChunkSize;
+        nChunkBytes += nNextChunkSize;
+        if (nNextChunkSize < MAX_CHUNK_SIZE_BYTES)
+            nNextChunkSize *= 2;
+    }
+
+public:
+    PoolResource() : pAvailableBegin(nullptr), pAvailableEnd(nullptr), nNextChunkSize(MIN_CHUNK_SIZE_BYTES), nChunkBytes(0)
+    {
+        vFreeLists.fill(nullptr);
+    }
+
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    ~PoolResource()
+    {
+        for (void* pChunk : vChunks)
+            ::operator delete(pChunk);
+    }
+
+    /** Whether a request of this size and alignment is served from the pool. */
+    static bool IsPooled(size_t bytes, size_t alignment)
+    {
+        return bytes <= MAX_BLOCK_SIZE_BYTES && alignment <= ALIGN_BYTES;
+    }
+
+    void* Allocate(size_t bytes, size_t alignment)
+    {
+        if (!IsPooled(bytes, alignment))
+            return ::operator new(bytes);
+
+        const size_t nIndex = FreeListIndex(bytes);
+        if (vFreeLists[nIndex]) {
+            FreeBlock* pBlock = vFreeLists[nIndex];
+            vFreeLists[nIndex] = pBlock->next;
+            return pBlock;
+        }
+        const size_t nRounded = nIndex * ALIGN_BYTES;
+        if ((size_t)(pAvailableEnd - pAvailableBegin) < nRounded)
+            AllocateChunk();
+        void* p = pAvailableBegin;
+        pAvailableBegin += nRounded;
+        return p;
+    }
+
+    void Deallocate(void* p, size_t bytes, size_t alignment) noexcept
+    {
+        if (!IsPooled(bytes, alignment)) {
+            ::operator delete(p);
+            return;
+        }
+        const size_t nIndex = FreeListIndex(bytes);
+        FreeBlock* pBlock = static_cast<FreeBlock*>(p);
+        pBlock->next = vFreeLists[nIndex];
+        vFreeLists[nIndex] = pBlock;
+    }
+
+    /** Bytes held in chunks, whether in use or free. */
+    size_t ChunkBytes() const { return nChunkBytes; }
+};
+
+/**
+ * Allocator that takes the nodes of a container from a shared PoolResource.
+ * The resource lives as long as any allocator, so a container moved
+ * elsewhere keeps its nodes valid. A default constructed allocator has no
+ * resource and uses the heap.
+ */
+template <typename T, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    PoolAllocator() noexcept {}
+    explicit PoolAllocator(std::shared_ptr<ResourceType> resource) noexcept : pResource(std::move(resource)) {}
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) noexcept : pResource(other.resource()) {}
+
+    T* allocate(size_t n)
+    {
+        if (n > std::numeric_limits<size_t>::max() / sizeof(T))
+            throw std::bad_alloc();
+        if (!pResource)
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        return static_cast<T*>(pResource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n) noexcept
+    {
+        if (!pResource)
+            ::operator delete(p);
+        else
+            pResource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    const std::shared_ptr<ResourceType>& resource() const noexcept { return pResource; }
+
+private:
+    std::shared_ptr<ResourceType> pResource;
+};
+
+template <typename T, typename U, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return a.resource() == b.resource();
+}
+
+template <typename T, typename U, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return !(a == b);
+}
+
+#endif // GENESIS_SUPPORT_ALLOCATORS_POOL_H
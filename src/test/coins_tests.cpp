@@ -8,6 +8,8 @@
 #include <undo.h>
 #include <utilstrencodings.h>
 #include <test/test_genesis.h>
+#include <txdb.h>
+#include <init.h>
 #include <validation.h>
 #include <consensus/validation.h>
 
@@ -18,6 +20,7 @@
 
 int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out);
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txundo, int nHeight);
+extern std::atomic<bool> fRequestShutdown;
 
 namespace
 {
@@ -855,4 +858,137 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_get_coins_duplicates)
+{
+    CCoinsViewTest base;
+    const COutPoint present(InsecureRand256(), 0);
+    const COutPoint absent(InsecureRand256(), 1);
+    const Coin coin(CTxOut(VALUE1, CScript() << OP_TRUE), 1, false);
+    {
+        CCoinsViewCacheTest parent(&base);
+        parent.AddCoin(present, Coin(coin), false);
+        parent.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(parent.Flush());
+    }
+
+    // Outpoints requested more than once are fetched and accounted once
+    CCoinsViewCacheTest cache(&base);
+    std::vector<Coin> coins;
+    std::vector<bool> found;
+    BOOST_CHECK_EQUAL(cache.GetCoins(std::vector<COutPoint>{present, absent, present, present}, coins, found), 3U);
+    BOOST_CHECK(found[0] && !found[1] && found[2] && found[3]);
+    BOOST_CHECK(coins[0] == coin && coins[2] == coin && coins[3] == coin);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1U);
+    cache.SelfTest();
+
+    // as are those already cached
+    BOOST_CHECK_EQUAL(cache.GetCoins(std::vector<COutPoint>{present, present}, coins, found), 2U);
+    cache.SelfTest();
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_map_pool_usage)
+{
+    const CTxOut txout(VALUE1, CScript() << OP_TRUE);
+    CCoinsMap heap;
+    CCoinsMap pooled(0, SaltedOutpointHasher(), std::equal_to<COutPoint>(), CCoinsMapAllocator(std::make_shared<CCoinsMapAllocator::ResourceType>()));
+    std::vector<COutPoint> outpoints;
+    for (uint32_t i = 0; i < 20000; i++) {
+        outpoints.emplace_back(InsecureRand256(), i);
+        heap.emplace(outpoints.back(), CCoinsCacheEntry(Coin(txout, 1, false)));
+        pooled.emplace(outpoints.back(), CCoinsCacheEntry(Coin(txout, 1, false)));
+    }
+    // The pool is accounted by its chunks, which hold more coins per byte
+    // than one malloc per node
+    BOOST_CHECK(memusage::DynamicUsage(pooled) < memusage::DynamicUsage(heap));
+
+    // Erased nodes are reused rather than growing the pool
+    const size_t nUsage = memusage::DynamicUsage(pooled);
+    for (size_t i = 0; i < 1000; i++)
+        pooled.erase(outpoints[i]);
+    for (size_t i = 0; i < 1000; i++)
+        BOOST_CHECK(pooled.emplace(outpoints[i], CCoinsCacheEntry(Coin(txout, 2, false))).second);
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(pooled), nUsage);
+    BOOST_CHECK_EQUAL(pooled.size(), outpoints.size());
+    BOOST_CHECK_EQUAL(pooled.at(outpoints[0]).coin.nHeight, 2U);
+
+    // A moved map keeps its pool
+    CCoinsMap moved(std::move(pooled));
+    BOOST_CHECK_EQUAL(moved.at(outpoints[1]).coin.nHeight, 2U);
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(moved), nUsage);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_background_flush)
+{
+    CCoinsViewDB db(1 << 20, true);
+    db.StartBackgroundFlush();
+
+    const COutPoint kept(InsecureRand256(), 0);
+    const COutPoint spent(InsecureRand256(), 1);
+    const Coin coin(CTxOut(VALUE1, CScript() << OP_TRUE), 1, false);
+    const uint256 hash1 = InsecureRand256();
+    const uint256 hash2 = InsecureRand256();
+
+    CCoinsViewCache cache(&db);
+    cache.AddCoin(kept, Coin(coin), false);
+    cache.AddCoin(spent, Coin(coin), false);
+    cache.SetBestBlock(hash1);
+    BOOST_CHECK(cache.Flush());
+    // Whether or not the write has finished, the view is the same
+    Coin out;
+    BOOST_CHECK(db.GetCoin(kept, out) && out == coin);
+    BOOST_CHECK(db.GetBestBlock() == hash1);
+
+    // The next generation waits for the first and overrides it
+    cache.SpendCoin(spent);
+    cache.SetBestBlock(hash2);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!db.HaveCoin(spent));
+    std::vector<Coin> coins;
+    std::vector<bool> found;
+    BOOST_CHECK_EQUAL(db.GetCoins(std::vector<COutPoint>{kept, spent}, coins, found), 1U);
+    BOOST_CHECK(found[0] && coins[0] == coin && !found[1]);
+
+    BOOST_CHECK(db.WaitForFlush());
+    BOOST_CHECK(db.GetBestBlock() == hash2);
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+    db.StopBackgroundFlush();
+    BOOST_CHECK(db.GetCoin(kept, out) && out == coin);
+    BOOST_CHECK(!db.HaveCoin(spent));
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_background_flush_failure)
+{
+    CCoinsViewDB db(1 << 20, true);
+    db.StartBackgroundFlush();
+
+    const COutPoint outpoint(InsecureRand256(), 0);
+    const Coin coin(CTxOut(VALUE1, CScript() << OP_TRUE), 1, false);
+    const uint256 hash1 = InsecureRand256();
+
+    CCoinsViewCache cache(&db);
+    cache.AddCoin(outpoint, Coin(coin), false);
+    cache.SetBestBlock(hash1);
+    gArgs.ForceSetArg("-dbwritefailure", "1");
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!db.WaitForFlush());
+    gArgs.ForceSetArg("-dbwritefailure", "0");
+    BOOST_CHECK(ShutdownRequested());
+
+    // The generation that failed to reach the database is still read
+    Coin out;
+    BOOST_CHECK(db.GetCoin(outpoint, out) && out == coin);
+    BOOST_CHECK(db.HaveCoin(outpoint));
+    BOOST_CHECK(db.GetBestBlock() == hash1);
+
+    // and nothing more is written on top of it, even synchronously
+    cache.SetBestBlock(InsecureRand256());
+    BOOST_CHECK(!cache.Flush());
+    db.StopBackgroundFlush();
+    BOOST_CHECK(!cache.Flush());
+    BOOST_CHECK(db.GetCoin(outpoint, out) && out == coin);
+    BOOST_CHECK(db.GetBestBlock() == hash1);
+
+    fRequestShutdown = false;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <crypto/aes.h>
+#include <crypto/blake2b.h>
 #include <crypto/chacha20.h>
 #include <crypto/ripemd160.h>
 #include <crypto/sha1.h>
@@ -524,6 +525,44 @@ BOOST_AUTO_TEST_CASE(chacha20_testvector)
                  "fab78c9");
 }
 
+BOOST_AUTO_TEST_CASE(blake2b_lanes_tests)
+{
+    // Multi-lane finalization must agree with libsodium for every prefix
+    // length it accepts, and may only refuse a trailing word that would
+    // straddle two blocks.
+    FastRandomContext ctx(true);
+    unsigned char personalization[crypto_generichash_blake2b_PERSONALBYTES] = {};
+    memcpy(personalization, "GENX_PoW", 8);
+    std::vector<unsigned char> input = ctx.randbytes(400);
+    for (size_t prefixLen = 0; prefixLen <= input.size(); prefixLen++) {
+        crypto_generichash_blake2b_state state;
+        crypto_generichash_blake2b_init_salt_personal(&state, NULL, 0, 48, NULL, personalization);
+        crypto_generichash_blake2b_update(&state, input.data(), prefixLen);
+
+        CBlake2bLanes lanes;
+        if (!Blake2bPrepareLanes(state, lanes)) {
+            size_t buffered = prefixLen <= 256 ? prefixLen : (prefixLen - 129) % 128 + 129;
+            BOOST_CHECK(buffered % 128 > 124);
+            continue;
+        }
+        uint32_t suffix[BLAKE2B_LANES];
+        for (size_t lane = 0; lane < BLAKE2B_LANES; lane++) {
+            suffix[lane] = ctx.rand32();
+        }
+        unsigned char out[BLAKE2B_LANES][48];
+        Blake2bFinalizeLanes(lanes, suffix, out[0], sizeof(out[0]));
+        for (size_t lane = 0; lane < BLAKE2B_LANES; lane++) {
+            crypto_generichash_blake2b_state laneState = state;
+            unsigned char leb[4];
+            WriteLE32(leb, suffix[lane]);
+            crypto_generichash_blake2b_update(&laneState, leb, sizeof(leb));
+            unsigned char expected[48];
+            crypto_generichash_blake2b_final(&laneState, expected, sizeof(expected));
+            BOOST_CHECK(memcmp(out[lane], expected, sizeof(expected)) == 0);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(countbits_tests)
 {
     FastRandomContext ctx;
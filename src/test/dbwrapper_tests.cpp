@@ -79,6 +79,37 @@ BOOST_AUTO_TEST_CASE(dbwrapper_batch)
     }
 }
 
+// Test reading many keys at once
+BOOST_AUTO_TEST_CASE(dbwrapper_readmany)
+{
+    for (bool obfuscate : {false, true}) {
+        fs::path ph = fs::temp_directory_path() / fs::unique_path();
+        CDBWrapper dbw(ph, (1 << 20), true, false, obfuscate, false, 64, 2 << 20);
+
+        // Even keys are present
+        std::vector<uint256> in(10);
+        for (uint32_t i = 0; i < 10; i += 2) {
+            in[i] = InsecureRand256();
+            BOOST_CHECK(dbw.Write(std::make_pair('m', i), in[i]));
+        }
+
+        // Unsorted, with a repeat and a key past the end
+        std::vector<std::pair<char, uint32_t> > keys;
+        for (uint32_t i : {7, 4, 0, 9, 4, 8, 3, 20})
+            keys.push_back(std::make_pair('m', i));
+        std::vector<uint256> values;
+        std::vector<bool> found;
+        BOOST_CHECK_EQUAL(dbw.ReadMany(keys, values, found), 4U);
+        BOOST_REQUIRE_EQUAL(values.size(), keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            const uint32_t n = keys[i].second;
+            BOOST_CHECK_EQUAL(found[i], n < 10 && n % 2 == 0);
+            if (found[i])
+                BOOST_CHECK(values[i] == in[n]);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(dbwrapper_iterator)
 {
     // Perform tests both obfuscated and non-obfuscated.
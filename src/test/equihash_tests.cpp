@@ -10,6 +10,7 @@
 #include <arith_uint256.h>
 #include <crypto/sha256.h>
 #include <crypto/equihash/equihash.h>
+#include <miner.h>
 #include <test/test_genesis.h>
 #include <uint256.h>
 
@@ -47,7 +48,7 @@ void PrintSolutions(std::stringstream &strm, std::set<std::vector<uint32_t>> sol
 void TestEquihashSolvers(unsigned int n, unsigned int k, const std::string &I, const arith_uint256 &nonce, const std::set<std::vector<uint32_t>> &solns) {
     size_t cBitLen { n/(k+1) };
     crypto_generichash_blake2b_state state;
-    EhInitialiseState(n, k, state);
+    EhInitialiseState(n, k, state, "ZcashPoW");
     uint256 V = ArithToUint256(nonce);
     BOOST_TEST_MESSAGE("Running solver: n = " << n << ", k = " << k << ", I = " << I << ", V = " << V.GetHex());
     crypto_generichash_blake2b_update(&state, (unsigned char*)&I[0], I.size());
@@ -81,12 +82,38 @@ void TestEquihashSolvers(unsigned int n, unsigned int k, const std::string &I, c
     BOOST_TEST_MESSAGE(strm.str());
     BOOST_CHECK(retOpt == solns);
     BOOST_CHECK(retOpt == ret);
+
+    // Grouping rows by a radix sort must not change the result of either
+    std::set<std::vector<uint32_t>> retRadix;
+    std::function<bool(std::vector<unsigned char>)> validBlockRadix =
+            [&retRadix, cBitLen](std::vector<unsigned char> soln) {
+        retRadix.insert(GetIndicesFromMinimal(soln, cBitLen));
+        return false;
+    };
+    std::function<bool(EhSolverCancelCheck)> notCancelled = [](EhSolverCancelCheck pos) { return false; };
+    EhBasicSolve(n, k, state, validBlockRadix, notCancelled, true);
+    BOOST_CHECK(retRadix == solns);
+    retRadix.clear();
+    EhOptimisedSolve(n, k, state, validBlockRadix, notCancelled, true);
+    BOOST_CHECK(retRadix == solns);
+
+    // So should the solver picked for generate, whichever backend it is
+    std::unique_ptr<CEquihashSolver> solver = MakeEquihashSolver(DEFAULT_EQUIHASH_SOLVER, n, k, 1, false);
+    BOOST_CHECK_EQUAL(solver->GetName(), CTrompSolver::Supports(n, k) ? "tromp" : "radix");
+    std::set<std::vector<uint32_t>> retSolver;
+    std::function<bool(std::vector<unsigned char>)> validBlockSolver =
+            [&retSolver, cBitLen](std::vector<unsigned char> soln) {
+        retSolver.insert(GetIndicesFromMinimal(soln, cBitLen));
+        return false;
+    };
+    BOOST_CHECK(!solver->Solve(state, validBlockSolver, notCancelled));
+    BOOST_CHECK(retSolver == solns);
 }
 
 void TestEquihashValidator(unsigned int n, unsigned int k, const std::string &I, const arith_uint256 &nonce, std::vector<uint32_t> soln, bool expected) {
     size_t cBitLen { n/(k+1) };
     crypto_generichash_blake2b_state state;
-    EhInitialiseState(n, k, state);
+    EhInitialiseState(n, k, state, "ZcashPoW");
     uint256 V = ArithToUint256(nonce);
     crypto_generichash_blake2b_update(&state, (unsigned char*)&I[0], I.size());
     crypto_generichash_blake2b_update(&state, V.begin(), V.size());
@@ -94,9 +121,21 @@ void TestEquihashValidator(unsigned int n, unsigned int k, const std::string &I,
     std::stringstream strm;
     PrintSolution(strm, soln);
     BOOST_TEST_MESSAGE(strm.str());
+    std::vector<unsigned char> minimal = GetMinimalFromIndices(soln, cBitLen);
     bool isValid;
-    EhIsValidSolution(n, k, state, GetMinimalFromIndices(soln, cBitLen), isValid);
+    EhIsValidSolution(n, k, state, minimal, isValid);
     BOOST_CHECK(isValid == expected);
+
+    // The allocation-free verifier must agree with the generic one
+    bool isValidFlat;
+    if (n == 96 && k == 5) {
+        isValidFlat = EquihashFlatVerifier<96,5>::IsValidSolution(state, minimal);
+    } else if (n == 192 && k == 7) {
+        isValidFlat = EquihashFlatVerifier<192,7>::IsValidSolution(state, minimal);
+    } else {
+        BOOST_FAIL("No flat verifier test coverage for these parameters");
+    }
+    BOOST_CHECK(isValidFlat == expected);
 }
 
 BOOST_AUTO_TEST_CASE(solver_testvectors) {
@@ -195,4 +234,27 @@ BOOST_AUTO_TEST_CASE(validator_testvectors) {
                 false);
 }
 
+BOOST_AUTO_TEST_CASE(validator_testvectors_192_7) {
+    // Original valid solution
+    TestEquihashValidator(192, 7, "block header", 0,
+  {353065, 2285352, 4052508, 32655279, 6425581, 32444613, 11132334, 32174742, 1135535, 1316591, 23575676, 26779278, 3404916, 6475039, 4315308, 15597112, 2911760, 3597648, 6759030, 15705381, 12459724, 14440020, 16882312, 21906755, 3174661, 27129465, 16129659, 22569540, 5259078, 18094614, 8875400, 24205139, 1662164, 7798741, 3796814, 15097811, 10728390, 15172164, 20355177, 24922893, 6050103, 20366309, 7218096, 14000079, 9088775, 25231591, 25186474, 29732788, 3135313, 27598632, 8899269, 18785720, 4414764, 7125615, 22658132, 30291704, 3407605, 15188295, 14929059, 30950311, 6466754, 18719699, 24328060, 26788476, 1115940, 8131871, 9361851, 28340399, 7257918, 25865082, 16370709, 30428733, 3091180, 18383070, 13024176, 24377951, 22057650, 31381175, 25115753, 31981131, 2334876, 6957228, 12340546, 23797569, 4771942, 18608409, 6551777, 6819468, 15223536, 21196245, 22012611, 33005471, 20158855, 26160192, 23145498, 31773052, 1391533, 14963314, 5401887, 20882073, 2386662, 17935048, 7734547, 17638475, 2839963, 8337948, 10708122, 16330796, 3838556, 6859962, 10041123, 26920400, 2148757, 4216446, 10803691, 20931676, 8576127, 15336351, 26438321, 29074181, 2760402, 20900170, 17838362, 23109679, 3109494, 25230412, 9248884, 28642724},
+                true);
+    // Change one index
+    TestEquihashValidator(192, 7, "block header", 0,
+  {353066, 2285352, 4052508, 32655279, 6425581, 32444613, 11132334, 32174742, 1135535, 1316591, 23575676, 26779278, 3404916, 6475039, 4315308, 15597112, 2911760, 3597648, 6759030, 15705381, 12459724, 14440020, 16882312, 21906755, 3174661, 27129465, 16129659, 22569540, 5259078, 18094614, 8875400, 24205139, 1662164, 7798741, 3796814, 15097811, 10728390, 15172164, 20355177, 24922893, 6050103, 20366309, 7218096, 14000079, 9088775, 25231591, 25186474, 29732788, 3135313, 27598632, 8899269, 18785720, 4414764, 7125615, 22658132, 30291704, 3407605, 15188295, 14929059, 30950311, 6466754, 18719699, 24328060, 26788476, 1115940, 8131871, 9361851, 28340399, 7257918, 25865082, 16370709, 30428733, 3091180, 18383070, 13024176, 24377951, 22057650, 31381175, 25115753, 31981131, 2334876, 6957228, 12340546, 23797569, 4771942, 18608409, 6551777, 6819468, 15223536, 21196245, 22012611, 33005471, 20158855, 26160192, 23145498, 31773052, 1391533, 14963314, 5401887, 20882073, 2386662, 17935048, 7734547, 17638475, 2839963, 8337948, 10708122, 16330796, 3838556, 6859962, 10041123, 26920400, 2148757, 4216446, 10803691, 20931676, 8576127, 15336351, 26438321, 29074181, 2760402, 20900170, 17838362, 23109679, 3109494, 25230412, 9248884, 28642724},
+                false);
+    // Reverse the first pair of indices
+    TestEquihashValidator(192, 7, "block header", 0,
+  {2285352, 353065, 4052508, 32655279, 6425581, 32444613, 11132334, 32174742, 1135535, 1316591, 23575676, 26779278, 3404916, 6475039, 4315308, 15597112, 2911760, 3597648, 6759030, 15705381, 12459724, 14440020, 16882312, 21906755, 3174661, 27129465, 16129659, 22569540, 5259078, 18094614, 8875400, 24205139, 1662164, 7798741, 3796814, 15097811, 10728390, 15172164, 20355177, 24922893, 6050103, 20366309, 7218096, 14000079, 9088775, 25231591, 25186474, 29732788, 3135313, 27598632, 8899269, 18785720, 4414764, 7125615, 22658132, 30291704, 3407605, 15188295, 14929059, 30950311, 6466754, 18719699, 24328060, 26788476, 1115940, 8131871, 9361851, 28340399, 7257918, 25865082, 16370709, 30428733, 3091180, 18383070, 13024176, 24377951, 22057650, 31381175, 25115753, 31981131, 2334876, 6957228, 12340546, 23797569, 4771942, 18608409, 6551777, 6819468, 15223536, 21196245, 22012611, 33005471, 20158855, 26160192, 23145498, 31773052, 1391533, 14963314, 5401887, 20882073, 2386662, 17935048, 7734547, 17638475, 2839963, 8337948, 10708122, 16330796, 3838556, 6859962, 10041123, 26920400, 2148757, 4216446, 10803691, 20931676, 8576127, 15336351, 26438321, 29074181, 2760402, 20900170, 17838362, 23109679, 3109494, 25230412, 9248884, 28642724},
+                false);
+    // Swap the first half and second half
+    TestEquihashValidator(192, 7, "block header", 0,
+  {1115940, 8131871, 9361851, 28340399, 7257918, 25865082, 16370709, 30428733, 3091180, 18383070, 13024176, 24377951, 22057650, 31381175, 25115753, 31981131, 2334876, 6957228, 12340546, 23797569, 4771942, 18608409, 6551777, 6819468, 15223536, 21196245, 22012611, 33005471, 20158855, 26160192, 23145498, 31773052, 1391533, 14963314, 5401887, 20882073, 2386662, 17935048, 7734547, 17638475, 2839963, 8337948, 10708122, 16330796, 3838556, 6859962, 10041123, 26920400, 2148757, 4216446, 10803691, 20931676, 8576127, 15336351, 26438321, 29074181, 2760402, 20900170, 17838362, 23109679, 3109494, 25230412, 9248884, 28642724, 353065, 2285352, 4052508, 32655279, 6425581, 32444613, 11132334, 32174742, 1135535, 1316591, 23575676, 26779278, 3404916, 6475039, 4315308, 15597112, 2911760, 3597648, 6759030, 15705381, 12459724, 14440020, 16882312, 21906755, 3174661, 27129465, 16129659, 22569540, 5259078, 18094614, 8875400, 24205139, 1662164, 7798741, 3796814, 15097811, 10728390, 15172164, 20355177, 24922893, 6050103, 20366309, 7218096, 14000079, 9088775, 25231591, 25186474, 29732788, 3135313, 27598632, 8899269, 18785720, 4414764, 7125615, 22658132, 30291704, 3407605, 15188295, 14929059, 30950311, 6466754, 18719699, 24328060, 26788476},
+                false);
+    // Duplicate first half
+    TestEquihashValidator(192, 7, "block header", 0,
+  {353065, 2285352, 4052508, 32655279, 6425581, 32444613, 11132334, 32174742, 1135535, 1316591, 23575676, 26779278, 3404916, 6475039, 4315308, 15597112, 2911760, 3597648, 6759030, 15705381, 12459724, 14440020, 16882312, 21906755, 3174661, 27129465, 16129659, 22569540, 5259078, 18094614, 8875400, 24205139, 1662164, 7798741, 3796814, 15097811, 10728390, 15172164, 20355177, 24922893, 6050103, 20366309, 7218096, 14000079, 9088775, 25231591, 25186474, 29732788, 3135313, 27598632, 8899269, 18785720, 4414764, 7125615, 22658132, 30291704, 3407605, 15188295, 14929059, 30950311, 6466754, 18719699, 24328060, 26788476, 353065, 2285352, 4052508, 32655279, 6425581, 32444613, 11132334, 32174742, 1135535, 1316591, 23575676, 26779278, 3404916, 6475039, 4315308, 15597112, 2911760, 3597648, 6759030, 15705381, 12459724, 14440020, 16882312, 21906755, 3174661, 27129465, 16129659, 22569540, 5259078, 18094614, 8875400, 24205139, 1662164, 7798741, 3796814, 15097811, 10728390, 15172164, 20355177, 24922893, 6050103, 20366309, 7218096, 14000079, 9088775, 25231591, 25186474, 29732788, 3135313, 27598632, 8899269, 18785720, 4414764, 7125615, 22658132, 30291704, 3407605, 15188295, 14929059, 30950311, 6466754, 18719699, 24328060, 26788476},
+                false);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
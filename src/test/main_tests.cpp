@@ -2,7 +2,10 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <arith_uint256.h>
+#include <blocktimeindex.h>
 #include <chainparams.h>
+#include <txdb.h>
 #include <validation.h>
 #include <net.h>
 
@@ -61,6 +64,318 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
 bool ReturnFalse() { return false; }
 bool ReturnTrue() { return true; }
 
+BOOST_AUTO_TEST_CASE(block_index_solution_trim)
+{
+    LOCK(cs_main);
+    CBlockIndex* pindex = chainActive.Genesis();
+    BOOST_REQUIRE(pindex);
+    FlushStateToDisk();
+
+    // Once written, the index entry no longer holds the solution in memory...
+    BOOST_CHECK(!pindex->HasSolution());
+    // ...but reads it back from the block tree DB when needed.
+    std::vector<unsigned char> solution;
+    BOOST_CHECK(ReadBlockSolution(pindex, solution));
+    BOOST_CHECK(solution == Params().GenesisBlock().nSolution);
+    CBlockHeader header;
+    BOOST_CHECK(ReadBlockHeader(pindex, header));
+    BOOST_CHECK(header.GetHash() == pindex->GetBlockHash());
+    // Rewriting a trimmed entry keeps its solution.
+    int nLastFile = 0;
+    pblocktree->ReadLastBlockFile(nLastFile);
+    BOOST_CHECK(pblocktree->WriteBatchSync(std::vector<std::pair<int, const CBlockFileInfo*> >(), nLastFile, std::vector<const CBlockIndex*>(1, pindex)));
+    CDiskBlockIndex diskindex;
+    BOOST_CHECK(pblocktree->Read(std::make_pair('b', pindex->GetBlockHash()), diskindex));
+    BOOST_CHECK(diskindex.nSolution == Params().GenesisBlock().nSolution);
+
+    // Without a way to read it back, the header is unavailable rather than
+    // an exception
+    BOOST_CHECK(!pindex->GetBlockHeader(header, nullptr));
+    BOOST_CHECK(!pindex->GetSolution(solution, [](const uint256&, std::vector<unsigned char>&) { return false; }));
+}
+
+static bool WriteAddressIndex(CIndexDB& db, const std::vector<std::pair<CAddressIndexKey, CAmount> >& vect)
+{
+    CDBBatch batch(db);
+    db.WriteAddressIndex(batch, vect);
+    return db.WriteBatch(batch);
+}
+
+static bool EraseAddressIndex(CIndexDB& db, const std::vector<std::pair<CAddressIndexKey, CAmount> >& vect)
+{
+    CDBBatch batch(db);
+    db.EraseAddressIndex(batch, vect);
+    return db.WriteBatch(batch);
+}
+
+BOOST_AUTO_TEST_CASE(address_balance_records)
+{
+    CIndexDB db(1 << 20, true, false, false, 64, 2 << 20);
+    const uint160 address(ParseHex("0102030405060708090a0b0c0d0e0f1011121314"));
+    const uint256 tx1 = uint256S("01");
+    const uint256 tx2 = uint256S("02");
+
+    // Height 1: two outputs of one transaction pay the address
+    std::vector<std::pair<CAddressIndexKey, CAmount> > block1;
+    block1.push_back(std::make_pair(CAddressIndexKey(1, address, 1, 0, tx1, 0, false), 100));
+    block1.push_back(std::make_pair(CAddressIndexKey(1, address, 1, 0, tx1, 1, false), 50));
+    // Height 2: the first is spent, with change back to the address
+    std::vector<std::pair<CAddressIndexKey, CAmount> > block2;
+    block2.push_back(std::make_pair(CAddressIndexKey(1, address, 2, 1, tx2, 0, true), -100));
+    block2.push_back(std::make_pair(CAddressIndexKey(1, address, 2, 1, tx2, 0, false), 30));
+    BOOST_CHECK(WriteAddressIndex(db, block1));
+    BOOST_CHECK(WriteAddressIndex(db, block2));
+
+    CAddressBalanceValue value;
+    db.ReadAddressBalance(address, 1, value);
+    BOOST_CHECK_EQUAL(value.balance, 80);
+    BOOST_CHECK_EQUAL(value.received, 180);
+    BOOST_CHECK_EQUAL(value.txCount, 2);
+    BOOST_CHECK_EQUAL(value.firstHeight, 1);
+    BOOST_CHECK_EQUAL(value.lastHeight, 2);
+
+    // Connecting a block the record already covers changes nothing
+    BOOST_CHECK(WriteAddressIndex(db, block1));
+    db.ReadAddressBalance(address, 1, value);
+    BOOST_CHECK_EQUAL(value.balance, 80);
+
+    // A migration builds the same record from the entries
+    BOOST_CHECK(db.BuildAddressBalanceIndex());
+    db.ReadAddressBalance(address, 1, value);
+    BOOST_CHECK_EQUAL(value.balance, 80);
+    BOOST_CHECK_EQUAL(value.received, 180);
+    BOOST_CHECK_EQUAL(value.txCount, 2);
+    BOOST_CHECK_EQUAL(value.firstHeight, 1);
+    BOOST_CHECK_EQUAL(value.lastHeight, 2);
+
+    BOOST_CHECK(EraseAddressIndex(db, block2));
+    db.ReadAddressBalance(address, 1, value);
+    BOOST_CHECK_EQUAL(value.balance, 150);
+    BOOST_CHECK_EQUAL(value.received, 150);
+    BOOST_CHECK_EQUAL(value.txCount, 1);
+    BOOST_CHECK_EQUAL(value.lastHeight, 1);
+
+    BOOST_CHECK(EraseAddressIndex(db, block1));
+    db.ReadAddressBalance(address, 1, value);
+    BOOST_CHECK(value.IsNull());
+}
+
+BOOST_AUTO_TEST_CASE(address_index_pages)
+{
+    CIndexDB db(1 << 20, true, false, false, 64, 2 << 20);
+    const uint160 address(ParseHex("0102030405060708090a0b0c0d0e0f1011121314"));
+    const uint160 other(ParseHex("1413121110090807060504030201000f0e0d0c0b"));
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > entries;
+    for (int height = 1; height <= 5; height++) {
+        entries.push_back(std::make_pair(CAddressIndexKey(1, address, height, 0, ArithToUint256(height), 0, false), height));
+        entries.push_back(std::make_pair(CAddressIndexKey(1, other, height, 0, ArithToUint256(height), 1, false), height));
+    }
+    BOOST_CHECK(WriteAddressIndex(db, entries));
+
+    // Forward pages of two within heights 2..5
+    std::vector<std::pair<CAddressIndexKey, CAmount> > page;
+    CAddressIndexKey cursor;
+    BOOST_CHECK(db.ReadAddressIndexPage(address, 1, 2, 5, false, 2, cursor, page));
+    BOOST_CHECK_EQUAL(page.size(), 2U);
+    BOOST_CHECK_EQUAL(page[0].first.blockHeight, 2);
+    BOOST_CHECK_EQUAL(page[1].first.blockHeight, 3);
+    BOOST_CHECK(!cursor.IsNull());
+    page.clear();
+    BOOST_CHECK(db.ReadAddressIndexPage(address, 1, 2, 5, false, 2, cursor, page));
+    BOOST_CHECK_EQUAL(page.size(), 2U);
+    BOOST_CHECK_EQUAL(page[0].first.blockHeight, 4);
+    BOOST_CHECK_EQUAL(page[1].first.blockHeight, 5);
+    BOOST_CHECK(cursor.IsNull());
+
+    // Newest first, without reading past the address
+    page.clear();
+    BOOST_CHECK(db.ReadAddressIndexPage(address, 1, 0, 0, true, 3, cursor, page));
+    BOOST_CHECK_EQUAL(page.size(), 3U);
+    BOOST_CHECK_EQUAL(page[0].first.blockHeight, 5);
+    BOOST_CHECK_EQUAL(page[2].first.blockHeight, 3);
+    BOOST_CHECK(!cursor.IsNull());
+    page.clear();
+    BOOST_CHECK(db.ReadAddressIndexPage(address, 1, 0, 0, true, 3, cursor, page));
+    BOOST_CHECK_EQUAL(page.size(), 2U);
+    BOOST_CHECK_EQUAL(page[0].first.blockHeight, 2);
+    BOOST_CHECK_EQUAL(page[1].first.blockHeight, 1);
+    BOOST_CHECK(page[1].first.hashBytes == address);
+    BOOST_CHECK(cursor.IsNull());
+}
+
+BOOST_AUTO_TEST_CASE(index_db_migration)
+{
+    CBlockTreeDB blocktree(1 << 20, true, false, false, 64, 2 << 20);
+    CIndexDB indexdb(1 << 20, true, false, false, 64, 2 << 20);
+    const CSpentIndexKey spentKey(uint256S("01"), 0);
+    const CSpentIndexValue spentValue(uint256S("02"), 1, 10, 50, 1, uint160());
+    const CLegacyAddressIndexKey addressKey(1, uint160(), 10, 0, uint256S("02"), 0, false);
+
+    // An older version wrote the indexes next to the block index
+    BOOST_CHECK(blocktree.Write(std::make_pair('p', spentKey), spentValue));
+    BOOST_CHECK(blocktree.Write(std::make_pair('a', addressKey), CAmount(50)));
+    BOOST_CHECK(blocktree.WriteFlag("addressindex", true));
+
+    BOOST_CHECK(indexdb.MigrateFromBlockTree(blocktree));
+    BOOST_CHECK(indexdb.Upgrade());
+    CSpentIndexKey key = spentKey;
+    CSpentIndexValue value;
+    BOOST_CHECK(indexdb.ReadSpentIndex(key, value));
+    BOOST_CHECK(value.txid == spentValue.txid);
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    BOOST_CHECK(indexdb.ReadAddressIndex(uint160(), 1, addressIndex));
+    BOOST_CHECK_EQUAL(addressIndex.size(), 1U);
+    BOOST_CHECK(!blocktree.Exists(std::make_pair('p', spentKey)));
+    BOOST_CHECK(!blocktree.Exists(std::make_pair('a', addressKey)));
+    // Block tree entries of its own stay
+    bool fAddressIndex = false;
+    BOOST_CHECK(blocktree.ReadFlag("addressindex", fAddressIndex) && fAddressIndex);
+}
+
+BOOST_AUTO_TEST_CASE(address_index_compact_format)
+{
+    // Sorted varints order like the numbers across all encoded lengths
+    const uint32_t values[] = {0, 0x7f, 0x80, 0x407f, 0x4080, 0x20407f, 0x204080, 0x1020407f, 0x10204080, 0xffffffff};
+    std::vector<unsigned char> prev;
+    for (uint32_t n : values) {
+        CDataStream ss(SER_DISK, 0);
+        WriteSortedVarInt(ss, n);
+        std::vector<unsigned char> encoded(ss.begin(), ss.end());
+        BOOST_CHECK(prev < encoded);
+        BOOST_CHECK_EQUAL(ReadSortedVarInt(ss), n);
+        BOOST_CHECK(ss.empty());
+        prev = encoded;
+    }
+
+    // Records written in the legacy format are rewritten on upgrade
+    CIndexDB db(1 << 20, true, false, false, 64, 2 << 20);
+    const uint160 address(ParseHex("0102030405060708090a0b0c0d0e0f1011121314"));
+    const CScript script = GetAddressScript(1, address);
+    BOOST_CHECK(script.IsPayToPublicKeyHash());
+    const CLegacyAddressIndexKey indexKey(1, address, 300, 2, uint256S("01"), 1, true);
+    const CLegacyAddressUnspentKey unspentKey(1, address, uint256S("02"), 3);
+    BOOST_CHECK(db.Write(std::make_pair('a', indexKey), CAmount(-12345)));
+    BOOST_CHECK(db.Write(std::make_pair('u', unspentKey), CLegacyAddressUnspentValue(500, script, 299)));
+    BOOST_CHECK(db.Upgrade());
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    BOOST_CHECK(db.ReadAddressIndex(address, 1, addressIndex));
+    BOOST_REQUIRE_EQUAL(addressIndex.size(), 1U);
+    BOOST_CHECK_EQUAL(addressIndex[0].first.blockHeight, 300);
+    BOOST_CHECK_EQUAL(addressIndex[0].first.txindex, 2U);
+    BOOST_CHECK(addressIndex[0].first.spending);
+    BOOST_CHECK_EQUAL(addressIndex[0].second, -12345);
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspent;
+    BOOST_CHECK(db.ReadAddressUnspentIndex(address, 1, unspent));
+    BOOST_REQUIRE_EQUAL(unspent.size(), 1U);
+    BOOST_CHECK_EQUAL(unspent[0].first.index, 3U);
+    BOOST_CHECK_EQUAL(unspent[0].second.satoshis, 500);
+    BOOST_CHECK_EQUAL(unspent[0].second.blockHeight, 299);
+    BOOST_CHECK(unspent[0].second.script == script);
+    BOOST_CHECK(!db.Exists(std::make_pair('a', indexKey)));
+    BOOST_CHECK(!db.Exists(std::make_pair('u', unspentKey)));
+}
+
+BOOST_AUTO_TEST_CASE(index_best_block)
+{
+    CIndexDB db(1 << 20, true, false, false, 64, 2 << 20);
+    const CSpentIndexKey spentKey(uint256S("01"), 0);
+    const CSpentIndexValue spentValue(uint256S("02"), 1, 10, 50, 1, uint160());
+    CBlockLocator locator;
+    BOOST_CHECK(!db.ReadBestBlock("spentindex", locator));
+
+    // Entries and best block go in one batch
+    CDBBatch batch(db);
+    db.UpdateSpentIndex(batch, std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >(1, std::make_pair(spentKey, spentValue)));
+    db.WriteBestBlock(batch, "spentindex", CBlockLocator(std::vector<uint256>(1, uint256S("03"))));
+    db.WriteBestBlock(batch, "timestampindex", CBlockLocator());
+    BOOST_CHECK(db.WriteBatch(batch));
+    BOOST_CHECK(db.ReadBestBlock("spentindex", locator));
+    BOOST_CHECK(locator.vHave[0] == uint256S("03"));
+    // A null best block means: build from genesis
+    BOOST_CHECK(db.ReadBestBlock("timestampindex", locator));
+    BOOST_CHECK(locator.IsNull());
+
+    // Switching an index off erases its entries and best block only
+    BOOST_CHECK(db.WipeIndex("spentindex"));
+    CSpentIndexKey key = spentKey;
+    CSpentIndexValue value;
+    BOOST_CHECK(!db.ReadSpentIndex(key, value));
+    BOOST_CHECK(!db.ReadBestBlock("spentindex", locator));
+    BOOST_CHECK(db.ReadBestBlock("timestampindex", locator));
+}
+
+namespace {
+class TestBlockTimeIndex : public CBlockTimeIndex
+{
+public:
+    using CBlockTimeIndex::BlockConnected;
+};
+} // namespace
+
+BOOST_AUTO_TEST_CASE(block_time_index)
+{
+    LOCK(cs_main);
+    CBlockIndex* pgenesis = chainActive.Genesis();
+    BOOST_REQUIRE(pgenesis);
+
+    // Block times 100, 90, 200, 200: logical times 100, 101, 200, 201
+    const unsigned int times[] = {100, 90, 200, 200};
+    std::vector<uint256> hashes(4);
+    std::vector<CBlockIndex> blocks(4);
+    for (int i = 0; i < 4; i++) {
+        hashes[i] = ArithToUint256(arith_uint256(i + 1));
+        blocks[i].phashBlock = &hashes[i];
+        blocks[i].pprev = i ? &blocks[i - 1] : pgenesis;
+        blocks[i].nHeight = i + 1;
+        blocks[i].nTime = times[i];
+    }
+    chainActive.SetTip(&blocks.back());
+
+    TestBlockTimeIndex index;
+    std::vector<std::pair<uint256, unsigned int> > result;
+    index.GetBlockHashes(201, 101, result);
+    BOOST_CHECK_EQUAL(result.size(), 2U);
+    BOOST_CHECK(result[0].first == hashes[1]);
+    BOOST_CHECK_EQUAL(result[0].second, 101U);
+    BOOST_CHECK(result[1].first == hashes[2]);
+    BOOST_CHECK_EQUAL(result[1].second, 200U);
+
+    // The genesis block is never returned
+    result.clear();
+    index.GetBlockHashes(std::numeric_limits<unsigned int>::max(), 0, result);
+    BOOST_CHECK_EQUAL(result.size(), 4U);
+    BOOST_CHECK_EQUAL(result.back().second, 201U);
+
+    result.clear();
+    index.GetBlockHashes(100, 0, result);
+    BOOST_CHECK(result.empty());
+
+    // A stale notification of a block on another branch is not grafted onto
+    // the active chain at its height
+    uint256 hashStale = ArithToUint256(arith_uint256(5));
+    CBlockIndex stale;
+    stale.phashBlock = &hashStale;
+    stale.pprev = pgenesis;
+    stale.nHeight = 1;
+    stale.nTime = 300;
+    uint256 hashStaleChild = ArithToUint256(arith_uint256(6));
+    CBlockIndex staleChild;
+    staleChild.phashBlock = &hashStaleChild;
+    staleChild.pprev = &stale;
+    staleChild.nHeight = 2;
+    staleChild.nTime = 50;
+    index.BlockConnected(nullptr, &staleChild, std::vector<CTransactionRef>());
+    result.clear();
+    index.GetBlockHashes(std::numeric_limits<unsigned int>::max(), 0, result);
+    BOOST_CHECK_EQUAL(result.size(), 4U);
+    BOOST_CHECK(result[1].first == hashes[1]);
+    BOOST_CHECK_EQUAL(result[1].second, 101U);
+
+    chainActive.SetTip(pgenesis);
+}
+
 BOOST_AUTO_TEST_CASE(test_combiner_all)
 {
     boost::signals2::signal<bool (), CombinerAll> Test;
@@ -2,14 +2,18 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <mempoolindex.h>
 #include <policy/policy.h>
 #include <txmempool.h>
 #include <util.h>
+#include <utilstrencodings.h>
 
 #include <test/test_genesis.h>
 
 #include <boost/test/unit_test.hpp>
+#include <atomic>
 #include <list>
+#include <thread>
 #include <vector>
 
 BOOST_FIXTURE_TEST_SUITE(mempool_tests, TestingSetup)
@@ -571,4 +575,100 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAddressSpentIndexTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+    CCoinsView base;
+    CCoinsViewCache view(&base);
+
+    const uint160 keyHash = uint160(ParseHex("0102030405060708090a0b0c0d0e0f1011121314"));
+    const uint160 scriptHash = uint160(ParseHex("1413121110090807060504030201000f0e0d0c0b"));
+
+    COutPoint prevout(InsecureRand256(), 1);
+    CTxOut coin(50000LL, CScript() << OP_DUP << OP_HASH160 << ToByteVector(keyHash) << OP_EQUALVERIFY << OP_CHECKSIG);
+    view.AddCoin(prevout, Coin(coin, 1, false), false);
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = prevout;
+    tx.vout.resize(2);
+    tx.vout[0].scriptPubKey = CScript() << OP_HASH160 << ToByteVector(scriptHash) << OP_EQUAL;
+    tx.vout[0].nValue = 40000LL;
+    tx.vout[1].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx.vout[1].nValue = 9000LL;
+    const uint256 txhash = tx.GetHash();
+
+    CTxMemPoolEntry poolEntry = entry.Time(42).FromTx(tx);
+    pool.addUnchecked(txhash, poolEntry);
+    pool.addAddressIndex(poolEntry, view);
+    pool.addSpentIndex(poolEntry, view);
+
+    std::vector<std::pair<uint160, int> > addresses;
+    addresses.push_back(std::make_pair(keyHash, 1));
+    addresses.push_back(std::make_pair(scriptHash, 2));
+    addresses.push_back(std::make_pair(keyHash, 2));
+    std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > results;
+    BOOST_CHECK(pool.getAddressIndex(addresses, results));
+    BOOST_CHECK_EQUAL(results.size(), 2U);
+    BOOST_CHECK(results[0].first.txhash == txhash);
+    BOOST_CHECK_EQUAL(results[0].first.spending, 1);
+    BOOST_CHECK_EQUAL(results[0].second.amount, -50000LL);
+    BOOST_CHECK(results[0].second.prevhash == prevout.hash);
+    BOOST_CHECK_EQUAL(results[0].second.prevout, 1U);
+    BOOST_CHECK_EQUAL(results[1].first.type, 2);
+    BOOST_CHECK(results[1].first.addressBytes == scriptHash);
+    BOOST_CHECK_EQUAL(results[1].first.index, 0U);
+    BOOST_CHECK_EQUAL(results[1].second.amount, 40000LL);
+    BOOST_CHECK_EQUAL(results[1].second.time, 42);
+
+    CSpentIndexValue value;
+    BOOST_CHECK(pool.getSpentIndex(CSpentIndexKey(prevout.hash, prevout.n), value));
+    BOOST_CHECK(value.txid == txhash);
+    BOOST_CHECK_EQUAL(value.inputIndex, 0U);
+    BOOST_CHECK_EQUAL(value.blockHeight, -1);
+    BOOST_CHECK_EQUAL(value.satoshis, 50000LL);
+    BOOST_CHECK_EQUAL(value.addressType, 1);
+    BOOST_CHECK(value.addressHash == keyHash);
+    BOOST_CHECK(!pool.getSpentIndex(CSpentIndexKey(prevout.hash, 0), value));
+
+    pool.removeRecursive(tx);
+    results.clear();
+    pool.getAddressIndex(addresses, results);
+    BOOST_CHECK(results.empty());
+    BOOST_CHECK(!pool.getSpentIndex(CSpentIndexKey(prevout.hash, prevout.n), value));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolAddressIndexSnapshotTest)
+{
+    // A reader sees all or none of the entries a transaction files under
+    // several addresses, while another thread adds and removes it
+    CMempoolAddressIndex index;
+    const uint256 txhash = InsecureRand256();
+    std::vector<std::pair<uint160, int> > addresses;
+    std::vector<CMempoolAddressIndex::Entry> entries;
+    for (int i = 0; i < 8; i++) {
+        const uint160 hash = uint160(ParseHex(strprintf("%040x", i + 1)));
+        addresses.push_back(std::make_pair(hash, 1));
+        entries.push_back(std::make_pair(CMempoolAddressDeltaKey(1, hash, txhash, i, 0), CMempoolAddressDelta(0, 1000)));
+    }
+
+    std::atomic<bool> fDone(false);
+    std::thread writer([&] {
+        for (int i = 0; i < 2000; i++) {
+            index.Add(txhash, entries);
+            index.Remove(txhash);
+        }
+        fDone = true;
+    });
+    int nPartial = 0;
+    while (!fDone) {
+        std::vector<CMempoolAddressIndex::Entry> results;
+        index.Get(addresses, results);
+        nPartial += !results.empty() && results.size() != entries.size();
+    }
+    writer.join();
+    BOOST_CHECK_EQUAL(nPartial, 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
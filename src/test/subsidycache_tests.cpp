@@ -0,0 +1,200 @@
+// Copyright (c) 2018 The Genesis Official developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <subsidycache.h>
+
+#include <chain.h>
+#include <chainparams.h>
+#include <consensus/consensus.h>
+#include <primitives/block.h>
+#include <validation.h>
+#include <test/test_genesis.h>
+
+#include <deque>
+#include <map>
+#include <memory>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+class TestSubsidyCache : public CSubsidyCache
+{
+public:
+    using CSubsidyCache::BlockConnected;
+    using CSubsidyCache::BlockDisconnected;
+};
+
+/** Branches of blocks held only in memory, which chainActive can be pointed at */
+struct SubsidyCacheTestingSetup : public BasicTestingSetup {
+    struct Entry {
+        std::shared_ptr<const CBlock> block;
+        uint256 hash;
+        CBlockIndex index;
+    };
+    std::deque<Entry> entries;
+    std::map<const CBlockIndex*, std::shared_ptr<const CBlock>> mapBlock;
+    TestSubsidyCache cache;
+
+    ~SubsidyCacheTestingSetup()
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(nullptr);
+    }
+
+    /** Build nCount blocks on pindexPrev, or a new chain if it is null, and return the last */
+    CBlockIndex* Extend(CBlockIndex* pindexPrev, int nCount)
+    {
+        for (int i = 0; i < nCount; i++) {
+            CBlock block;
+            block.hashPrevBlock = pindexPrev ? pindexPrev->GetBlockHash() : uint256();
+            block.nNonce = InsecureRand256();
+            entries.emplace_back();
+            Entry& entry = entries.back();
+            entry.block = std::make_shared<const CBlock>(block);
+            entry.hash = block.GetHash();
+            entry.index.phashBlock = &entry.hash;
+            entry.index.pprev = pindexPrev;
+            entry.index.nHeight = pindexPrev ? pindexPrev->nHeight + 1 : 0;
+            entry.index.BuildSkip();
+            mapBlock[&entry.index] = entry.block;
+            pindexPrev = &entry.index;
+        }
+        return pindexPrev;
+    }
+
+    /** Make pindexNew the tip, without notifying the cache */
+    void SetTip(CBlockIndex* pindexNew)
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(pindexNew);
+    }
+
+    /** Notify the cache of a reorganization from pindexOld to pindexNew, as validation would */
+    void Notify(const CBlockIndex* pindexOld, const CBlockIndex* pindexNew)
+    {
+        const CBlockIndex* pindexFork = LastCommonAncestor(pindexOld, pindexNew);
+        for (const CBlockIndex* pindex = pindexOld; pindex != pindexFork; pindex = pindex->pprev)
+            cache.BlockDisconnected(mapBlock[pindex]);
+        std::vector<const CBlockIndex*> vConnect;
+        for (const CBlockIndex* pindex = pindexNew; pindex != pindexFork; pindex = pindex->pprev)
+            vConnect.push_back(pindex);
+        for (auto it = vConnect.rbegin(); it != vConnect.rend(); ++it)
+            cache.BlockConnected(mapBlock[*it], *it, std::vector<CTransactionRef>());
+    }
+
+    /** Check every subsidy the cache can determine against chainActive */
+    void CheckSubsidies()
+    {
+        int nHeight;
+        {
+            LOCK(cs_main);
+            nHeight = chainActive.Height();
+        }
+        std::vector<CAmount> vSubsidy;
+        BOOST_REQUIRE(cache.GetSubsidies(0, nHeight + COINBASE_MATURITY + 1, vSubsidy));
+        BOOST_REQUIRE_EQUAL(vSubsidy.size(), (size_t)nHeight + COINBASE_MATURITY + 1);
+        LOCK(cs_main);
+        int nMismatched = 0;
+        for (size_t i = 0; i < vSubsidy.size(); i++)
+            nMismatched += vSubsidy[i] != GetBlockSubsidy(i, Params().GetConsensus());
+        BOOST_CHECK_EQUAL(nMismatched, 0);
+    }
+};
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(subsidycache_tests, SubsidyCacheTestingSetup)
+
+BOOST_AUTO_TEST_CASE(subsidycache_range)
+{
+    SetTip(Extend(nullptr, 201));
+    CheckSubsidies();
+
+    // Heights up to COINBASE_MATURITY above the tip are determined
+    std::vector<CAmount> vSubsidy;
+    BOOST_CHECK(cache.GetSubsidies(300, 1, vSubsidy));
+    BOOST_CHECK_EQUAL(vSubsidy.size(), 1U);
+    BOOST_CHECK(!cache.GetSubsidies(301, 1, vSubsidy));
+    BOOST_CHECK(vSubsidy.empty());
+    BOOST_CHECK(!cache.GetSubsidies(0, 302, vSubsidy));
+    BOOST_CHECK(vSubsidy.empty());
+    BOOST_CHECK(!cache.GetSubsidies(-1, 1, vSubsidy));
+    BOOST_CHECK(!cache.GetSubsidies(0, -1, vSubsidy));
+    BOOST_CHECK(cache.GetSubsidies(10, 0, vSubsidy));
+    BOOST_CHECK(vSubsidy.empty());
+
+    CAmount nSubsidy;
+    BOOST_CHECK(cache.GetSubsidy(0, nSubsidy));
+    BOOST_CHECK_EQUAL(nSubsidy, 0);
+    BOOST_CHECK(cache.GetSubsidy(COINBASE_MATURITY, nSubsidy));
+    BOOST_CHECK_EQUAL(nSubsidy, BLOCK_REWARD_MAX * COIN);
+    BOOST_CHECK(cache.GetSubsidy(300, nSubsidy));
+    {
+        LOCK(cs_main);
+        BOOST_CHECK_EQUAL(nSubsidy, GetBlockSubsidy(300, Params().GetConsensus()));
+    }
+    BOOST_CHECK(!cache.GetSubsidy(301, nSubsidy));
+}
+
+BOOST_AUTO_TEST_CASE(subsidycache_connect_disconnect)
+{
+    CBlockIndex* pindexTip = Extend(nullptr, 201);
+    SetTip(pindexTip);
+    CheckSubsidies();
+
+    // Blocks connected one at a time
+    for (int i = 0; i < 5; i++) {
+        CBlockIndex* pindexNew = Extend(pindexTip, 1);
+        SetTip(pindexNew);
+        Notify(pindexTip, pindexNew);
+        pindexTip = pindexNew;
+        CheckSubsidies();
+    }
+
+    // A reorganization the notifications have not caught up with yet is
+    // still answered from the new chain, even over heights already cached
+    CBlockIndex* pindexFork = pindexTip->GetAncestor(pindexTip->nHeight - 20);
+    CBlockIndex* pindexNew = Extend(pindexFork, 20);
+    SetTip(pindexNew);
+    CheckSubsidies();
+    Notify(pindexTip, pindexNew);
+    CheckSubsidies();
+
+    // and back to a shorter branch, disconnecting only
+    SetTip(pindexFork);
+    Notify(pindexNew, pindexFork);
+    CheckSubsidies();
+
+    // Stale notifications arriving after the cache followed chainActive
+    pindexTip = Extend(pindexFork, 10);
+    SetTip(pindexTip);
+    CheckSubsidies();
+    Notify(pindexFork, pindexTip);
+    CheckSubsidies();
+}
+
+BOOST_AUTO_TEST_CASE(subsidycache_deep_reorg)
+{
+    const int nFork = 100;
+    const int nDepth = SUBSIDY_CACHE_REORG_DEPTH + 200;
+    CBlockIndex* pindexFork = Extend(nullptr, nFork + 1);
+    CBlockIndex* pindexOld = Extend(pindexFork, nDepth);
+    SetTip(pindexOld);
+    CheckSubsidies();
+
+    // Deeper than the confirmed hashes the cache keeps
+    CBlockIndex* pindexNew = Extend(pindexFork, nDepth + 10);
+    SetTip(pindexNew);
+    Notify(pindexOld, pindexNew);
+    CheckSubsidies();
+
+    // and back, with the notifications arriving after a lookup
+    SetTip(pindexOld);
+    CheckSubsidies();
+    Notify(pindexNew, pindexOld);
+    CheckSubsidies();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,7 @@
 #include <chainparams.h>
 #include <consensus/consensus.h>
 #include <consensus/validation.h>
+#include <crypto/blake2b.h>
 #include <crypto/sha256.h>
 #include <validation.h>
 #include <miner.h>
@@ -46,6 +47,7 @@ std::ostream& operator<<(std::ostream& os, const uint256& num)
 BasicTestingSetup::BasicTestingSetup(const std::string& chainName)
 {
         SHA256AutoDetect();
+        Blake2bAutoDetect();
         RandomInit();
         ECC_Start();
         SetupEnvironment();
@@ -81,7 +83,8 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
         GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
 
         mempool.setSanityCheck(1.0);
-        pblocktree.reset(new CBlockTreeDB(1 << 20, true));
+        pblocktree.reset(new CBlockTreeDB(1 << 20, true, false, DEFAULT_DB_COMPRESSION, DEFAULT_DB_MAX_OPEN_FILES, DEFAULT_DB_MAX_FILE_SIZE << 20));
+        pindexdb.reset(new CIndexDB(1 << 20, true, false, DEFAULT_DB_COMPRESSION, DEFAULT_DB_MAX_OPEN_FILES, DEFAULT_DB_MAX_FILE_SIZE << 20));
         pcoinsdbview.reset(new CCoinsViewDB(1 << 23, true));
         pcoinsTip.reset(new CCoinsViewCache(pcoinsdbview.get()));
         if (!LoadGenesisBlock(chainparams)) {
@@ -113,6 +116,7 @@ TestingSetup::~TestingSetup()
         pcoinsTip.reset();
         pcoinsdbview.reset();
         pblocktree.reset();
+        pindexdb.reset();
         fs::remove_all(pathTemp);
 }
 
@@ -0,0 +1,227 @@
+// Copyright (c) 2018 The Genesis Official developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <workserver.h>
+
+#include <arith_uint256.h>
+#include <chain.h>
+#include <chainparams.h>
+#include <compat.h>
+#include <crypto/common.h>
+#include <crypto/equihash/equihash.h>
+#include <netbase.h>
+#include <primitives/block.h>
+#include <streams.h>
+#include <utilstrencodings.h>
+#include <validation.h>
+#include <validationinterface.h>
+#include <version.h>
+#include <test/test_genesis.h>
+
+#include <univalue.h>
+
+#include <functional>
+
+#include <boost/test/unit_test.hpp>
+
+struct WorkServerTestingSetup : public TestingSetup {
+    WorkServerTestingSetup() : TestingSetup(CBaseChainParams::REGTEST) {}
+};
+
+/** A small blocking client speaking the work server's line-delimited JSON */
+class WorkServerTestClient
+{
+public:
+    explicit WorkServerTestClient(uint16_t nPort)
+    {
+        hSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        // Fail the test rather than hang if an expected message never comes
+        struct timeval timeout = {30, 0};
+        setsockopt(hSocket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+        struct sockaddr_in sin;
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        sin.sin_port = htons(nPort);
+        fConnected = connect(hSocket, (struct sockaddr*)&sin, sizeof(sin)) == 0;
+    }
+    ~WorkServerTestClient()
+    {
+        CloseSocket(hSocket);
+    }
+
+    bool fConnected;
+
+    void Request(int nId, const std::string& strMethod, const UniValue& params)
+    {
+        UniValue request(UniValue::VOBJ);
+        request.push_back(Pair("id", nId));
+        request.push_back(Pair("method", strMethod));
+        request.push_back(Pair("params", params));
+        const std::string strRequest = request.write() + "\n";
+        send(hSocket, strRequest.data(), strRequest.size(), 0);
+    }
+
+    /** The reply to request nId, skipping notifications */
+    UniValue ReadReply(int nId)
+    {
+        return ReadUntil([nId](const UniValue& msg) {
+            const UniValue& id = find_value(msg, "id");
+            return id.isNum() && id.get_int() == nId;
+        });
+    }
+
+    /** The params of the next notification strMethod */
+    UniValue ReadNotification(const std::string& strMethod)
+    {
+        return find_value(ReadUntil([&strMethod](const UniValue& msg) {
+            const UniValue& method = find_value(msg, "method");
+            return method.isStr() && method.get_str() == strMethod;
+        }), "params");
+    }
+
+private:
+    SOCKET hSocket;
+    std::string strBuffer;
+
+    UniValue ReadUntil(const std::function<bool(const UniValue&)>& match)
+    {
+        while (true) {
+            size_t nPos;
+            while ((nPos = strBuffer.find('\n')) == std::string::npos) {
+                char buf[4096];
+                const ssize_t nRead = recv(hSocket, buf, sizeof(buf), 0);
+                if (nRead <= 0)
+                    return NullUniValue;
+                strBuffer.append(buf, nRead);
+            }
+            UniValue msg;
+            const bool fParsed = msg.read(strBuffer.substr(0, nPos));
+            strBuffer.erase(0, nPos + 1);
+            if (fParsed && match(msg))
+                return msg;
+        }
+    }
+};
+
+/** Rebuild the Equihash input from the fields of a mining.notify, as a miner would */
+static CBlockHeader HeaderFromJob(const UniValue& job)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    for (size_t i = 1; i <= 6; i++) {
+        const std::vector<unsigned char> field = ParseHex(job[i].get_str());
+        ss.write((const char*)field.data(), field.size());
+    }
+    CBlockHeader header;
+    ss >> header.nVersion >> header.hashPrevBlock >> header.hashMerkleRoot >> header.hashReserved >> header.nTime >> header.nBits;
+    return header;
+}
+
+/** Search the nonces after nonce1 for a solution meeting the block target */
+static bool SolveJob(CBlockHeader& header, const std::vector<unsigned char>& nonce1)
+{
+    const CChainParams& chainparams = Params();
+    const unsigned int n = chainparams.EquihashN();
+    const unsigned int k = chainparams.EquihashK();
+    const arith_uint256 target = arith_uint256().SetCompact(header.nBits);
+    std::function<bool(std::vector<unsigned char>)> validBlock = [&header, &target](std::vector<unsigned char> soln) {
+        header.nSolution = soln;
+        return UintToArith256(header.GetHash()) <= target;
+    };
+    for (uint32_t nCounter = 0; nCounter < 1000; nCounter++) {
+        header.nNonce.SetNull();
+        std::copy(nonce1.begin(), nonce1.end(), header.nNonce.begin());
+        WriteLE32(header.nNonce.begin() + nonce1.size(), nCounter);
+
+        crypto_generichash_blake2b_state state;
+        EhInitialiseState(n, k, state, "GENX_PoW");
+        CEquihashInput I{header};
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << I << header.nNonce;
+        crypto_generichash_blake2b_update(&state, (unsigned char*)&ss[0], ss.size());
+        if (EhOptimisedSolveUncancellable(n, k, state, validBlock))
+            return true;
+    }
+    return false;
+}
+
+static UniValue Submission(const std::string& strJobId, const CBlockHeader& header)
+{
+    CDataStream ssTime(SER_NETWORK, PROTOCOL_VERSION), ssSolution(SER_NETWORK, PROTOCOL_VERSION);
+    ssTime << header.nTime;
+    ssSolution << header.nSolution;
+    UniValue params(UniValue::VARR);
+    params.push_back("worker");
+    params.push_back(strJobId);
+    params.push_back(HexStr(ssTime.begin(), ssTime.end()));
+    params.push_back(HexStr(header.nNonce.begin() + WORKSERVER_NONCE1_SIZE, header.nNonce.end()));
+    params.push_back(HexStr(ssSolution.begin(), ssSolution.end()));
+    return params;
+}
+
+static int ErrorCode(const UniValue& reply)
+{
+    const UniValue& error = find_value(reply, "error");
+    return error.isArray() && error.size() > 0 && error[0].isNum() ? error[0].get_int() : 0;
+}
+
+BOOST_FIXTURE_TEST_SUITE(workserver_tests, WorkServerTestingSetup)
+
+BOOST_AUTO_TEST_CASE(workserver_mine_block)
+{
+    // A late notification of the setup's tip would replace the first job
+    SyncWithValidationInterfaceQueue();
+    BOOST_REQUIRE(StartWorkServer(0, CScript() << OP_TRUE));
+    const uint16_t nPort = GetWorkServerPort();
+    BOOST_REQUIRE(nPort != 0);
+
+    WorkServerTestClient client(nPort);
+    BOOST_REQUIRE(client.fConnected);
+
+    // Nothing can be submitted before subscribing
+    client.Request(1, "mining.submit", UniValue(UniValue::VARR));
+    BOOST_CHECK_EQUAL(ErrorCode(client.ReadReply(1)), 25);
+
+    client.Request(2, "mining.subscribe", UniValue(UniValue::VARR));
+    const UniValue subscribed = find_value(client.ReadReply(2), "result");
+    BOOST_REQUIRE(subscribed.isArray() && subscribed.size() == 2);
+    const std::vector<unsigned char> nonce1 = ParseHex(subscribed[1].get_str());
+    BOOST_CHECK_EQUAL(nonce1.size(), WORKSERVER_NONCE1_SIZE);
+
+    const UniValue job = client.ReadNotification("mining.notify");
+    BOOST_REQUIRE(job.isArray() && job.size() == 8);
+    BOOST_CHECK(job[7].get_bool());
+    CBlockHeader header = HeaderFromJob(job);
+    BOOST_CHECK(header.hashPrevBlock == chainActive.Tip()->GetBlockHash());
+
+    // Unknown jobs and invalid solutions are refused
+    client.Request(3, "mining.submit", Submission("ffffffff", header));
+    BOOST_CHECK_EQUAL(ErrorCode(client.ReadReply(3)), 21);
+    client.Request(4, "mining.submit", Submission(job[0].get_str(), header));
+    BOOST_CHECK_EQUAL(ErrorCode(client.ReadReply(4)), 20);
+
+    BOOST_REQUIRE(SolveJob(header, nonce1));
+    client.Request(5, "mining.submit", Submission(job[0].get_str(), header));
+    const UniValue accepted = client.ReadReply(5);
+    BOOST_CHECK(find_value(accepted, "result").isTrue());
+    BOOST_CHECK(find_value(accepted, "error").isNull());
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == header.GetHash());
+    }
+
+    // The new tip replaces every job
+    const UniValue next = client.ReadNotification("mining.notify");
+    BOOST_REQUIRE(next.isArray() && next.size() == 8);
+    BOOST_CHECK(next[7].get_bool());
+    BOOST_CHECK(HeaderFromJob(next).hashPrevBlock == header.GetHash());
+    client.Request(6, "mining.submit", Submission(job[0].get_str(), header));
+    BOOST_CHECK_EQUAL(ErrorCode(client.ReadReply(6)), 21);
+
+    InterruptWorkServer();
+    StopWorkServer();
+    BOOST_CHECK_EQUAL(GetWorkServerPort(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
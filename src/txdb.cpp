@@ -16,6 +16,11 @@
 #include <validation.h>
 
 #include <stdint.h>
+#include <string.h>
+
+#include <functional>
+#include <limits>
+#include <set>
 
 #include <boost/thread.hpp>
 
@@ -23,8 +28,11 @@ static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
-static const char DB_ADDRESSINDEX = 'a';
-static const char DB_ADDRESSUNSPENTINDEX = 'u';
+static const char DB_ADDRESSINDEX = 'd';
+static const char DB_ADDRESSUNSPENTINDEX = 'o';
+static const char DB_ADDRESSINDEX_LEGACY = 'a';
+static const char DB_ADDRESSUNSPENTINDEX_LEGACY = 'u';
+static const char DB_ADDRESSBALANCE = 'A';
 static const char DB_TIMESTAMPINDEX = 's';
 static const char DB_BLOCKHASHINDEX = 'z';
 static const char DB_SPENTINDEX = 'p';
@@ -33,6 +41,7 @@ static const char DB_BLOCK_INDEX = 'b';
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_HEAD_BLOCKS = 'H';
 static const char DB_FLAG = 'F';
+static const char DB_INDEX_VERSION = 'V';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
 
@@ -60,19 +69,166 @@ struct CoinEntry {
 
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true, false, 64, 2 << 20) 
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true, false, 64, 2 << 20),
+    fFlushing(false), fFlushFailed(false), fStopFlush(false)
+{
+}
+
+CCoinsViewDB::~CCoinsViewDB()
+{
+    StopBackgroundFlush();
+}
+
+void CCoinsViewDB::StartBackgroundFlush()
+{
+    if (threadFlush.joinable())
+        return;
+    fStopFlush = false;
+    threadFlush = std::thread(&TraceThread<std::function<void()> >, "coinsflush", std::bind(&CCoinsViewDB::ThreadFlush, this));
+}
+
+void CCoinsViewDB::StopBackgroundFlush()
+{
+    if (!threadFlush.joinable())
+        return;
+    {
+        WaitableLock lock(cs_flush);
+        fStopFlush = true;
+    }
+    condFlush.notify_all();
+    threadFlush.join();
+}
+
+bool CCoinsViewDB::WaitForFlush() const
+{
+    WaitableLock lock(cs_flush);
+    condFlush.wait(lock, [this] { return !fFlushing || fFlushFailed; });
+    return !fFlushFailed;
+}
+
+void CCoinsViewDB::ThreadFlush()
 {
+    WaitableLock lock(cs_flush);
+    while (true) {
+        condFlush.wait(lock, [this] { return fFlushing || fStopFlush; });
+        if (!fFlushing)
+            return;
+
+        // Nothing else changes the frozen generation while it is being
+        // written, so it is read without the lock; readers only look.
+        const uint256 hashBlock = hashFlushing;
+        lock.unlock();
+        bool fOk = false;
+        try {
+            fOk = WriteCoins(*pFlushing, hashBlock, false);
+        } catch (const std::runtime_error& e) {
+            LogPrintf("Error writing to coin database: %s\n", e.what());
+        }
+        if (!fOk) {
+            // The database may now hold any prefix of the generation, so it
+            // stays readable in memory until shutdown and nothing more is
+            // written; replaying the blocks at startup repairs the coins.
+            lock.lock();
+            fFlushFailed = true;
+            condFlush.notify_all();
+            lock.unlock();
+            AbortNode(strprintf("Failed to write coins for block %s to the coin database", hashBlock.ToString()));
+            lock.lock();
+            condFlush.wait(lock, [this] { return fStopFlush; });
+            return;
+        }
+
+        std::unique_ptr<CCoinsMap> pWritten;
+        lock.lock();
+        pWritten.swap(pFlushing);
+        fFlushing = false;
+        condFlush.notify_all();
+        // Free the written generation without holding up readers
+        lock.unlock();
+        pWritten.reset();
+        lock.lock();
+    }
+}
+
+bool CCoinsViewDB::GetFlushingCoin(const COutPoint &outpoint, Coin &coin, bool &found) const {
+    if (!fFlushing)
+        return false;
+    CCoinsMap::const_iterator it = pFlushing->find(outpoint);
+    if (it == pFlushing->end())
+        return false;
+    // Spent entries are erasures on their way to disk
+    found = !it->second.coin.IsSpent();
+    if (found)
+        coin = it->second.coin;
+    return true;
 }
 
 bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    {
+        WaitableLock lock(cs_flush);
+        bool found;
+        if (GetFlushingCoin(outpoint, coin, found))
+            return found;
+    }
     return db.Read(CoinEntry(&outpoint), coin);
 }
 
+size_t CCoinsViewDB::GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins, std::vector<bool> &found) const {
+    coins.assign(outpoints.size(), Coin());
+    found.assign(outpoints.size(), false);
+    size_t nFound = 0;
+    std::vector<size_t> vMissing;
+    std::vector<CoinEntry> entries;
+    {
+        WaitableLock lock(cs_flush);
+        for (size_t i = 0; i < outpoints.size(); i++) {
+            bool fFound;
+            if (GetFlushingCoin(outpoints[i], coins[i], fFound)) {
+                found[i] = fFound;
+                nFound += fFound;
+            } else {
+                vMissing.push_back(i);
+                entries.emplace_back(&outpoints[i]);
+            }
+        }
+    }
+    if (vMissing.empty())
+        return nFound;
+
+    std::vector<Coin> vDiskCoins;
+    std::vector<bool> vDiskFound;
+    db.ReadMany(entries, vDiskCoins, vDiskFound);
+    for (size_t j = 0; j < vMissing.size(); j++) {
+        if (!vDiskFound[j])
+            continue;
+        coins[vMissing[j]] = std::move(vDiskCoins[j]);
+        found[vMissing[j]] = true;
+        nFound++;
+    }
+    return nFound;
+}
+
 bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    {
+        WaitableLock lock(cs_flush);
+        Coin coin;
+        bool found;
+        if (GetFlushingCoin(outpoint, coin, found))
+            return found;
+    }
     return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
+    {
+        WaitableLock lock(cs_flush);
+        if (fFlushing)
+            return hashFlushing;
+    }
+    return ReadBestBlock();
+}
+
+uint256 CCoinsViewDB::ReadBestBlock() const {
     uint256 hashBestChain;
     if (!db.Read(DB_BEST_BLOCK, hashBestChain))
         return uint256();
@@ -88,14 +244,38 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    WaitableLock lock(cs_flush);
+    condFlush.wait(lock, [this] { return !fFlushing || fFlushFailed; });
+    // Writing on top of a generation that never reached the database would
+    // record a best block whose coins are missing.
+    if (fFlushFailed)
+        return false;
+    if (!threadFlush.joinable()) {
+        lock.unlock();
+        return WriteCoins(mapCoins, hashBlock, true);
+    }
+
+    // Hand the coins over as a frozen generation; the caller gets back an
+    // empty map straight away.
+    pFlushing.reset(new CCoinsMap(std::move(mapCoins)));
+    mapCoins.clear();
+    hashFlushing = hashBlock;
+    fFlushing = true;
+    condFlush.notify_all();
+    return true;
+}
+
+bool CCoinsViewDB::WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
     size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
     int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
     assert(!hashBlock.IsNull());
+    if (gArgs.GetBoolArg("-dbwritefailure", false))
+        throw dbwrapper_error("Simulated write failure");
 
-    uint256 old_tip = GetBestBlock();
+    uint256 old_tip = ReadBestBlock();
     if (old_tip.IsNull()) {
         // We may be in the middle of replaying.
         std::vector<uint256> old_heads = GetHeadBlocks();
@@ -122,8 +302,10 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase)
+            it = mapCoins.erase(it);
+        else
+            ++it;
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
@@ -178,6 +360,8 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
 {
+    // The cursor iterates the database alone
+    WaitForFlush();
     CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper&>(db).NewIterator(), GetBestBlock());
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
@@ -237,7 +421,11 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     }
     batch.Write(DB_LAST_BLOCK, nLastFile);
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
-        batch.Write(std::make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
+        // A trimmed entry that is rewritten keeps the solution stored with it
+        CDiskBlockIndex diskindex(*it);
+        if (!diskindex.HasSolution() && !ReadBlockSolution((*it)->GetBlockHash(), diskindex.nSolution))
+            return error("%s: failed to read the solution of block %s", __func__, (*it)->GetBlockHash().ToString());
+        batch.Write(std::make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), diskindex);
     }
     return WriteBatch(batch, true);
 }
@@ -253,11 +441,191 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
+bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
+    return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
+}
+
+bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
+    char ch;
+    if (!Read(std::make_pair(DB_FLAG, name), ch))
+        return false;
+    fValue = ch == '1';
+    return true;
+}
+
+/**
+ * Check that each entry of a chunk of the block index hashes to its key and
+ * satisfies its own target, spread over nThreads threads. The hashes cover
+ * the whole header including the Equihash solution and dominate load time.
+ */
+static bool VerifyBlockIndexChunk(const std::vector<std::pair<uint256, CDiskBlockIndex> >& vChunk, const Consensus::Params& consensusParams, int nThreads)
+{
+    std::vector<char> vValid(vChunk.size(), 0);
+    auto verify = [&vChunk, &vValid, &consensusParams](size_t nBegin, size_t nEnd) {
+        for (size_t i = nBegin; i < nEnd; i++) {
+            const uint256 hash = vChunk[i].second.GetBlockHash();
+            vValid[i] = hash == vChunk[i].first && CheckProofOfWork(hash, vChunk[i].second.nBits, consensusParams);
+        }
+    };
+
+    size_t nPerThread = (vChunk.size() + nThreads - 1) / nThreads;
+    boost::thread_group threads;
+    for (int t = 1; t < nThreads; t++) {
+        size_t nBegin = std::min(vChunk.size(), t * nPerThread);
+        size_t nEnd = std::min(vChunk.size(), nBegin + nPerThread);
+        threads.create_thread([&verify, nBegin, nEnd] { verify(nBegin, nEnd); });
+    }
+    verify(0, std::min(vChunk.size(), nPerThread));
+    threads.join_all();
+
+    for (size_t i = 0; i < vChunk.size(); i++) {
+        if (!vValid[i])
+            return error("%s: block index entry %s failed hash or proof of work check: %s", __func__, vChunk[i].first.ToString(), vChunk[i].second.ToString());
+    }
+    return true;
+}
+
+bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex)
+{
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, uint256()));
+
+    // Entries are keyed by their block hash, so they can be linked into
+    // mapBlockIndex without rehashing; the hashes are re-checked in parallel.
+    const int nThreads = std::max(1, nScriptCheckThreads);
+    std::vector<std::pair<uint256, CDiskBlockIndex> > vChunk;
+    vChunk.reserve(BLOCK_INDEX_LOAD_CHUNK_SIZE);
+    size_t nEntries = 0;
+    int64_t nTimeRead = 0, nTimeVerify = 0, nTimeInsert = 0;
+
+    auto processChunk = [&]() {
+        int64_t nTime1 = GetTimeMicros();
+        if (!VerifyBlockIndexChunk(vChunk, consensusParams, nThreads))
+            return false;
+        int64_t nTime2 = GetTimeMicros(); nTimeVerify += nTime2 - nTime1;
+
+        for (const std::pair<uint256, CDiskBlockIndex>& item : vChunk) {
+            const CDiskBlockIndex& diskindex = item.second;
+            // Construct block index object
+            CBlockIndex* pindexNew = insertBlockIndex(item.first);
+            pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
+            pindexNew->nHeight        = diskindex.nHeight;
+            pindexNew->nFile          = diskindex.nFile;
+            pindexNew->nDataPos       = diskindex.nDataPos;
+            pindexNew->nUndoPos       = diskindex.nUndoPos;
+            pindexNew->nVersion       = diskindex.nVersion;
+            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+            pindexNew->hashReserved   = diskindex.hashReserved;
+            pindexNew->nTime          = diskindex.nTime;
+            pindexNew->nBits          = diskindex.nBits;
+            pindexNew->nNonce         = diskindex.nNonce;
+            // The solution stays on disk until GetSolution asks for it.
+            pindexNew->nStatus        = diskindex.nStatus;
+            pindexNew->nTx            = diskindex.nTx;
+        }
+        nEntries += vChunk.size();
+        vChunk.clear();
+        nTimeInsert += GetTimeMicros() - nTime2;
+        return true;
+    };
+
+    // Load mapBlockIndex
+    int64_t nTimeStart = GetTimeMicros();
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, uint256> key;
+        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
+            vChunk.push_back(std::make_pair(key.second, CDiskBlockIndex()));
+            if (!pcursor->GetValue(vChunk.back().second))
+                return error("%s: failed to read value", __func__);
+            pcursor->Next();
+            if (vChunk.size() == BLOCK_INDEX_LOAD_CHUNK_SIZE) {
+                nTimeRead += GetTimeMicros() - nTimeStart;
+                if (!processChunk())
+                    return false;
+                nTimeStart = GetTimeMicros();
+            }
+        } else {
+            break;
+        }
+    }
+    nTimeRead += GetTimeMicros() - nTimeStart;
+    if (!processChunk())
+        return false;
+
+    LogPrintf("%s: %u entries, read %.2fs, verify %.2fs (%d threads), insert %.2fs\n", __func__,
+        nEntries, nTimeRead * 0.000001, nTimeVerify * 0.000001, nThreads, nTimeInsert * 0.000001);
+
+    return true;
+}
+
+bool CBlockTreeDB::ReadBlockSolution(const uint256 &hash, std::vector<unsigned char> &solution)
+{
+    {
+        LOCK(cs_solutionCache);
+        std::map<uint256, SolutionList::iterator>::iterator it = mapSolutions.find(hash);
+        if (it != mapSolutions.end()) {
+            lruSolutions.splice(lruSolutions.begin(), lruSolutions, it->second);
+            solution = it->second->second;
+            return true;
+        }
+    }
+
+    CDiskBlockIndex diskindex;
+    if (!Read(std::make_pair(DB_BLOCK_INDEX, hash), diskindex))
+        return false;
+    solution = diskindex.nSolution;
+
+    LOCK(cs_solutionCache);
+    if (mapSolutions.count(hash))
+        return true;
+    lruSolutions.push_front(std::make_pair(hash, solution));
+    mapSolutions[hash] = lruSolutions.begin();
+    if (lruSolutions.size() > BLOCK_SOLUTION_CACHE_SIZE) {
+        mapSolutions.erase(lruSolutions.back().first);
+        lruSolutions.pop_back();
+    }
+    return true;
+}
+
+CIndexDB::CIndexDB(size_t nCacheSize, bool fMemory, bool fWipe, bool compression, int maxOpenFiles, size_t maxFileSize) : CDBWrapper(GetDataDir() / "indexes", nCacheSize, fMemory, fWipe, false, compression, maxOpenFiles, maxFileSize) {
+}
+
+/** Address index values leave out what their keys hold: the sign of an
+ *  amount and the script of an unspent output. */
+static void WriteAddressEntry(CDBBatch &batch, const CAddressIndexKey &key, CAmount nValue) {
+    batch.Write(std::make_pair(DB_ADDRESSINDEX, key), CAddressAmountCompressor(nValue));
+}
+
+static void WriteAddressEntry(CDBBatch &batch, const CAddressUnspentKey &key, const CAddressUnspentValue &value) {
+    batch.Write(std::make_pair(DB_ADDRESSUNSPENTINDEX, key), value);
+}
+
+static bool GetAddressEntryValue(CDBIterator &it, const CAddressIndexKey &key, CAmount &nValue) {
+    CAddressAmountCompressor value(nValue);
+    return it.GetValue(value);
+}
+
+static bool GetAddressEntryValue(CDBIterator &it, const CAddressUnspentKey &key, CAddressUnspentValue &value) {
+    if (!it.GetValue(value))
+        return false;
+    value.script = GetAddressScript(key.type, key.hashBytes);
+    return true;
+}
+
+bool CIndexDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
     return Read(std::make_pair(DB_SPENTINDEX, key), value);
 }
- bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect) {
-    CDBBatch batch(*this);
+
+size_t CIndexDB::ReadSpentIndexes(const std::vector<CSpentIndexKey> &keys, std::vector<CSpentIndexValue> &values, std::vector<bool> &found) {
+    std::vector<std::pair<char, CSpentIndexKey> > dbKeys;
+    dbKeys.reserve(keys.size());
+    for (const CSpentIndexKey& key : keys)
+        dbKeys.push_back(std::make_pair(DB_SPENTINDEX, key));
+    return ReadMany(dbKeys, values, found);
+}
+ void CIndexDB::UpdateSpentIndex(CDBBatch &batch, const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect) {
     for (std::vector<std::pair<CSpentIndexKey,CSpentIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
         if (it->second.IsNull()) {
             batch.Erase(std::make_pair(DB_SPENTINDEX, it->first));
@@ -265,20 +633,17 @@ bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
             batch.Write(std::make_pair(DB_SPENTINDEX, it->first), it->second);
         }
     }
-    return WriteBatch(batch);
 }
- bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect) {
-    CDBBatch batch(*this);
+ void CIndexDB::UpdateAddressUnspentIndex(CDBBatch &batch, const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect) {
     for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
         if (it->second.IsNull()) {
             batch.Erase(std::make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
         } else {
-            batch.Write(std::make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
+            WriteAddressEntry(batch, it->first, it->second);
         }
     }
-    return WriteBatch(batch);
 }
- bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
+ bool CIndexDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
                                            std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs) {
      boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
      pcursor->Seek(std::make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
@@ -287,7 +652,7 @@ bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
         std::pair<char,CAddressUnspentKey> key;
         if (pcursor->GetKey(key) && key.first == DB_ADDRESSUNSPENTINDEX && key.second.hashBytes == addressHash) {
             CAddressUnspentValue nValue;
-            if (pcursor->GetValue(nValue)) {
+            if (GetAddressEntryValue(*pcursor, key.second, nValue)) {
                 unspentOutputs.push_back(std::make_pair(key.second, nValue));
                 pcursor->Next();
             } else {
@@ -299,19 +664,224 @@ bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
     }
      return true;
 }
- bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
-    CDBBatch batch(*this);
+/** Collect up to nLimit entries of one address under prefix, forwards from
+ *  cursor or backwards from just before it. Forward cursors name the next
+ *  entry to read, backward ones the last entry read, so resuming after a
+ *  reorg erased that entry still lands in the right place. */
+template<typename Key, typename Value, typename Stop>
+static bool ReadAddressPage(CDBWrapper& db, char prefix, const Key& seek, bool fReverse, size_t nLimit, Stop fStop,
+                            Key& cursor, std::vector<std::pair<Key, Value> >& vect)
+{
+    const unsigned int type = seek.type;
+    const uint160 addressHash = seek.hashBytes;
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(std::make_pair(prefix, seek));
+    if (fReverse) {
+        if (pcursor->Valid())
+            pcursor->Prev();
+        else
+            pcursor->SeekToLast();
+    }
+
+    Key last = seek;
+    size_t nRead = 0;
+    cursor.SetNull();
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, Key> key;
+        if (!pcursor->GetKey(key) || key.first != prefix || key.second.type != type ||
+            key.second.hashBytes != addressHash || fStop(key.second)) {
+            break;
+        }
+        if (nRead == nLimit) {
+            cursor = fReverse ? last : key.second;
+            break;
+        }
+        Value nValue;
+        if (!GetAddressEntryValue(*pcursor, key.second, nValue))
+            return error("failed to get address index value");
+        vect.push_back(std::make_pair(key.second, nValue));
+        last = key.second;
+        nRead++;
+        if (fReverse)
+            pcursor->Prev();
+        else
+            pcursor->Next();
+    }
+    return true;
+}
+
+bool CIndexDB::ReadAddressIndexPage(uint160 addressHash, int type, int start, int end, bool fReverse, size_t nLimit,
+                                        CAddressIndexKey &cursor, std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex) {
+    CAddressIndexKey seek = cursor;
+    if (seek.IsNull()) {
+        // Just before the first entry in range, or (reverse) just after the last
+        const int height = fReverse ? (end > 0 ? end + 1 : std::numeric_limits<int>::max()) : std::max(start, 0);
+        seek = CAddressIndexKey(type, addressHash, height, 0, uint256(), 0, false);
+    }
+    return ReadAddressPage(*this, DB_ADDRESSINDEX, seek, fReverse, nLimit,
+                           [start, end](const CAddressIndexKey& key) {
+                               return (end > 0 && key.blockHeight > end) || (start > 0 && key.blockHeight < start);
+                           },
+                           cursor, addressIndex);
+}
+
+bool CIndexDB::ReadAddressUnspentPage(uint160 addressHash, int type, bool fReverse, size_t nLimit, CAddressUnspentKey &cursor,
+                                          std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect) {
+    CAddressUnspentKey seek = cursor;
+    if (seek.IsNull()) {
+        uint256 txhash;
+        if (fReverse)
+            memset(txhash.begin(), 0xff, txhash.size());
+        seek = CAddressUnspentKey(type, addressHash, txhash, fReverse ? std::numeric_limits<uint32_t>::max() : 0);
+    }
+    return ReadAddressPage(*this, DB_ADDRESSUNSPENTINDEX, seek, fReverse, nLimit,
+                           [](const CAddressUnspentKey& key) { return false; },
+                           cursor, vect);
+}
+
+ void CIndexDB::WriteAddressIndex(CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
     for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Write(std::make_pair(DB_ADDRESSINDEX, it->first), it->second);
-    return WriteBatch(batch);
+        WriteAddressEntry(batch, it->first, it->second);
+    UpdateAddressBalance(batch, vect, true);
 }
- bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
-    CDBBatch batch(*this);
+ void CIndexDB::EraseAddressIndex(CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
     for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Erase(std::make_pair(DB_ADDRESSINDEX, it->first));
-    return WriteBatch(batch);
+    UpdateAddressBalance(batch, vect, false);
+}
+
+namespace {
+//! Change a block makes to the balance record of one address
+struct CAddressBalanceDelta {
+    CAmount balance = 0;
+    CAmount received = 0;
+    std::set<uint256> txids;
+    int height = 0;
+};
+}
+
+/** Fold the address index entries of one block into the balance records, in
+ *  the batch that writes (fConnect) or erases the entries themselves. */
+void CIndexDB::UpdateAddressBalance(CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, bool fConnect) {
+    std::map<std::pair<unsigned int, uint160>, CAddressBalanceDelta> mapDelta;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        CAddressBalanceDelta& delta = mapDelta[std::make_pair(it->first.type, it->first.hashBytes)];
+        delta.balance += it->second;
+        if (!it->first.spending)
+            delta.received += it->second;
+        delta.txids.insert(it->first.txhash);
+        delta.height = std::max(delta.height, it->first.blockHeight);
+    }
+
+    for (std::map<std::pair<unsigned int, uint160>, CAddressBalanceDelta>::const_iterator it=mapDelta.begin(); it!=mapDelta.end(); it++) {
+        const CAddressIndexIteratorKey key(it->first.first, it->first.second);
+        const CAddressBalanceDelta& delta = it->second;
+        CAddressBalanceValue value;
+        if (!Read(std::make_pair(DB_ADDRESSBALANCE, key), value))
+            value.SetNull();
+
+        if (fConnect) {
+            // Blocks connect in height order, so a record that already reaches
+            // this height has seen the block (e.g. under -reindex-chainstate).
+            if (!value.IsNull() && value.lastHeight >= delta.height)
+                continue;
+            if (value.IsNull())
+                value.firstHeight = delta.height;
+            value.balance += delta.balance;
+            value.received += delta.received;
+            value.txCount += delta.txids.size();
+            value.lastHeight = delta.height;
+        } else {
+            if (value.IsNull() || value.lastHeight < delta.height)
+                continue;
+            value.balance -= delta.balance;
+            value.received -= delta.received;
+            value.txCount -= std::min<int64_t>(value.txCount, delta.txids.size());
+            if (value.IsNull()) {
+                batch.Erase(std::make_pair(DB_ADDRESSBALANCE, key));
+                continue;
+            }
+            value.lastHeight = ReadAddressIndexHeightBefore(key.hashBytes, key.type, delta.height);
+            if (value.lastHeight < value.firstHeight)
+                value.lastHeight = value.firstHeight;
+        }
+        batch.Write(std::make_pair(DB_ADDRESSBALANCE, key), value);
+    }
+}
+
+/** Height of the last address index entry below height, or -1. The entries at
+ *  height itself are still in the database while their erasure is batched. */
+int CIndexDB::ReadAddressIndexHeightBefore(uint160 addressHash, int type, int height) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, height)));
+    if (!pcursor->Valid())
+        return -1;
+    pcursor->Prev();
+    std::pair<char,CAddressIndexKey> key;
+    if (pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX &&
+        key.second.type == (unsigned int)type && key.second.hashBytes == addressHash && key.second.blockHeight < height) {
+        return key.second.blockHeight;
+    }
+    return -1;
+}
+
+void CIndexDB::ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value) {
+    if (!Read(std::make_pair(DB_ADDRESSBALANCE, CAddressIndexIteratorKey(type, addressHash)), value))
+        value.SetNull();
+}
+
+bool CIndexDB::BuildAddressBalanceIndex() {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey()));
+
+    // Entries are ordered by address, then height, then transaction, so each
+    // record is complete once the cursor moves on to the next address.
+    const size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
+    CDBBatch batch(*this);
+    CAddressIndexKey last;
+    CAddressBalanceValue value;
+    int64_t nAddresses = 0;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char,CAddressIndexKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ADDRESSINDEX)
+            break;
+        CAmount nValue;
+        if (!GetAddressEntryValue(*pcursor, key.second, nValue))
+            return error("failed to get address index value");
+
+        const CAddressIndexKey& entry = key.second;
+        if (entry.type != last.type || entry.hashBytes != last.hashBytes) {
+            if (!value.IsNull()) {
+                batch.Write(std::make_pair(DB_ADDRESSBALANCE, CAddressIndexIteratorKey(last.type, last.hashBytes)), value);
+                nAddresses++;
+            }
+            if (batch.SizeEstimate() > batch_size) {
+                if (!WriteBatch(batch))
+                    return error("failed to write address balances");
+                batch.Clear();
+            }
+            value.SetNull();
+            value.firstHeight = entry.blockHeight;
+        }
+        if (value.IsNull() || entry.blockHeight != last.blockHeight || entry.txindex != last.txindex || entry.txhash != last.txhash)
+            value.txCount++;
+        value.balance += nValue;
+        if (!entry.spending)
+            value.received += nValue;
+        value.lastHeight = entry.blockHeight;
+        last = entry;
+        pcursor->Next();
+    }
+    if (!value.IsNull()) {
+        batch.Write(std::make_pair(DB_ADDRESSBALANCE, CAddressIndexIteratorKey(last.type, last.hashBytes)), value);
+        nAddresses++;
+    }
+    LogPrintf("%s: wrote balance records for %d addresses\n", __func__, nAddresses);
+    return WriteBatch(batch, true);
 }
- bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
+ bool CIndexDB::ReadAddressIndex(uint160 addressHash, int type,
                                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
                                     int start, int end) {
      boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
@@ -328,7 +898,7 @@ bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
                 break;
             }
             CAmount nValue;
-            if (pcursor->GetValue(nValue)) {
+            if (GetAddressEntryValue(*pcursor, key.second, nValue)) {
                 addressIndex.push_back(std::make_pair(key.second, nValue));
                 pcursor->Next();
             } else {
@@ -340,12 +910,10 @@ bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
     }
      return true;
 }
- bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex) {
-    CDBBatch batch(*this);
+ void CIndexDB::WriteTimestampIndex(CDBBatch &batch, const CTimestampIndexKey &timestampIndex) {
     batch.Write(std::make_pair(DB_TIMESTAMPINDEX, timestampIndex), 0);
-    return WriteBatch(batch);
 }
- bool CBlockTreeDB::ReadTimestampIndex(const unsigned int &high, const unsigned int &low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &hashes) {
+ bool CIndexDB::ReadTimestampIndex(const unsigned int &high, const unsigned int &low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &hashes) {
      boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
      pcursor->Seek(std::make_pair(DB_TIMESTAMPINDEX, CTimestampIndexIteratorKey(low)));
      while (pcursor->Valid()) {
@@ -366,12 +934,10 @@ bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
     }
      return true;
 }
- bool CBlockTreeDB::WriteTimestampBlockIndex(const CTimestampBlockIndexKey &blockhashIndex, const CTimestampBlockIndexValue &logicalts) {
-    CDBBatch batch(*this);
+ void CIndexDB::WriteTimestampBlockIndex(CDBBatch &batch, const CTimestampBlockIndexKey &blockhashIndex, const CTimestampBlockIndexValue &logicalts) {
     batch.Write(std::make_pair(DB_BLOCKHASHINDEX, blockhashIndex), logicalts);
-    return WriteBatch(batch);
 }
- bool CBlockTreeDB::ReadTimestampBlockIndex(const uint256 &hash, unsigned int &ltimestamp) {
+ bool CIndexDB::ReadTimestampBlockIndex(const uint256 &hash, unsigned int &ltimestamp) {
      CTimestampBlockIndexValue(lts);
     if (!Read(std::make_pair(DB_BLOCKHASHINDEX, hash), lts))
 	return false;
@@ -379,61 +945,155 @@ bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
     return true;
 }
 
-bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
-    return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
+/** Copy the entries of one index from the block tree DB, then erase them
+ *  there. Copies are written first, so an interrupted move just repeats. */
+template<typename Key, typename Value>
+static bool MoveIndexEntries(CBlockTreeDB& blocktree, CIndexDB& indexdb, char prefix, size_t batch_size, int64_t& nMoved)
+{
+    boost::scoped_ptr<CDBIterator> pcursor(blocktree.NewIterator());
+    pcursor->Seek(prefix);
+    CDBBatch copies(indexdb);
+    CDBBatch erasures(blocktree);
+    while (true) {
+        bool fDone = !pcursor->Valid();
+        std::pair<char, Key> key;
+        if (!fDone) {
+            boost::this_thread::interruption_point();
+            fDone = !pcursor->GetKey(key) || key.first != prefix;
+        }
+        if (!fDone) {
+            Value value;
+            if (!pcursor->GetValue(value))
+                return error("%s: failed to read index entry", __func__);
+            copies.Write(key, value);
+            erasures.Erase(key);
+            nMoved++;
+            pcursor->Next();
+        }
+        if (fDone || copies.SizeEstimate() > batch_size) {
+            if (!indexdb.WriteBatch(copies, true) || !blocktree.WriteBatch(erasures))
+                return error("%s: failed to move index entries", __func__);
+            copies.Clear();
+            erasures.Clear();
+        }
+        if (fDone)
+            return true;
+    }
 }
 
-bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
-    char ch;
-    if (!Read(std::make_pair(DB_FLAG, name), ch))
+bool CIndexDB::MigrateFromBlockTree(CBlockTreeDB &blocktree) {
+    const size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
+    int64_t nMoved = 0;
+    if (!MoveIndexEntries<CLegacyAddressIndexKey, CAmount>(blocktree, *this, DB_ADDRESSINDEX_LEGACY, batch_size, nMoved) ||
+        !MoveIndexEntries<CLegacyAddressUnspentKey, CLegacyAddressUnspentValue>(blocktree, *this, DB_ADDRESSUNSPENTINDEX_LEGACY, batch_size, nMoved) ||
+        !MoveIndexEntries<CAddressIndexIteratorKey, CAddressBalanceValue>(blocktree, *this, DB_ADDRESSBALANCE, batch_size, nMoved) ||
+        !MoveIndexEntries<CSpentIndexKey, CSpentIndexValue>(blocktree, *this, DB_SPENTINDEX, batch_size, nMoved) ||
+        !MoveIndexEntries<CTimestampIndexKey, int>(blocktree, *this, DB_TIMESTAMPINDEX, batch_size, nMoved) ||
+        !MoveIndexEntries<CTimestampBlockIndexKey, CTimestampBlockIndexValue>(blocktree, *this, DB_BLOCKHASHINDEX, batch_size, nMoved)) {
         return false;
-    fValue = ch == '1';
+    }
+    if (nMoved > 0)
+        LogPrintf("%s: moved %d index entries out of the block tree database\n", __func__, nMoved);
     return true;
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex)
+/** Rewrite the entries of one address index from the legacy format in the
+ *  compact one. Each batch adds new entries and erases the old ones, so an
+ *  interrupted upgrade carries on where it stopped. */
+template<typename LegacyKey, typename LegacyValue>
+static bool UpgradeAddressEntries(CIndexDB& indexdb, char prefix, size_t batch_size, int64_t& nUpgraded)
 {
-    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    boost::scoped_ptr<CDBIterator> pcursor(indexdb.NewIterator());
+    pcursor->Seek(prefix);
+    CDBBatch batch(indexdb);
+    while (true) {
+        std::pair<char, LegacyKey> key;
+        bool fDone = !pcursor->Valid() || !pcursor->GetKey(key) || key.first != prefix;
+        if (!fDone) {
+            boost::this_thread::interruption_point();
+            LegacyValue value;
+            if (!pcursor->GetValue(value))
+                return error("%s: failed to read address index entry", __func__);
+            WriteAddressEntry(batch, key.second, value);
+            batch.Erase(key);
+            nUpgraded++;
+            pcursor->Next();
+        }
+        if (fDone || batch.SizeEstimate() > batch_size) {
+            if (!indexdb.WriteBatch(batch))
+                return error("%s: failed to write address index entries", __func__);
+            batch.Clear();
+        }
+        if (fDone)
+            return true;
+    }
+}
 
-    pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, uint256()));
+bool CIndexDB::Upgrade() {
+    int nVersion = 0;
+    if (Read(DB_INDEX_VERSION, nVersion) && nVersion >= INDEX_DB_VERSION)
+        return true;
 
-    // Load mapBlockIndex
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
-            CDiskBlockIndex diskindex;
-            if (pcursor->GetValue(diskindex)) {
-                // Construct block index object
-                CBlockIndex* pindexNew = insertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->hashReserved   = diskindex.hashReserved;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nSolution      = diskindex.nSolution;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nTx            = diskindex.nTx;
-
-                if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, consensusParams))
-                    return error("%s: CheckProofOfWork failed: %s", __func__, pindexNew->ToString());
+    const size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
+    int64_t nUpgraded = 0;
+    if (!UpgradeAddressEntries<CLegacyAddressIndexKey, CAmount>(*this, DB_ADDRESSINDEX_LEGACY, batch_size, nUpgraded) ||
+        !UpgradeAddressEntries<CLegacyAddressUnspentKey, CLegacyAddressUnspentValue>(*this, DB_ADDRESSUNSPENTINDEX_LEGACY, batch_size, nUpgraded)) {
+        return false;
+    }
+    if (nUpgraded > 0)
+        LogPrintf("%s: rewrote %d address index entries in the compact format\n", __func__, nUpgraded);
+    return Write(DB_INDEX_VERSION, INDEX_DB_VERSION, true);
+}
 
-                pcursor->Next();
-            } else {
-                return error("%s: failed to read value", __func__);
-            }
-        } else {
-            break;
+bool CIndexDB::ReadBestBlock(const std::string &name, CBlockLocator &locator) {
+    return Read(std::make_pair(DB_BEST_BLOCK, name), locator);
+}
+
+void CIndexDB::WriteBestBlock(CDBBatch &batch, const std::string &name, const CBlockLocator &locator) {
+    batch.Write(std::make_pair(DB_BEST_BLOCK, name), locator);
+}
+
+/** Erase every entry under one prefix, in batches of at most batch_size. */
+template<typename Key>
+static bool EraseIndexEntries(CIndexDB& indexdb, char prefix, size_t batch_size)
+{
+    boost::scoped_ptr<CDBIterator> pcursor(indexdb.NewIterator());
+    pcursor->Seek(prefix);
+    CDBBatch batch(indexdb);
+    while (true) {
+        std::pair<char, Key> key;
+        bool fDone = !pcursor->Valid() || !pcursor->GetKey(key) || key.first != prefix;
+        if (!fDone) {
+            boost::this_thread::interruption_point();
+            batch.Erase(key);
+            pcursor->Next();
+        }
+        if (fDone || batch.SizeEstimate() > batch_size) {
+            if (!indexdb.WriteBatch(batch))
+                return error("%s: failed to erase index entries", __func__);
+            batch.Clear();
         }
+        if (fDone)
+            return true;
     }
+}
 
-    return true;
+bool CIndexDB::WipeIndex(const std::string &name) {
+    const size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
+    bool fSuccess;
+    if (name == "addressindex") {
+        fSuccess = EraseIndexEntries<CAddressIndexKey>(*this, DB_ADDRESSINDEX, batch_size) &&
+                   EraseIndexEntries<CAddressUnspentKey>(*this, DB_ADDRESSUNSPENTINDEX, batch_size) &&
+                   EraseIndexEntries<CAddressIndexIteratorKey>(*this, DB_ADDRESSBALANCE, batch_size);
+    } else if (name == "spentindex") {
+        fSuccess = EraseIndexEntries<CSpentIndexKey>(*this, DB_SPENTINDEX, batch_size);
+    } else if (name == "timestampindex") {
+        fSuccess = EraseIndexEntries<CTimestampIndexKey>(*this, DB_TIMESTAMPINDEX, batch_size) &&
+                   EraseIndexEntries<CTimestampBlockIndexKey>(*this, DB_BLOCKHASHINDEX, batch_size);
+    } else {
+        return error("%s: unknown index %s", __func__, name);
+    }
+    return fSuccess && Erase(std::make_pair(DB_BEST_BLOCK, name), true);
 }
 
 namespace {
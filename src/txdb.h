@@ -12,10 +12,13 @@
 #include <addressindex.h>
 #include <spentindex.h>
 #include <timestampindex.h>
+#include <sync.h>
 
+#include <list>
 #include <map>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -23,12 +26,18 @@ class CBlockIndex;
 class CCoinsViewDBCursor;
 class uint256;
 
+//! Number of block index entries read before they are verified in parallel
+static const size_t BLOCK_INDEX_LOAD_CHUNK_SIZE = 16384;
+//! Number of recently read block solutions cached by CBlockTreeDB
+static const size_t BLOCK_SOLUTION_CACHE_SIZE = 2000;
 //! No need to periodic flush if at least this much space still available.
 static constexpr int MAX_BLOCK_COINSDB_USAGE = 10;
 //! -dbcache default (MiB)
 static const int64_t nDefaultDbCache = 450;
 //! -dbbatchsize default (bytes)
 static const int64_t nDefaultDbBatchSize = 16 << 20;
+//! -asynccoinsflush default
+static const bool DEFAULT_ASYNC_COINS_FLUSH = false;
 //! max. -dbcache (MiB)
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache (MiB)
@@ -41,6 +50,10 @@ static const int64_t nMaxBlockDBCache = 2;
 static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
+//! -indexdbcache default (MiB)
+static const int64_t nDefaultIndexDbCache = 256;
+//! Format of the index DB: 1 has compact address index records
+static const int INDEX_DB_VERSION = 1;
 
 struct CDiskTxPos : public CDiskBlockPos
 {
@@ -72,10 +85,44 @@ class CCoinsViewDB final : public CCoinsView
 {
 protected:
     CDBWrapper db;
+
+    /**
+     * Background flushing. BatchWrite swaps the coins it is given into
+     * mapFlushing, a frozen generation that a thread writes to the database
+     * while the caller carries on with an empty cache. Reads look in the
+     * frozen generation first. Only one generation is written at a time: a
+     * BatchWrite that finds one still in flight waits for it. If the write
+     * fails, the generation stays in place for reads, every later BatchWrite
+     * fails, and the node is shut down.
+     */
+    mutable CWaitableCriticalSection cs_flush;
+    mutable CConditionVariable condFlush;
+    std::unique_ptr<CCoinsMap> pFlushing;
+    uint256 hashFlushing;
+    bool fFlushing;
+    bool fFlushFailed;
+    bool fStopFlush;
+    std::thread threadFlush;
+
+    bool WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase);
+    uint256 ReadBestBlock() const;
+    void ThreadFlush();
+    /** Find outpoint in the generation being written. Requires cs_flush. */
+    bool GetFlushingCoin(const COutPoint &outpoint, Coin &coin, bool &found) const;
+
 public:
     explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CCoinsViewDB();
+
+    /** Write from now on in the background, see -asynccoinsflush. */
+    void StartBackgroundFlush();
+    /** Wait for the background write to finish and go back to writing synchronously. */
+    void StopBackgroundFlush();
+    /** Wait until no generation is being written. Returns false if a background write failed. */
+    bool WaitForFlush() const;
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    size_t GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins, std::vector<bool> &found) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
@@ -125,23 +172,71 @@ public:
     bool ReadReindexing(bool &fReindexing);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &vect);
+    bool WriteFlag(const std::string &name, bool fValue);
+    bool ReadFlag(const std::string &name, bool &fValue);
+    bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+    /** Read the Equihash solution of an indexed block. Recent ones are kept in
+     *  a small LRU cache, as peers tend to ask for the same headers. */
+    bool ReadBlockSolution(const uint256 &hash, std::vector<unsigned char> &solution);
+
+private:
+    typedef std::list<std::pair<uint256, std::vector<unsigned char> > > SolutionList;
+    CCriticalSection cs_solutionCache;
+    SolutionList lruSolutions; //!< most recently used first
+    std::map<uint256, SolutionList::iterator> mapSolutions;
+};
+
+/** Access to the address, spent and timestamp indexes (indexes/). They are
+ *  kept apart from the block index so that their writes, cache and
+ *  compactions don't hold up block index flushes and loading. */
+class CIndexDB : public CDBWrapper
+{
+public:
+    explicit CIndexDB(size_t nCacheSize, bool fMemory, bool fWipe, bool compression, int maxOpenFiles, size_t maxFileSize);
+
+    CIndexDB(const CIndexDB&) = delete;
+    CIndexDB& operator=(const CIndexDB&) = delete;
+
     bool ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
-    bool UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect);
-    bool UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect);
+    size_t ReadSpentIndexes(const std::vector<CSpentIndexKey> &keys, std::vector<CSpentIndexValue> &values, std::vector<bool> &found);
+    void UpdateSpentIndex(CDBBatch &batch, const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect);
+    void UpdateAddressUnspentIndex(CDBBatch &batch, const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect);
     bool ReadAddressUnspentIndex(uint160 addressHash, int type,
                                  std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
-    bool WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
-    bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
+    /** Read at most nLimit unspent outputs of an address in index order, or
+     *  (fReverse) backwards. A null cursor starts at the first (last) output;
+     *  on return it is where to resume, or null if there is nothing left. */
+    bool ReadAddressUnspentPage(uint160 addressHash, int type, bool fReverse, size_t nLimit, CAddressUnspentKey &cursor,
+                                std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
+    void WriteAddressIndex(CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
+    void EraseAddressIndex(CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
     bool ReadAddressIndex(uint160 addressHash, int type,
                           std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
                           int start = 0, int end = 0);
-    bool WriteTimestampIndex(const CTimestampIndexKey &timestampIndex);
+    /** As ReadAddressUnspentPage, for the address index entries between the
+     *  heights start and end (either 0 for no bound), oldest first. */
+    bool ReadAddressIndexPage(uint160 addressHash, int type, int start, int end, bool fReverse, size_t nLimit,
+                              CAddressIndexKey &cursor, std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex);
+    void ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value);
+    /** Build the balance records of an address index that predates them. */
+    bool BuildAddressBalanceIndex();
+    void WriteTimestampIndex(CDBBatch &batch, const CTimestampIndexKey &timestampIndex);
     bool ReadTimestampIndex(const unsigned int &high, const unsigned int &low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &vect);
-    bool WriteTimestampBlockIndex(const CTimestampBlockIndexKey &blockhashIndex, const CTimestampBlockIndexValue &logicalts);
+    void WriteTimestampBlockIndex(CDBBatch &batch, const CTimestampBlockIndexKey &blockhashIndex, const CTimestampBlockIndexValue &logicalts);
     bool ReadTimestampBlockIndex(const uint256 &hash, unsigned int &logicalTS);
-    bool WriteFlag(const std::string &name, bool fValue);
-    bool ReadFlag(const std::string &name, bool &fValue);
-    bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+    /** Block the named index was last written up to, stored with its entries. */
+    bool ReadBestBlock(const std::string &name, CBlockLocator &locator);
+    void WriteBestBlock(CDBBatch &batch, const std::string &name, const CBlockLocator &locator);
+    /** Erase all entries of the named index, e.g. once it is switched off. */
+    bool WipeIndex(const std::string &name);
+    /** Move the index entries that older versions kept in the block tree DB. */
+    bool MigrateFromBlockTree(CBlockTreeDB &blocktree);
+    /** Bring entries written in older formats up to INDEX_DB_VERSION. */
+    bool Upgrade();
+
+private:
+    void UpdateAddressBalance(CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, bool fConnect);
+    int ReadAddressIndexHeightBefore(uint160 addressHash, int type, int height);
 };
 
 #endif // GENESIS_TXDB_H
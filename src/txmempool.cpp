@@ -423,121 +423,63 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
 
 void CTxMemPool::addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view)
 {
-    LOCK(cs);
     const CTransaction& tx = entry.GetTx();
-    std::vector<CMempoolAddressDeltaKey> inserted;
-     uint256 txhash = tx.GetHash();
+    const uint256& txhash = tx.GetHash();
+    std::vector<CMempoolAddressIndex::Entry> entries;
+    CMempoolAddressId id;
     for (unsigned int j = 0; j < tx.vin.size(); j++) {
-        const CTxIn input = tx.vin[j];
+        const CTxIn& input = tx.vin[j];
         const CTxOut &prevout = view.AccessCoin(input.prevout).out;
-        if (prevout.scriptPubKey.IsPayToScriptHash()) {
-            std::vector<unsigned char> hashBytes(prevout.scriptPubKey.begin()+2, prevout.scriptPubKey.begin()+22);
-            CMempoolAddressDeltaKey key(2, uint160(hashBytes), txhash, j, 1);
-            CMempoolAddressDelta delta(entry.GetTime(), prevout.nValue * -1, input.prevout.hash, input.prevout.n);
-            mapAddress.insert(std::make_pair(key, delta));
-            inserted.push_back(key);
-        } else if (prevout.scriptPubKey.IsPayToPublicKeyHash()) {
-            std::vector<unsigned char> hashBytes(prevout.scriptPubKey.begin()+3, prevout.scriptPubKey.begin()+23);
-            CMempoolAddressDeltaKey key(1, uint160(hashBytes), txhash, j, 1);
-            CMempoolAddressDelta delta(entry.GetTime(), prevout.nValue * -1, input.prevout.hash, input.prevout.n);
-            mapAddress.insert(std::make_pair(key, delta));
-            inserted.push_back(key);
+        if (GetScriptAddressId(prevout.scriptPubKey, id)) {
+            entries.emplace_back(CMempoolAddressDeltaKey(id.type, id.hash, txhash, j, 1),
+                                 CMempoolAddressDelta(entry.GetTime(), prevout.nValue * -1, input.prevout.hash, input.prevout.n));
         }
     }
-     for (unsigned int k = 0; k < tx.vout.size(); k++) {
+    for (unsigned int k = 0; k < tx.vout.size(); k++) {
         const CTxOut &out = tx.vout[k];
-        if (out.scriptPubKey.IsPayToScriptHash()) {
-            std::vector<unsigned char> hashBytes(out.scriptPubKey.begin()+2, out.scriptPubKey.begin()+22);
-            CMempoolAddressDeltaKey key(2, uint160(hashBytes), txhash, k, 0);
-            mapAddress.insert(std::make_pair(key, CMempoolAddressDelta(entry.GetTime(), out.nValue)));
-            inserted.push_back(key);
-        } else if (out.scriptPubKey.IsPayToPublicKeyHash()) {
-            std::vector<unsigned char> hashBytes(out.scriptPubKey.begin()+3, out.scriptPubKey.begin()+23);
-            std::pair<addressDeltaMap::iterator,bool> ret;
-            CMempoolAddressDeltaKey key(1, uint160(hashBytes), txhash, k, 0);
-            mapAddress.insert(std::make_pair(key, CMempoolAddressDelta(entry.GetTime(), out.nValue)));
-            inserted.push_back(key);
+        if (GetScriptAddressId(out.scriptPubKey, id)) {
+            entries.emplace_back(CMempoolAddressDeltaKey(id.type, id.hash, txhash, k, 0),
+                                 CMempoolAddressDelta(entry.GetTime(), out.nValue));
         }
     }
-     mapAddressInserted.insert(std::make_pair(txhash, inserted));
+    addressIndex.Add(txhash, entries);
 }
- bool CTxMemPool::getAddressIndex(std::vector<std::pair<uint160, int> > &addresses,
-                                 std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > &results)
+
+bool CTxMemPool::getAddressIndex(const std::vector<std::pair<uint160, int> > &addresses,
+                                 std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > &results) const
 {
-    LOCK(cs);
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        addressDeltaMap::iterator ait = mapAddress.lower_bound(CMempoolAddressDeltaKey((*it).second, (*it).first));
-        while (ait != mapAddress.end() && (*ait).first.addressBytes == (*it).first && (*ait).first.type == (*it).second) {
-            results.push_back(*ait);
-            ait++;
-        }
-    }
+    addressIndex.Get(addresses, results);
     return true;
 }
- bool CTxMemPool::removeAddressIndex(const uint256 txhash)
+
+void CTxMemPool::removeAddressIndex(const uint256& txhash)
 {
-    LOCK(cs);
-    addressDeltaMapInserted::iterator it = mapAddressInserted.find(txhash);
-     if (it != mapAddressInserted.end()) {
-        std::vector<CMempoolAddressDeltaKey> keys = (*it).second;
-        for (std::vector<CMempoolAddressDeltaKey>::iterator mit = keys.begin(); mit != keys.end(); mit++) {
-            mapAddress.erase(*mit);
-        }
-        mapAddressInserted.erase(it);
-    }
-     return true;
+    addressIndex.Remove(txhash);
 }
- void CTxMemPool::addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view)
+
+void CTxMemPool::addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view)
 {
-    LOCK(cs);
-     const CTransaction& tx = entry.GetTx();
-    std::vector<CSpentIndexKey> inserted;
-     uint256 txhash = tx.GetHash();
+    const CTransaction& tx = entry.GetTx();
+    const uint256& txhash = tx.GetHash();
     for (unsigned int j = 0; j < tx.vin.size(); j++) {
-        const CTxIn input = tx.vin[j];
+        const CTxIn& input = tx.vin[j];
         const CTxOut &prevout = view.AccessCoin(input.prevout).out;
-        uint160 addressHash;
-        int addressType;
-         if (prevout.scriptPubKey.IsPayToScriptHash()) {
-            addressHash = uint160(std::vector<unsigned char> (prevout.scriptPubKey.begin()+2, prevout.scriptPubKey.begin()+22));
-            addressType = 2;
-        } else if (prevout.scriptPubKey.IsPayToPublicKeyHash()) {
-            addressHash = uint160(std::vector<unsigned char> (prevout.scriptPubKey.begin()+3, prevout.scriptPubKey.begin()+23));
-            addressType = 1;
-        } else {
-            addressHash.SetNull();
-            addressType = 0;
-        }
-         CSpentIndexKey key = CSpentIndexKey(input.prevout.hash, input.prevout.n);
-        CSpentIndexValue value = CSpentIndexValue(txhash, j, -1, prevout.nValue, addressType, addressHash);
-         mapSpent.insert(std::make_pair(key, value));
-        inserted.push_back(key);
-     }
-     mapSpentInserted.insert(std::make_pair(txhash, inserted));
+        CMempoolAddressId id;
+        GetScriptAddressId(prevout.scriptPubKey, id);
+        spentIndex.Add(CSpentIndexKey(input.prevout.hash, input.prevout.n),
+                       CSpentIndexValue(txhash, j, -1, prevout.nValue, id.type, id.hash));
+    }
 }
- bool CTxMemPool::getSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
+
+bool CTxMemPool::getSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value) const
 {
-    LOCK(cs);
-    mapSpentIndex::iterator it;
-     it = mapSpent.find(key);
-    if (it != mapSpent.end()) {
-        value = it->second;
-        return true;
-    }
-    return false;
+    return spentIndex.Get(key, value);
 }
- bool CTxMemPool::removeSpentIndex(const uint256 txhash)
+
+void CTxMemPool::removeSpentIndex(const CTransaction& tx)
 {
-    LOCK(cs);
-    mapSpentIndexInserted::iterator it = mapSpentInserted.find(txhash);
-     if (it != mapSpentInserted.end()) {
-        std::vector<CSpentIndexKey> keys = (*it).second;
-        for (std::vector<CSpentIndexKey>::iterator mit = keys.begin(); mit != keys.end(); mit++) {
-            mapSpent.erase(*mit);
-        }
-        mapSpentInserted.erase(it);
-    }
-     return true;
+    for (const CTxIn& txin : tx.vin)
+        spentIndex.Remove(CSpentIndexKey(txin.prevout.hash, txin.prevout.n), tx.GetHash());
 }
 
 void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
@@ -560,11 +502,11 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
     cachedInnerUsage -= it->DynamicMemoryUsage();
     cachedInnerUsage -= memusage::DynamicUsage(mapLinks[it].parents) + memusage::DynamicUsage(mapLinks[it].children);
     mapLinks.erase(it);
+    removeAddressIndex(hash);
+    removeSpentIndex(it->GetTx());
     mapTx.erase(it);
     nTransactionsUpdated++;
     if (minerPolicyEstimator) {minerPolicyEstimator->removeTx(hash, false);}
-    removeAddressIndex(hash);
-    removeSpentIndex(hash);
 }
 
 // Calculates descendants of entry that are not already in setDescendants, and adds to
@@ -1030,6 +972,40 @@ bool CCoinsViewMemPool::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     return base->GetCoin(outpoint, coin);
 }
 
+size_t CCoinsViewMemPool::GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins, std::vector<bool> &found) const {
+    coins.assign(outpoints.size(), Coin());
+    found.assign(outpoints.size(), false);
+    size_t nFound = 0;
+    // As in GetCoin, mempool entries take precedence; the rest go to the base in one batch
+    std::vector<size_t> vMissing;
+    std::vector<COutPoint> vMissingOutpoints;
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        CTransactionRef ptx = mempool.get(outpoints[i].hash);
+        if (!ptx) {
+            vMissing.push_back(i);
+            vMissingOutpoints.push_back(outpoints[i]);
+        } else if (outpoints[i].n < ptx->vout.size()) {
+            coins[i] = Coin(ptx->vout[outpoints[i].n], MEMPOOL_HEIGHT, false);
+            found[i] = true;
+            nFound++;
+        }
+    }
+    if (vMissing.empty())
+        return nFound;
+
+    std::vector<Coin> vBaseCoins;
+    std::vector<bool> vBaseFound;
+    base->GetCoins(vMissingOutpoints, vBaseCoins, vBaseFound);
+    for (size_t j = 0; j < vMissing.size(); j++) {
+        if (!vBaseFound[j])
+            continue;
+        coins[vMissing[j]] = std::move(vBaseCoins[j]);
+        found[vMissing[j]] = true;
+        nFound++;
+    }
+    return nFound;
+}
+
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
     // Estimate the overhead of mapTx to be 12 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
@@ -6,6 +6,7 @@
 #include <validation.h>
 
 #include <arith_uint256.h>
+#include <blocktimeindex.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
@@ -161,13 +162,13 @@ public:
 
     bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams, std::shared_ptr<const CBlock> pblock);
 
-    bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex);
+    bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fCheckPOW = true);
     bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock);
 
     // Block (dis)connection on a given view:
-    DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view, bool ignoreAddressIndex = false);
+    DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view);
     bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                    CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false, bool ignoreAddressIndex = false);
+                    CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false);
 
     // Block disconnection on our pcoinsTip:
     bool DisconnectTip(CValidationState& state, const CChainParams& chainparams, DisconnectedBlockTransactions *disconnectpool);
@@ -290,6 +291,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 std::unique_ptr<CCoinsViewDB> pcoinsdbview;
 std::unique_ptr<CCoinsViewCache> pcoinsTip;
 std::unique_ptr<CBlockTreeDB> pblocktree;
+std::unique_ptr<CIndexDB> pindexdb;
 
 enum FlushStateMode {
     FLUSH_STATE_NONE,
@@ -1023,9 +1025,14 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 
 bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &hashes)
 {
+    // Active chain blocks come from memory; only orphans need the timestamp index
+    if (fActiveOnly) {
+        blockTimeIndex.GetBlockHashes(high, low, hashes);
+        return true;
+    }
     if (!fTimestampIndex)
         return error("Timestamp index not enabled");
-     if (!pblocktree->ReadTimestampIndex(high, low, fActiveOnly, hashes))
+     if (!pindexdb->ReadTimestampIndex(high, low, fActiveOnly, hashes))
         return error("Unable to get hashes for timestamps");
      return true;
 }
@@ -1035,10 +1042,45 @@ bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
         return false;
      if (mempool.getSpentIndex(key, value))
         return true;
-     if (!pblocktree->ReadSpentIndex(key, value))
+     if (!pindexdb->ReadSpentIndex(key, value))
         return false;
      return true;
 }
+
+size_t GetSpentIndexes(const std::vector<CSpentIndexKey> &keys, std::vector<CSpentIndexValue> &values, std::vector<bool> &found)
+{
+    values.assign(keys.size(), CSpentIndexValue());
+    found.assign(keys.size(), false);
+    if (!fSpentIndex)
+        return 0;
+
+    size_t nFound = 0;
+    std::vector<size_t> vMissing;
+    std::vector<CSpentIndexKey> vMissingKeys;
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (mempool.getSpentIndex(keys[i], values[i])) {
+            found[i] = true;
+            nFound++;
+        } else {
+            vMissing.push_back(i);
+            vMissingKeys.push_back(keys[i]);
+        }
+    }
+    if (vMissing.empty())
+        return nFound;
+
+    std::vector<CSpentIndexValue> vDiskValues;
+    std::vector<bool> vDiskFound;
+    pindexdb->ReadSpentIndexes(vMissingKeys, vDiskValues, vDiskFound);
+    for (size_t j = 0; j < vMissing.size(); j++) {
+        if (!vDiskFound[j])
+            continue;
+        values[vMissing[j]] = vDiskValues[j];
+        found[vMissing[j]] = true;
+        nFound++;
+    }
+    return nFound;
+}
  bool HashOnchainActive(const uint256 &hash)
 {
     CBlockIndex* pblockindex = mapBlockIndex[hash];
@@ -1052,7 +1094,7 @@ bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
 {
     if (!fAddressIndex)
         return error("address index not enabled");
-     if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end))
+     if (!pindexdb->ReadAddressIndex(addressHash, type, addressIndex, start, end))
         return error("unable to get txids for address");
      return true;
 }
@@ -1061,11 +1103,41 @@ bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
 {
     if (!fAddressIndex)
         return error("address index not enabled");
-     if (!pblocktree->ReadAddressUnspentIndex(addressHash, type, unspentOutputs))
+     if (!pindexdb->ReadAddressUnspentIndex(addressHash, type, unspentOutputs))
         return error("unable to get txids for address");
      return true;
 }
 
+bool GetAddressIndexPage(uint160 addressHash, int type, int start, int end, bool fReverse, size_t nLimit,
+                         CAddressIndexKey &cursor, std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+
+    if (!pindexdb->ReadAddressIndexPage(addressHash, type, start, end, fReverse, nLimit, cursor, addressIndex))
+        return error("unable to get txids for address");
+    return true;
+}
+
+bool GetAddressUnspentPage(uint160 addressHash, int type, bool fReverse, size_t nLimit, CAddressUnspentKey &cursor,
+                           std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+
+    if (!pindexdb->ReadAddressUnspentPage(addressHash, type, fReverse, nLimit, cursor, unspentOutputs))
+        return error("unable to get txids for address");
+    return true;
+}
+bool GetAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+
+    pindexdb->ReadAddressBalance(addressHash, type, value);
+    return true;
+}
+
 /**
  * Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock.
  * If blockIndex is provided, the transaction is fetched from the corresponding block.
@@ -1200,7 +1272,26 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
-CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
+static bool ReadSolutionFromBlockTree(const uint256& hash, std::vector<unsigned char>& solution)
+{
+    if (!pblocktree || !pblocktree->ReadBlockSolution(hash, solution))
+        return error("%s: failed to read the solution of block %s", __func__, hash.ToString());
+    return true;
+}
+
+bool ReadBlockSolution(const CBlockIndex* pindex, std::vector<unsigned char>& solution)
+{
+    AssertLockHeld(cs_main);
+    return pindex->GetSolution(solution, ReadSolutionFromBlockTree);
+}
+
+bool ReadBlockHeader(const CBlockIndex* pindex, CBlockHeader& header)
+{
+    AssertLockHeld(cs_main);
+    return pindex->GetBlockHeader(header, ReadSolutionFromBlockTree);
+}
+
+CAmount GetBlockSubsidy(int nHeight, const uint256& confirmedHash, const Consensus::Params& consensusParams)
 {
     int subsidy = 0;
 
@@ -1240,11 +1331,7 @@ CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
         else
         {
             // A normal block...
-            // Get the most recent confirmed block's hash
-            auto lookupBlockHeight = nHeight - COINBASE_MATURITY;
-            CBlockIndex* pblockindex = chainActive[lookupBlockHeight];
-            assert(pblockindex != nullptr);
-            uint256  confirmedHash = pblockindex->GetBlockHash();
+            // Derived from the most recent confirmed block's hash
             //LogPrintf("Confirmed Hash for block %i: %s \n", nHeight - COINBASE_MATURITY, confirmedHash.GetHex());
             
             // Get a sum of the significant bytes
@@ -1284,6 +1371,17 @@ CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
     return nSubsidy;
 }
 
+CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
+{
+    uint256 confirmedHash;
+    if (nHeight > COINBASE_MATURITY) {
+        CBlockIndex* pblockindex = chainActive[nHeight - COINBASE_MATURITY];
+        assert(pblockindex != nullptr);
+        confirmedHash = pblockindex->GetBlockHash();
+    }
+    return GetBlockSubsidy(nHeight, confirmedHash, consensusParams);
+}
+
 bool IsInitialBlockDownload()
 {
     // Once this function has returned false, it must remain false.
@@ -1601,7 +1699,9 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
-static bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
+} // namespace
+
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
 {
     CDiskBlockPos pos = pindex->GetUndoPos();
     if (pos.IsNull()) {
@@ -1632,8 +1732,7 @@ static bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
     return true;
 }
 
-/** Abort with a message */
-bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
+bool AbortNode(const std::string& strMessage, const std::string& userMessage)
 {
     SetMiscWarning(strMessage);
     LogPrintf("*** %s\n", strMessage);
@@ -1644,9 +1743,11 @@ bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
     return false;
 }
 
+namespace {
+
 bool AbortNode(CValidationState& state, const std::string& strMessage, const std::string& userMessage="")
 {
-    AbortNode(strMessage, userMessage);
+    ::AbortNode(strMessage, userMessage);
     return state.Error(strMessage);
 }
 
@@ -1688,7 +1789,7 @@ int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  When FAILED is returned, view is left in an indeterminate state. */
-DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view, bool ignoreAddressIndex)
+DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view)
 {
     bool fClean = true;
 
@@ -1703,37 +1804,12 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
         return DISCONNECT_FAILED;
     }
 
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
-    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
-
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = *(block.vtx[i]);
         uint256 hash = tx.GetHash();
         bool is_coinbase = tx.IsCoinBase();
 
-        if (fAddressIndex) {
-             for (unsigned int k = tx.vout.size(); k-- > 0;) {
-                const CTxOut &out = tx.vout[k];
-                 if (out.scriptPubKey.IsPayToScriptHash()) {
-                    std::vector<unsigned char> hashBytes(out.scriptPubKey.begin()+2, out.scriptPubKey.begin()+22);
-                     // undo receiving activity
-                    addressIndex.push_back(std::make_pair(CAddressIndexKey(2, uint160(hashBytes), pindex->nHeight, i, hash, k, false), out.nValue));
-                     // undo unspent index
-                    addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(2, uint160(hashBytes), hash, k), CAddressUnspentValue()));
-                 } else if (out.scriptPubKey.IsPayToPublicKeyHash()) {
-                    std::vector<unsigned char> hashBytes(out.scriptPubKey.begin()+3, out.scriptPubKey.begin()+23);
-                     // undo receiving activity
-                    addressIndex.push_back(std::make_pair(CAddressIndexKey(1, uint160(hashBytes), pindex->nHeight, i, hash, k, false), out.nValue));
-                     // undo unspent index
-                    addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(1, uint160(hashBytes), hash, k), CAddressUnspentValue()));
-                 } else {
-                    continue;
-                }
-             }
-         }
-
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
         for (size_t o = 0; o < tx.vout.size(); o++) {
@@ -1760,30 +1836,6 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
                 int res = ApplyTxInUndo(std::move(undo), view, out);
                 if (res == DISCONNECT_FAILED) return DISCONNECT_FAILED;
                 fClean = fClean && res != DISCONNECT_UNCLEAN;
-
-                const CTxIn input = tx.vin[j];
-                 if (fSpentIndex) {
-                    // undo and delete the spent index
-                    spentIndex.push_back(std::make_pair(CSpentIndexKey(input.prevout.hash, input.prevout.n), CSpentIndexValue()));
-                }
-                 if (fAddressIndex) {
-                    const CTxOut &prevout = view.AccessCoin(tx.vin[j].prevout).out;
-                    if (prevout.scriptPubKey.IsPayToScriptHash()) {
-                        std::vector<unsigned char> hashBytes(prevout.scriptPubKey.begin()+2, prevout.scriptPubKey.begin()+22);
-                         // undo spending activity
-                        addressIndex.push_back(std::make_pair(CAddressIndexKey(2, uint160(hashBytes), pindex->nHeight, i, hash, j, true), prevout.nValue * -1));
-                         // restore unspent index
-                        addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(2, uint160(hashBytes), input.prevout.hash, input.prevout.n), CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, undo.nHeight)));
-                     } else if (prevout.scriptPubKey.IsPayToPublicKeyHash()) {
-                        std::vector<unsigned char> hashBytes(prevout.scriptPubKey.begin()+3, prevout.scriptPubKey.begin()+23);
-                         // undo spending activity
-                        addressIndex.push_back(std::make_pair(CAddressIndexKey(1, uint160(hashBytes), pindex->nHeight, i, hash, j, true), prevout.nValue * -1));
-                         // restore unspent index
-                        addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(1, uint160(hashBytes), input.prevout.hash, input.prevout.n), CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, undo.nHeight)));
-                     } else {
-                        continue;
-                    }
-                }
             }
             // At this point, all of txundo.vprevout should have been moved out.
         }
@@ -1792,17 +1844,6 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
-    if (!ignoreAddressIndex && fAddressIndex) {
-        if (!pblocktree->EraseAddressIndex(addressIndex)) {
-            error("Failed to delete address index");
-            return DISCONNECT_FAILED;
-        }
-        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
-            error("Failed to write address unspent index");
-            return DISCONNECT_FAILED;
-        }
-    }
-
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
@@ -1971,7 +2012,7 @@ static int64_t nBlocksTotal = 0;
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
  *  can fail if those validity checks fail (among other reasons). */
 bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck, bool ignoreAddressIndex)
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
 {
     AssertLockHeld(cs_main);
     assert(pindex);
@@ -1993,7 +2034,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     // is enforced in ContextualCheckBlockHeader(); we wouldn't want to
     // re-enforce that rule here (at least until we make it impossible for
     // GetAdjustedTime() to go backward).
-    if (!CheckBlock(block, state, chainparams.GetConsensus(), !fJustCheck, !fJustCheck))
+    if (!CheckBlock(block, state, chainparams.GetConsensus(), !fJustCheck, !fJustCheck, pindex->nHeight))
         return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
 
     // verify that the view's current state corresponds to the previous block
@@ -2101,14 +2142,9 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     std::vector<PrecomputedTransactionData> txdata;
     txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
 
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
-    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
-
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = *(block.vtx[i]);
-        const uint256 txhash = tx.GetHash();
 
         nInputs += tx.vin.size();
 
@@ -2136,37 +2172,6 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
                 return state.DoS(100, error("%s: contains a non-BIP68-final transaction", __func__),
                                  REJECT_INVALID, "bad-txns-nonfinal");
             }
-
-            if (fAddressIndex || fSpentIndex)
-            {
-                for (size_t j = 0; j < tx.vin.size(); j++) {
-                     const CTxIn input = tx.vin[j];
-                    const CTxOut &prevout = view.AccessCoin(tx.vin[j].prevout).out;
-                    uint160 hashBytes;
-                    int addressType;
-                     if (prevout.scriptPubKey.IsPayToScriptHash()) {
-                        hashBytes = uint160(std::vector <unsigned char>(prevout.scriptPubKey.begin()+2, prevout.scriptPubKey.begin()+22));
-                        addressType = 2;
-                    } else if (prevout.scriptPubKey.IsPayToPublicKeyHash()) {
-                        hashBytes = uint160(std::vector <unsigned char>(prevout.scriptPubKey.begin()+3, prevout.scriptPubKey.begin()+23));
-                        addressType = 1;
-                    } else {
-                        hashBytes.SetNull();
-                        addressType = 0;
-                    }
-                     if (fAddressIndex && addressType > 0) {
-                        // record spending activity
-                        addressIndex.push_back(std::make_pair(CAddressIndexKey(addressType, hashBytes, pindex->nHeight, i, txhash, j, true), prevout.nValue * -1));
-                         // remove address from unspent index
-                        addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(addressType, hashBytes, input.prevout.hash, input.prevout.n), CAddressUnspentValue()));
-                    }
-                     if (fSpentIndex) {
-                        // add the spent index to determine the txid and input that spent an output
-                        // and to find the amount and address from an input
-                        spentIndex.push_back(std::make_pair(CSpentIndexKey(input.prevout.hash, input.prevout.n), CSpentIndexValue(txhash, j, pindex->nHeight, prevout.nValue, addressType, hashBytes)));
-                    }
-                }
-             }
         }
 
         // GetTransactionSigOpCost counts 3 types of sigops:
@@ -2189,27 +2194,6 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
             control.Add(vChecks);
         }
 
-        if (fAddressIndex) {
-            for (unsigned int k = 0; k < tx.vout.size(); k++) {
-                const CTxOut &out = tx.vout[k];
-                 if (out.scriptPubKey.IsPayToScriptHash()) {
-                    std::vector<unsigned char> hashBytes(out.scriptPubKey.begin()+2, out.scriptPubKey.begin()+22);
-                     // record receiving activity
-                    addressIndex.push_back(std::make_pair(CAddressIndexKey(2, uint160(hashBytes), pindex->nHeight, i, txhash, k, false), out.nValue));
-                     // record unspent output
-                    addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(2, uint160(hashBytes), txhash, k), CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight)));
-                 } else if (out.scriptPubKey.IsPayToPublicKeyHash()) {
-                    std::vector<unsigned char> hashBytes(out.scriptPubKey.begin()+3, out.scriptPubKey.begin()+23);
-                     // record receiving activity
-                    addressIndex.push_back(std::make_pair(CAddressIndexKey(1, uint160(hashBytes), pindex->nHeight, i, txhash, k, false), out.nValue));
-                     // record unspent output
-                    addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(1, uint160(hashBytes), txhash, k), CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight)));
-                 } else {
-                    continue;
-                }
-             }
-        }
-
         CTxUndo undoDummy;
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
@@ -2245,34 +2229,6 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     if (!WriteTxIndexDataForBlock(block, state, pindex))
         return false;
 
-    if (!ignoreAddressIndex && fAddressIndex) {
-        if (!pblocktree->WriteAddressIndex(addressIndex)) {
-            return AbortNode(state, "Failed to write address index");
-        }
-         if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
-            return AbortNode(state, "Failed to write address unspent index");
-        }
-    }
-     if (!ignoreAddressIndex && fSpentIndex)
-        if (!pblocktree->UpdateSpentIndex(spentIndex))
-            return AbortNode(state, "Failed to write transaction index");
-     if (!ignoreAddressIndex && fTimestampIndex) {
-        unsigned int logicalTS = pindex->nTime;
-        unsigned int prevLogicalTS = 0;
-         // retrieve logical timestamp of the previous block
-        if (pindex->pprev)
-            if (!pblocktree->ReadTimestampBlockIndex(pindex->pprev->GetBlockHash(), prevLogicalTS))
-                LogPrintf("%s: Failed to read previous block's logical timestamp\n", __func__);
-         if (logicalTS <= prevLogicalTS) {
-            logicalTS = prevLogicalTS + 1;
-            LogPrintf("%s: Previous logical timestamp is newer Actual[%d] prevLogical[%d] Logical[%d]\n", __func__, pindex->nTime, prevLogicalTS, logicalTS);
-        }
-         if (!pblocktree->WriteTimestampIndex(CTimestampIndexKey(logicalTS, pindex->GetBlockHash())))
-            return AbortNode(state, "Failed to write timestamp index");
-         if (!pblocktree->WriteTimestampBlockIndex(CTimestampBlockIndexKey(pindex->GetBlockHash()), CTimestampBlockIndexValue(logicalTS)))
-            return AbortNode(state, "Failed to write blockhash index");
-    }
-
     assert(pindex->phashBlock);
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
@@ -2359,19 +2315,24 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
                     vFiles.push_back(std::make_pair(*it, &vinfoBlockFile[*it]));
                     setDirtyFileInfo.erase(it++);
                 }
-                std::vector<const CBlockIndex*> vBlocks;
-                vBlocks.reserve(setDirtyBlockIndex.size());
-                for (std::set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
-                    vBlocks.push_back(*it);
-                    setDirtyBlockIndex.erase(it++);
-                }
+                std::vector<CBlockIndex*> vDirty(setDirtyBlockIndex.begin(), setDirtyBlockIndex.end());
+                setDirtyBlockIndex.clear();
+                std::vector<const CBlockIndex*> vBlocks(vDirty.begin(), vDirty.end());
                 if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
                     return AbortNode(state, "Failed to write to block index database");
                 }
+                // Solutions are only needed again to serve headers, so read
+                // them back from the block tree DB instead of keeping them.
+                for (CBlockIndex* pindex : vDirty)
+                    pindex->TrimSolution();
             }
-            // Finally remove any pruned files
-            if (fFlushForPrune)
+            // Finally remove any pruned files. A coins write still in flight
+            // could need blocks from them to be replayed after a crash.
+            if (fFlushForPrune) {
+                if (!pcoinsdbview->WaitForFlush())
+                    return AbortNode(state, "Failed to write to coin database");
                 UnlinkPrunedFiles(setFilesToPrune);
+            }
             nLastWrite = nNow;
         }
         // Flush best chain related state. This can only be done if the blocks / block index write was also done.
@@ -2386,6 +2347,10 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             // Flush the chainstate (which may refer to block index entries).
             if (!pcoinsTip->Flush())
                 return AbortNode(state, "Failed to write to coin database");
+            // With -asynccoinsflush the coins are written in the background;
+            // explicit flushes and pruning still wait for them to be on disk.
+            if ((mode == FLUSH_STATE_ALWAYS || fFlushForPrune) && !pcoinsdbview->WaitForFlush())
+                return AbortNode(state, "Failed to write to coin database");
             nLastFlush = nNow;
         }
     }
@@ -3256,18 +3221,23 @@ static bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos,
     return true;
 }
 
-static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true)
+static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, int nHeight = -1)
 {
     // Check Equihash solution is valid
     if (fCheckPOW)
     {
-        if (CheckEquihashSolution(&block, Params(), "GENX_PoW"))
+        // Blocks are mined with the personalization for their height, so a
+        // valid header passes the first check and only invalid ones pay for
+        // the second. Without a known height (-1) assume a recent block.
+        const CChainParams& chainparams = Params();
+        const bool fAfterSwitch = nHeight < 0 || chainparams.IsAfterSwitch(nHeight);
+        if (CheckEquihashSolution(&block, chainparams, fAfterSwitch ? "GENX_PoW" : "SafeCash"))
         {
-            // LogPrintf("CheckBlockHeader(): Found solution using GENX_PoW at height: %d\n", block.nHeight);
+            // LogPrintf("CheckBlockHeader(): Found solution using expected personalization at height: %d\n", nHeight);
         }
-        else if (IsInitialBlockDownload && CheckEquihashSolution(&block, Params(), "SafeCash"))
+        else if (CheckEquihashSolution(&block, chainparams, fAfterSwitch ? "SafeCash" : "GENX_PoW"))
         {
-            // LogPrintf("CheckBlockHeader(): Found solution using SafeCash at height: %d\n", block.nHeight);
+            // LogPrintf("CheckBlockHeader(): Found solution using other personalization at height: %d\n", nHeight);
         }
         else if (block.GetHash() == Params().GetConsensus().hashGenesisBlock)
         {
@@ -3276,7 +3246,7 @@ static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state,
         else
         {
             // Nothing worked... bugger.
-            LogPrintf("CheckBlockHeader(): Equihash solution invalid at height %d\n", block.nHeight);
+            LogPrintf("CheckBlockHeader(): Equihash solution invalid at height %d\n", nHeight);
             return state.DoS(100, error("CheckBlockHeader(): Equihash solution invalid"),
                     REJECT_INVALID, "invalid-solution");
         }
@@ -3288,7 +3258,40 @@ static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state,
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot)
+/**
+ * Closure representing the context-free checks of one header, which are
+ * dominated by the Equihash solution. Run on equihashcheckqueue so that
+ * ProcessNewBlockHeaders can verify a whole batch before taking cs_main.
+ */
+class CEquihashCheck
+{
+private:
+    const CBlockHeader *pheader;
+    int nHeight;
+
+public:
+    CEquihashCheck(): pheader(nullptr), nHeight(-1) {}
+    CEquihashCheck(const CBlockHeader& header, int nHeightIn) : pheader(&header), nHeight(nHeightIn) {}
+
+    bool operator()() {
+        CValidationState state;
+        return CheckBlockHeader(*pheader, state, Params().GetConsensus(), true, nHeight);
+    }
+
+    void swap(CEquihashCheck &check) {
+        std::swap(pheader, check.pheader);
+        std::swap(nHeight, check.nHeight);
+    }
+};
+
+static CCheckQueue<CEquihashCheck> equihashcheckqueue(16);
+
+void ThreadEquihashCheck() {
+    RenameThread("genesis-ehcheck");
+    equihashcheckqueue.Thread();
+}
+
+bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot, int nHeight)
 {
     // These are checks that are independent of context.
 
@@ -3297,7 +3300,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
 
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
-    if (!CheckBlockHeader(block, state, consensusParams, fCheckPOW))
+    if (!CheckBlockHeader(block, state, consensusParams, fCheckPOW, nHeight))
         return false;
 
     // Check the merkle root.
@@ -3625,7 +3628,7 @@ static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, c
     return true;
 }
 
-bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fCheckPOW)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -3644,12 +3647,14 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
-            return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
-
         // Get prev block index
         CBlockIndex* pindexPrev = nullptr;
         BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+
+        int nHeight = mi != mapBlockIndex.end() ? mi->second->nHeight + 1 : -1;
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), fCheckPOW, nHeight))
+            return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
+
         if (mi == mapBlockIndex.end())
             return state.DoS(10, error("%s: prev block not found", __func__), 0, "prev-blk-not-found");
         pindexPrev = (*mi).second;
@@ -3688,11 +3693,47 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, CBlockHeader *first_invalid)
 {
     if (first_invalid != nullptr) first_invalid->SetNull();
+
+    // Verify the solutions of the headers we don't know yet on the check
+    // queue before taking cs_main for the whole batch. If any of them fails,
+    // everything is checked again one by one under the lock below, so the
+    // first invalid header is still the one reported.
+    bool fPOWChecked = false;
+    if (nScriptCheckThreads && headers.size() > 1) {
+        std::vector<uint256> vHashes;
+        vHashes.reserve(headers.size());
+        for (const CBlockHeader& header : headers) {
+            vHashes.push_back(header.GetHash());
+        }
+
+        std::vector<CEquihashCheck> vChecks;
+        vChecks.reserve(headers.size());
+        {
+            LOCK(cs_main);
+            int nHeight = -1;
+            for (size_t i = 0; i < headers.size(); i++) {
+                if (i > 0 && headers[i].hashPrevBlock == vHashes[i-1]) {
+                    nHeight = nHeight < 0 ? -1 : nHeight + 1;
+                } else {
+                    BlockMap::iterator mi = mapBlockIndex.find(headers[i].hashPrevBlock);
+                    nHeight = mi != mapBlockIndex.end() ? mi->second->nHeight + 1 : -1;
+                }
+                if (!mapBlockIndex.count(vHashes[i])) {
+                    vChecks.emplace_back(headers[i], nHeight);
+                }
+            }
+        }
+
+        CCheckQueueControl<CEquihashCheck> control(&equihashcheckqueue);
+        control.Add(vChecks);
+        fPOWChecked = control.Wait();
+    }
+
     {
         LOCK(cs_main);
         for (const CBlockHeader& header : headers) {
             CBlockIndex *pindex = nullptr; // Use a temp pindex instead of ppindex to avoid a const_cast
-            if (!g_chainstate.AcceptBlockHeader(header, state, chainparams, &pindex)) {
+            if (!g_chainstate.AcceptBlockHeader(header, state, chainparams, &pindex, !fPOWChecked)) {
                 if (first_invalid) *first_invalid = header;
                 return false;
             }
@@ -3778,7 +3819,7 @@ bool CChainState::AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CVali
 
     if (fNewBlock) *fNewBlock = true;
 
-    if (!CheckBlock(block, state, chainparams.GetConsensus()) ||
+    if (!CheckBlock(block, state, chainparams.GetConsensus(), true, true, pindex->nHeight) ||
         !ContextualCheckBlock(block, state, chainparams.GetConsensus(), pindex->pprev)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
@@ -3822,8 +3863,16 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
         if (fNewBlock) *fNewBlock = false;
         CValidationState state;
         // Ensure that CheckBlock() passes before calling AcceptBlock, as
-        // belt-and-suspenders.
-        bool ret = CheckBlock(*pblock, state, chainparams.GetConsensus());
+        // belt-and-suspenders. Only look up the height here so the Equihash
+        // check itself runs without cs_main.
+        int nHeight = -1;
+        {
+            LOCK(cs_main);
+            BlockMap::iterator mi = mapBlockIndex.find(pblock->hashPrevBlock);
+            if (mi != mapBlockIndex.end())
+                nHeight = mi->second->nHeight + 1;
+        }
+        bool ret = CheckBlock(*pblock, state, chainparams.GetConsensus(), true, true, nHeight);
 
         LOCK(cs_main);
 
@@ -3858,7 +3907,7 @@ bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams,
     // NOTE: CheckBlockHeader is called by CheckBlock
     if (!ContextualCheckBlockHeader(block, state, chainparams, pindexPrev, GetAdjustedTime()))
         return error("%s: Consensus::ContextualCheckBlockHeader: %s", __func__, FormatStateMessage(state));
-    if (!CheckBlock(block, state, chainparams.GetConsensus(), fCheckPOW, fCheckMerkleRoot))
+    if (!CheckBlock(block, state, chainparams.GetConsensus(), fCheckPOW, fCheckMerkleRoot, indexDummy.nHeight))
         return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
     if (!ContextualCheckBlock(block, state, chainparams.GetConsensus(), pindexPrev))
         return error("%s: Consensus::ContextualCheckBlock: %s", __func__, FormatStateMessage(state));
@@ -4090,8 +4139,10 @@ CBlockIndex * CChainState::InsertBlockIndex(const uint256& hash)
 
 bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlockTreeDB& blocktree)
 {
+    int64_t nTimeStart = GetTimeMicros();
     if (!blocktree.LoadBlockIndexGuts(consensus_params, [this](const uint256& hash){ return this->InsertBlockIndex(hash); }))
         return false;
+    int64_t nTimeGuts = GetTimeMicros();
 
     boost::this_thread::interruption_point();
 
@@ -4136,6 +4187,8 @@ bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlo
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == nullptr || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
+    LogPrintf("%s: loaded %u entries in %.2fs, linked chain work in %.2fs\n", __func__, mapBlockIndex.size(),
+        (nTimeGuts - nTimeStart) * 0.000001, (GetTimeMicros() - nTimeGuts) * 0.000001);
 
     return true;
 }
@@ -4164,6 +4217,7 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
 
     // Check presence of blk files
     LogPrintf("Checking all blk files are present...\n");
+    int64_t nTimeFiles = GetTimeMicros();
     std::set<int> setBlkDataFiles;
     for (const std::pair<uint256, CBlockIndex*>& item : mapBlockIndex)
     {
@@ -4179,6 +4233,7 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
             return false;
         }
     }
+    LogPrintf("%s: checked %u blk files in %.2fs\n", __func__, setBlkDataFiles.size(), (GetTimeMicros() - nTimeFiles) * 0.000001);
 
     // Check whether we have ever pruned block & undo files
     pblocktree->ReadFlag("prunedblockfiles", fHavePruned);
@@ -4194,9 +4249,27 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
 
+    // Older versions kept the indexes in the block tree DB
+    if (!pindexdb->MigrateFromBlockTree(*pblocktree))
+        return error("%s: failed to move the indexes to their own database", __func__);
+    if (!pindexdb->Upgrade())
+        return error("%s: failed to upgrade the index database", __func__);
+
     // Check whether we have an address index
     pblocktree->ReadFlag("addressindex", fAddressIndex);
     LogPrintf("%s: address index %s\n", __func__, fAddressIndex ? "enabled" : "disabled");
+    if (fAddressIndex) {
+        // Address indexes written before balance records existed need them built once
+        bool fAddressBalance = false;
+        pblocktree->ReadFlag("addressbalance", fAddressBalance);
+        if (!fAddressBalance) {
+            LogPrintf("%s: building address balance records...\n", __func__);
+            uiInterface.InitMessage(_("Building address balances..."));
+            if (!pindexdb->BuildAddressBalanceIndex())
+                return error("%s: failed to build address balance records", __func__);
+            pblocktree->WriteFlag("addressbalance", true);
+        }
+    }
      // Check whether we have a timestamp index
     pblocktree->ReadFlag("timestampindex", fTimestampIndex);
     LogPrintf("%s: timestamp index %s\n", __func__, fTimestampIndex ? "enabled" : "disabled");
@@ -4286,7 +4359,7 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
             return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
         // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams.GetConsensus()))
+        if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams.GetConsensus(), true, true, pindex->nHeight))
             return error("%s: *** found bad block at %d, hash=%s (%s)\n", __func__,
                          pindex->nHeight, pindex->GetBlockHash().ToString(), FormatStateMessage(state));
         // check level 2: verify undo validity
@@ -4301,7 +4374,7 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
         if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             assert(coins.GetBestBlock() == pindex->GetBlockHash());
-            DisconnectResult res = g_chainstate.DisconnectBlock(block, pindex, coins, true);
+            DisconnectResult res = g_chainstate.DisconnectBlock(block, pindex, coins);
             if (res == DISCONNECT_FAILED) {
                 return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
             }
@@ -4329,7 +4402,7 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
             CBlock block;
             if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
                 return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            if (!g_chainstate.ConnectBlock(block, state, pindex, coins, chainparams, false, true))
+            if (!g_chainstate.ConnectBlock(block, state, pindex, coins, chainparams))
                 return error("VerifyDB(): *** found unconnectable block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
         }
     }
@@ -4401,7 +4474,7 @@ bool CChainState::ReplayBlocks(const CChainParams& params, CCoinsView* view)
             }
             LogPrintf("Rolling back %s (%i)\n", pindexOld->GetBlockHash().ToString(), pindexOld->nHeight);
             // just check, do not update the address index
-            DisconnectResult res = DisconnectBlock(block, pindexOld, cache, true);
+            DisconnectResult res = DisconnectBlock(block, pindexOld, cache);
             if (res == DISCONNECT_FAILED) {
                 return error("RollbackBlock(): DisconnectBlock failed at %d, hash=%s", pindexOld->nHeight, pindexOld->GetBlockHash().ToString());
             }
@@ -4595,6 +4668,7 @@ bool LoadBlockIndex(const CChainParams& chainparams)
          // Use the provided setting for -addressindex in the new database
         fAddressIndex = gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
         pblocktree->WriteFlag("addressindex", fAddressIndex);
+        pblocktree->WriteFlag("addressbalance", true);
          LogPrintf("%s: address index %s\n", __func__, fAddressIndex ? "enabled" : "disabled");
          // Use the provided setting for -timestampindex in the new database
         fTimestampIndex = gArgs.GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX);
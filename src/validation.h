@@ -36,6 +36,8 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
+class CIndexDB;
 class CChainParams;
 class CCoinsViewDB;
 class CInv;
@@ -290,12 +292,19 @@ bool LoadChainTip(const CChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the header Equihash checking thread */
+void ThreadEquihashCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 bool GetTransaction(const uint256& hash, CTransactionRef& tx, const Consensus::Params& params, uint256& hashBlock, bool fAllowSlow = false, CBlockIndex* blockIndex = nullptr);
+/** Abort with a message: warn, log, notify the user and shut down. Always returns false. */
+bool AbortNode(const std::string& strMessage, const std::string& userMessage = "");
 /** Find the best known block, and make it the tip of the block chain */
 bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams, std::shared_ptr<const CBlock> pblock = std::shared_ptr<const CBlock>());
+/** Subsidy at nHeight given the hash of the block COINBASE_MATURITY below it, which only normal blocks depend on */
+CAmount GetBlockSubsidy(int nHeight, const uint256& confirmedHash, const Consensus::Params& consensusParams);
+/** Subsidy at nHeight on the active chain. Requires cs_main; see also CSubsidyCache. */
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams);
 
 /** Guess verification progress (as a fraction between 0.0=genesis and 1.0=current tip). */
@@ -416,21 +425,34 @@ void InitScriptExecutionCache();
 
 bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &hashes);
 bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
+/** Look up many spent index entries at once, reading those not in the mempool from disk in one pass */
+size_t GetSpentIndexes(const std::vector<CSpentIndexKey> &keys, std::vector<CSpentIndexValue> &values, std::vector<bool> &found);
 bool HashOnchainActive(const uint256 &hash);
 bool GetAddressIndex(uint160 addressHash, int type,
                      std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
                      int start = 0, int end = 0);
 bool GetAddressUnspent(uint160 addressHash, int type,
                        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs);
+bool GetAddressIndexPage(uint160 addressHash, int type, int start, int end, bool fReverse, size_t nLimit,
+                         CAddressIndexKey &cursor, std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex);
+bool GetAddressUnspentPage(uint160 addressHash, int type, bool fReverse, size_t nLimit, CAddressUnspentKey &cursor,
+                           std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs);
+bool GetAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value);
 
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** The solution of pindex, read from the block tree DB if the index entry no longer holds it.
+ *  Requires cs_main, under which flushing trims the in-memory solution. */
+bool ReadBlockSolution(const CBlockIndex* pindex, std::vector<unsigned char>& solution);
+/** The header of pindex, with its solution read as by ReadBlockSolution. */
+bool ReadBlockHeader(const CBlockIndex* pindex, CBlockHeader& header);
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex);
 
 /** Functions for validating blocks and updating the block tree */
 
 /** Context-independent validity checks */
-bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
+bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true, int nHeight = -1);
 
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
@@ -482,6 +504,9 @@ extern std::unique_ptr<CCoinsViewCache> pcoinsTip;
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern std::unique_ptr<CBlockTreeDB> pblocktree;
 
+/** Global variable that points to the address, spent and timestamp indexes */
+extern std::unique_ptr<CIndexDB> pindexdb;
+
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by cs_main)
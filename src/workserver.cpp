@@ -0,0 +1,519 @@
+// Copyright (c) 2018 The Genesis Official developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <workserver.h>
+
+#include <arith_uint256.h>
+#include <chain.h>
+#include <chainparams.h>
+#include <compat.h>
+#include <crypto/common.h>
+#include <miner.h>
+#include <pow.h>
+#include <primitives/block.h>
+#include <streams.h>
+#include <txmempool.h>
+#include <util.h>
+#include <utilstrencodings.h>
+#include <validation.h>
+#include <validationinterface.h>
+#include <version.h>
+
+#include <univalue.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+#include <event2/listener.h>
+#include <event2/thread.h>
+#include <event2/util.h>
+
+/** Longest request line accepted; a 200,9 solution is under 3000 hex digits */
+static const size_t WORKSERVER_MAX_LINE_LENGTH = 16384;
+/** Maximum number of connections served at once */
+static const size_t WORKSERVER_MAX_CONNECTIONS = 64;
+/** Jobs kept per tip, so that work on a job replaced by a refresh still counts */
+static const size_t WORKSERVER_MAX_JOBS = 16;
+
+static_assert(WORKSERVER_NONCE1_SIZE == sizeof(uint32_t), "NONCE_1 is a connection counter");
+
+/** Stratum error codes */
+enum WorkServerErrorCode
+{
+    WORKSERVER_ERROR_OTHER = 20,
+    WORKSERVER_ERROR_JOB_NOT_FOUND = 21,
+    WORKSERVER_ERROR_DUPLICATE = 22,
+    WORKSERVER_ERROR_LOW_DIFFICULTY = 23,
+    WORKSERVER_ERROR_NOT_SUBSCRIBED = 25,
+};
+
+static UniValue WorkServerError(WorkServerErrorCode code, const std::string& message)
+{
+    UniValue error(UniValue::VARR);
+    error.push_back((int)code);
+    error.push_back(message);
+    error.push_back(NullUniValue);
+    return error;
+}
+
+/** Header fields are sent as their serialization, as they go into the Equihash input */
+template <typename T>
+static std::string SerializeHex(const T& obj)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << obj;
+    return HexStr(ss.begin(), ss.end());
+}
+
+/** Deserialize obj from value, which must be hex of exactly its serialization */
+template <typename T>
+static bool UnserializeHex(const UniValue& value, T& obj)
+{
+    if (!value.isStr() || !IsHex(value.get_str()))
+        return false;
+    CDataStream ss(ParseHex(value.get_str()), SER_NETWORK, PROTOCOL_VERSION);
+    try {
+        ss >> obj;
+    } catch (const std::exception&) {
+        return false;
+    }
+    return ss.empty();
+}
+
+class CWorkServer;
+
+/** A miner or pool front end connected to the work server */
+struct CWorkServerConnection
+{
+    CWorkServerConnection(CWorkServer* serverIn, struct bufferevent* bevIn, uint32_t nId) :
+        server(serverIn), bev(bevIn), fSubscribed(false)
+    {
+        WriteLE32(nonce1, nId);
+    }
+    ~CWorkServerConnection()
+    {
+        bufferevent_free(bev);
+    }
+
+    CWorkServer* server;
+    struct bufferevent* bev;
+    /** Leading bytes of the header nonce in all of this connection's work */
+    unsigned char nonce1[WORKSERVER_NONCE1_SIZE];
+    bool fSubscribed;
+};
+
+/**
+ * Owns the jobs and connections, which are only touched from the thread
+ * running its event base. Tip changes arrive on the validation queue and
+ * are handed to that thread by activating an event.
+ */
+class CWorkServer final : public CValidationInterface
+{
+public:
+    CWorkServer(struct event_base* base, const CScript& scriptPubKey);
+    ~CWorkServer();
+
+    /** Listen on 127.0.0.1:nPort, or an ephemeral port if nPort is 0 */
+    bool Listen(uint16_t nPort);
+    uint16_t GetPort() const;
+
+protected:
+    // CValidationInterface
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
+
+private:
+    struct event_base* base;
+    struct evconnlistener* listener;
+    /** Activated when the tip changes, from whichever thread reports it */
+    struct event* evNewTip;
+    /** Periodic check for mempool changes */
+    struct event* evRefresh;
+    const CScript scriptPubKey;
+
+    std::map<struct bufferevent*, std::unique_ptr<CWorkServerConnection>> connections;
+    /** Jobs on the current tip by id, oldest first */
+    std::map<std::string, std::unique_ptr<CBlockTemplate>> jobs;
+    uint32_t nNextJobId;
+    uint32_t nNextConnectionId;
+    unsigned int nExtraNonce;
+    unsigned int nTransactionsUpdatedLast;
+
+    /** Assemble a job on the current tip and send it to every subscriber */
+    void NewJob(bool fClean);
+    void SendJob(CWorkServerConnection& conn, bool fClean);
+    void Notify(CWorkServerConnection& conn, const std::string& strMethod, const UniValue& params);
+    void Reply(CWorkServerConnection& conn, const UniValue& id, const UniValue& result, const UniValue& error);
+    void Send(CWorkServerConnection& conn, const UniValue& msg);
+    void HandleRequest(CWorkServerConnection& conn, const std::string& line);
+    /** Check a mining.submit and process the block; false and error if it is rejected */
+    bool Submit(const CWorkServerConnection& conn, const UniValue& params, UniValue& error);
+    void Disconnect(CWorkServerConnection& conn);
+
+    /** Libevent handlers: internal */
+    static void acceptcb(struct evconnlistener* listener, evutil_socket_t fd, struct sockaddr* addr, int socklen, void* ctx);
+    static void readcb(struct bufferevent* bev, void* ctx);
+    static void eventcb(struct bufferevent* bev, short what, void* ctx);
+    static void newtipcb(evutil_socket_t fd, short what, void* ctx);
+    static void refreshcb(evutil_socket_t fd, short what, void* ctx);
+};
+
+CWorkServer::CWorkServer(struct event_base* _base, const CScript& scriptPubKeyIn) :
+    base(_base), listener(nullptr), scriptPubKey(scriptPubKeyIn),
+    nNextJobId(0), nNextConnectionId(0), nExtraNonce(0), nTransactionsUpdatedLast(0)
+{
+    evNewTip = event_new(base, -1, 0, newtipcb, this);
+    evRefresh = event_new(base, -1, EV_PERSIST, refreshcb, this);
+    struct timeval tv = {WORKSERVER_REFRESH_INTERVAL, 0};
+    event_add(evRefresh, &tv);
+}
+
+CWorkServer::~CWorkServer()
+{
+    connections.clear();
+    if (listener)
+        evconnlistener_free(listener);
+    event_free(evRefresh);
+    event_free(evNewTip);
+}
+
+bool CWorkServer::Listen(uint16_t nPort)
+{
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sin.sin_port = htons(nPort);
+    listener = evconnlistener_new_bind(base, acceptcb, this, LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE, -1,
+                                       (struct sockaddr*)&sin, sizeof(sin));
+    if (!listener)
+        return false;
+    // Assemble the first job as soon as the event loop runs
+    event_active(evNewTip, 0, 0);
+    return true;
+}
+
+uint16_t CWorkServer::GetPort() const
+{
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+    if (!listener || getsockname(evconnlistener_get_fd(listener), (struct sockaddr*)&sin, &len) != 0)
+        return 0;
+    return ntohs(sin.sin_port);
+}
+
+void CWorkServer::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    if (fInitialDownload || pindexNew == pindexFork) // In IBD or blocks were disconnected without any new ones
+        return;
+    event_active(evNewTip, 0, 0);
+}
+
+void CWorkServer::NewJob(bool fClean)
+{
+    if (IsInitialBlockDownload())
+        return;
+
+    const unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    try {
+        LOCK(cs_main);
+        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptPubKey);
+        if (pblocktemplate)
+            IncrementExtraNonce(&pblocktemplate->block, chainActive.Tip(), nExtraNonce);
+    } catch (const std::runtime_error& e) {
+        LogPrintf("workserver: Unable to assemble a block: %s\n", e.what());
+        return;
+    }
+    if (!pblocktemplate)
+        return;
+    nTransactionsUpdatedLast = nTransactionsUpdated;
+
+    // Work on an older tip can no longer make a block
+    if (!jobs.empty() && jobs.rbegin()->second->block.hashPrevBlock != pblocktemplate->block.hashPrevBlock)
+        fClean = true;
+    if (fClean)
+        jobs.clear();
+    else if (jobs.size() >= WORKSERVER_MAX_JOBS)
+        jobs.erase(jobs.begin());
+    jobs[strprintf("%08x", nNextJobId++)] = std::move(pblocktemplate);
+
+    for (auto& it : connections) {
+        if (it.second->fSubscribed)
+            SendJob(*it.second, fClean);
+    }
+}
+
+void CWorkServer::SendJob(CWorkServerConnection& conn, bool fClean)
+{
+    const std::string& strJobId = jobs.rbegin()->first;
+    const CBlock& block = jobs.rbegin()->second->block;
+
+    // nBits only changes along with the tip, so the target goes with clean jobs
+    if (fClean) {
+        UniValue target(UniValue::VARR);
+        target.push_back(ArithToUint256(arith_uint256().SetCompact(block.nBits)).GetHex());
+        Notify(conn, "mining.set_target", target);
+    }
+
+    UniValue params(UniValue::VARR);
+    params.push_back(strJobId);
+    params.push_back(SerializeHex(block.nVersion));
+    params.push_back(SerializeHex(block.hashPrevBlock));
+    params.push_back(SerializeHex(block.hashMerkleRoot));
+    params.push_back(SerializeHex(block.hashReserved));
+    params.push_back(SerializeHex(block.nTime));
+    params.push_back(SerializeHex(block.nBits));
+    params.push_back(UniValue(fClean));
+    Notify(conn, "mining.notify", params);
+}
+
+void CWorkServer::Notify(CWorkServerConnection& conn, const std::string& strMethod, const UniValue& params)
+{
+    UniValue msg(UniValue::VOBJ);
+    msg.push_back(Pair("id", NullUniValue));
+    msg.push_back(Pair("method", strMethod));
+    msg.push_back(Pair("params", params));
+    Send(conn, msg);
+}
+
+void CWorkServer::Reply(CWorkServerConnection& conn, const UniValue& id, const UniValue& result, const UniValue& error)
+{
+    UniValue msg(UniValue::VOBJ);
+    msg.push_back(Pair("id", id));
+    msg.push_back(Pair("result", result));
+    msg.push_back(Pair("error", error));
+    Send(conn, msg);
+}
+
+void CWorkServer::Send(CWorkServerConnection& conn, const UniValue& msg)
+{
+    const std::string strMsg = msg.write() + "\n";
+    evbuffer_add(bufferevent_get_output(conn.bev), strMsg.data(), strMsg.size());
+}
+
+void CWorkServer::HandleRequest(CWorkServerConnection& conn, const std::string& line)
+{
+    UniValue request;
+    if (!request.read(line) || !request.isObject()) {
+        LogPrint(BCLog::POW, "workserver: Ignoring malformed request\n");
+        return;
+    }
+    const UniValue& id = find_value(request, "id");
+    const UniValue& method = find_value(request, "method");
+    const UniValue& params = find_value(request, "params");
+    const std::string strMethod = method.isStr() ? method.get_str() : "";
+
+    if (strMethod == "mining.subscribe") {
+        // Sessions are not resumable, so the session id is always null
+        UniValue result(UniValue::VARR);
+        result.push_back(NullUniValue);
+        result.push_back(HexStr(conn.nonce1, conn.nonce1 + WORKSERVER_NONCE1_SIZE));
+        conn.fSubscribed = true;
+        Reply(conn, id, result, NullUniValue);
+        if (!jobs.empty())
+            SendJob(conn, true);
+    } else if (strMethod == "mining.authorize") {
+        // Only local clients can connect, and every block pays to the same
+        // script, so any worker name is accepted
+        Reply(conn, id, true, NullUniValue);
+    } else if (strMethod == "mining.submit") {
+        UniValue error;
+        const bool fAccepted = Submit(conn, params, error);
+        Reply(conn, id, fAccepted ? UniValue(true) : NullUniValue, error);
+    } else {
+        Reply(conn, id, NullUniValue, WorkServerError(WORKSERVER_ERROR_OTHER, "Method not found"));
+    }
+}
+
+bool CWorkServer::Submit(const CWorkServerConnection& conn, const UniValue& params, UniValue& error)
+{
+    // [WORKER_NAME, JOB_ID, TIME, NONCE_2, EQUIHASH_SOLUTION]
+    if (!conn.fSubscribed) {
+        error = WorkServerError(WORKSERVER_ERROR_NOT_SUBSCRIBED, "Not subscribed");
+        return false;
+    }
+    if (!params.isArray() || params.size() < 5 || !params[1].isStr()) {
+        error = WorkServerError(WORKSERVER_ERROR_OTHER, "Malformed submission");
+        return false;
+    }
+    auto it = jobs.find(params[1].get_str());
+    if (it == jobs.end()) {
+        error = WorkServerError(WORKSERVER_ERROR_JOB_NOT_FOUND, "Job not found");
+        return false;
+    }
+    CBlock block = it->second->block;
+    const std::vector<unsigned char> nonce2 = params[3].isStr() && IsHex(params[3].get_str()) ? ParseHex(params[3].get_str()) : std::vector<unsigned char>();
+    if (nonce2.size() != block.nNonce.size() - WORKSERVER_NONCE1_SIZE ||
+        !UnserializeHex(params[2], block.nTime) || !UnserializeHex(params[4], block.nSolution)) {
+        error = WorkServerError(WORKSERVER_ERROR_OTHER, "Malformed submission");
+        return false;
+    }
+    std::copy(conn.nonce1, conn.nonce1 + WORKSERVER_NONCE1_SIZE, block.nNonce.begin());
+    std::copy(nonce2.begin(), nonce2.end(), block.nNonce.begin() + WORKSERVER_NONCE1_SIZE);
+
+    // Accept either personalization, as CheckBlockHeader does
+    const CChainParams& chainparams = Params();
+    const bool fAfterSwitch = chainparams.IsAfterSwitch(block.nHeight);
+    if (!CheckEquihashSolution(&block, chainparams, fAfterSwitch ? "GENX_PoW" : "SafeCash") &&
+        !CheckEquihashSolution(&block, chainparams, fAfterSwitch ? "SafeCash" : "GENX_PoW")) {
+        error = WorkServerError(WORKSERVER_ERROR_OTHER, "Invalid solution");
+        return false;
+    }
+    // Only whole blocks are of use to the node, so the block target is the share target
+    if (UintToArith256(block.GetHash()) > arith_uint256().SetCompact(block.nBits)) {
+        error = WorkServerError(WORKSERVER_ERROR_LOW_DIFFICULTY, "Above target");
+        return false;
+    }
+
+    bool fNewBlock = false;
+    std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(block);
+    if (!ProcessNewBlock(chainparams, shared_pblock, true, &fNewBlock)) {
+        error = WorkServerError(WORKSERVER_ERROR_OTHER, "Block rejected");
+        return false;
+    }
+    if (!fNewBlock) {
+        error = WorkServerError(WORKSERVER_ERROR_DUPLICATE, "Duplicate block");
+        return false;
+    }
+    LogPrintf("workserver: Accepted block %s from %s\n", block.GetHash().ToString(),
+              params[0].isStr() ? SanitizeString(params[0].get_str()) : "");
+    return true;
+}
+
+void CWorkServer::Disconnect(CWorkServerConnection& conn)
+{
+    connections.erase(conn.bev);
+}
+
+void CWorkServer::acceptcb(struct evconnlistener*, evutil_socket_t fd, struct sockaddr*, int, void* ctx)
+{
+    CWorkServer* self = (CWorkServer*)ctx;
+    if (self->connections.size() >= WORKSERVER_MAX_CONNECTIONS) {
+        LogPrintf("workserver: Refusing connection, %u already open\n", self->connections.size());
+        evutil_closesocket(fd);
+        return;
+    }
+    struct bufferevent* bev = bufferevent_socket_new(self->base, fd, BEV_OPT_CLOSE_ON_FREE);
+    if (!bev) {
+        evutil_closesocket(fd);
+        return;
+    }
+    std::unique_ptr<CWorkServerConnection> conn(new CWorkServerConnection(self, bev, self->nNextConnectionId++));
+    bufferevent_setcb(bev, CWorkServer::readcb, nullptr, CWorkServer::eventcb, conn.get());
+    bufferevent_enable(bev, EV_READ|EV_WRITE);
+    self->connections[bev] = std::move(conn);
+    LogPrint(BCLog::POW, "workserver: Accepted connection\n");
+}
+
+void CWorkServer::readcb(struct bufferevent* bev, void* ctx)
+{
+    CWorkServerConnection* conn = (CWorkServerConnection*)ctx;
+    struct evbuffer* input = bufferevent_get_input(bev);
+    size_t n_read_out = 0;
+    char* line;
+    //  If there is not a whole line to read, evbuffer_readln returns nullptr
+    while ((line = evbuffer_readln(input, &n_read_out, EVBUFFER_EOL_CRLF)) != nullptr) {
+        std::string s(line, n_read_out);
+        free(line);
+        conn->server->HandleRequest(*conn, s);
+    }
+    //  Everything left is an incomplete line
+    if (evbuffer_get_length(input) > WORKSERVER_MAX_LINE_LENGTH) {
+        LogPrintf("workserver: Disconnecting because WORKSERVER_MAX_LINE_LENGTH exceeded\n");
+        conn->server->Disconnect(*conn);
+    }
+}
+
+void CWorkServer::eventcb(struct bufferevent* bev, short what, void* ctx)
+{
+    CWorkServerConnection* conn = (CWorkServerConnection*)ctx;
+    if (what & (BEV_EVENT_EOF|BEV_EVENT_ERROR)) {
+        LogPrint(BCLog::POW, "workserver: Connection closed\n");
+        conn->server->Disconnect(*conn);
+    }
+}
+
+void CWorkServer::newtipcb(evutil_socket_t fd, short what, void* ctx)
+{
+    ((CWorkServer*)ctx)->NewJob(true);
+}
+
+void CWorkServer::refreshcb(evutil_socket_t fd, short what, void* ctx)
+{
+    CWorkServer* self = (CWorkServer*)ctx;
+    if (!self->jobs.empty() && mempool.GetTransactionsUpdated() != self->nTransactionsUpdatedLast)
+        self->NewJob(false);
+}
+
+/****** Thread ********/
+static struct event_base* gWorkServerBase;
+static std::unique_ptr<CWorkServer> gWorkServer;
+static boost::thread workServerThread;
+
+static void WorkServerThread()
+{
+    event_base_dispatch(gWorkServerBase);
+}
+
+bool StartWorkServer(uint16_t nPort, const CScript& scriptPubKey)
+{
+    assert(!gWorkServerBase);
+#ifdef WIN32
+    evthread_use_windows_threads();
+#else
+    evthread_use_pthreads();
+#endif
+    gWorkServerBase = event_base_new();
+    if (!gWorkServerBase) {
+        LogPrintf("workserver: Unable to create event_base\n");
+        return false;
+    }
+    gWorkServer.reset(new CWorkServer(gWorkServerBase, scriptPubKey));
+    if (!gWorkServer->Listen(nPort)) {
+        LogPrintf("workserver: Unable to listen on port %u\n", nPort);
+        gWorkServer.reset();
+        event_base_free(gWorkServerBase);
+        gWorkServerBase = nullptr;
+        return false;
+    }
+    RegisterValidationInterface(gWorkServer.get());
+    LogPrintf("workserver: Listening on 127.0.0.1:%u\n", gWorkServer->GetPort());
+
+    workServerThread = boost::thread(boost::bind(&TraceThread<void (*)()>, "workserver", &WorkServerThread));
+    return true;
+}
+
+uint16_t GetWorkServerPort()
+{
+    return gWorkServer ? gWorkServer->GetPort() : 0;
+}
+
+void InterruptWorkServer()
+{
+    if (gWorkServerBase) {
+        LogPrintf("workserver: Thread interrupt\n");
+        event_base_loopbreak(gWorkServerBase);
+    }
+}
+
+void StopWorkServer()
+{
+    if (gWorkServerBase) {
+        // Let a tip notification in flight finish before its event is freed
+        UnregisterValidationInterface(gWorkServer.get());
+        SyncWithValidationInterfaceQueue();
+        workServerThread.join();
+        gWorkServer.reset();
+        event_base_free(gWorkServerBase);
+        gWorkServerBase = nullptr;
+    }
+}
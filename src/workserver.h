@@ -0,0 +1,40 @@
+// Copyright (c) 2018 The Genesis Official developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+/**
+ * A Stratum-style work server for local pool front ends and miners.
+ *
+ * Rather than a whole block template, each job carries only the header
+ * fields that go into the Equihash input (ZIP 301 mining.notify), and each
+ * connection is given its own leading nonce bytes (NONCE_1) so that workers
+ * search disjoint nonce ranges. Jobs are pushed whenever the tip changes,
+ * and submitted (time, NONCE_2, solution) triples are checked and handed to
+ * ProcessNewBlock.
+ */
+#ifndef GENESIS_WORKSERVER_H
+#define GENESIS_WORKSERVER_H
+
+#include <script/script.h>
+
+#include <stdint.h>
+
+/** Default for -workserverport; 0 leaves the work server off */
+static const int DEFAULT_WORKSERVER_PORT = 0;
+/** Bytes of the header nonce fixed per connection, leaving the rest to the miner */
+static const unsigned int WORKSERVER_NONCE1_SIZE = 4;
+/** Seconds between checks for new mempool transactions worth a fresh job */
+static const int WORKSERVER_REFRESH_INTERVAL = 10;
+
+/**
+ * Listen on 127.0.0.1:nPort, or an ephemeral port if nPort is 0, and pay
+ * the coinbase of every job to scriptPubKey. Returns false if the server
+ * could not be set up.
+ */
+bool StartWorkServer(uint16_t nPort, const CScript& scriptPubKey);
+/** The port the work server listens on, or 0 if it is not running */
+uint16_t GetWorkServerPort();
+void InterruptWorkServer();
+void StopWorkServer();
+
+#endif // GENESIS_WORKSERVER_H